@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <opencv2/core.hpp>
+#include <opencv2/core/affine.hpp>
+#include <ArucoPipeline/ObjectIdentity.hpp>
+
+//Constant acceleration Kalman filter over the position and yaw of every tracked object
+//Each axis (x, y, z, yaw) is filtered independently with a [position, velocity, acceleration] state
+//State is stored as structure of arrays, one entry per slot, so that all the objects are filtered in a single pass without allocation
+class LocationFilter
+{
+public:
+	typedef ObjectData::Clock Clock;
+	typedef ObjectData::TimePoint TimePoint;
+	static constexpr int NumAxes = 4; //x, y, z, yaw
+
+	struct Parameters
+	{
+		std::array<double, NumAxes> JerkNoise = {50, 50, 10, 200}; //Spectral density of the jerk, (m/s³)² or (rad/s³)², per second
+		std::array<double, NumAxes> MeasurementNoise = {1e-5, 1e-5, 1e-5, 1e-3}; //Variance of a measurement, m² or rad²
+		double ResetTime = 0.5; //If an object wasn't seen for this long, seconds, the filter restarts from the measurement
+	};
+
+	Parameters Params;
+
+private:
+	struct AxisState
+	{
+		std::vector<double> Position, Velocity, Acceleration;
+		std::vector<double> P00, P01, P02, P11, P12, P22; //Upper triangle of the covariance
+		std::vector<double> Measurement;
+	};
+
+	std::array<AxisState, NumAxes> Axes;
+	std::vector<TimePoint> LastUpdate;
+	std::vector<uint8_t> HasMeasurement, Initialised;
+	std::vector<double> DeltaTime;
+	std::vector<int> FreeSlots;
+
+public:
+	//Returns the slot to use for an object
+	int Allocate();
+
+	void Release(int Slot);
+
+	//Queue a measurement, it will be used on the next call to Update
+	void SetMeasurement(int Slot, const cv::Affine3d &Location);
+
+	//Predict and correct all the slots that have a measurement
+	void Update(TimePoint Tick);
+
+	//Filtered state at the time of the last update. Returns false if the slot has never been updated.
+	bool GetState(int Slot, cv::Vec4d &Position, cv::Vec4d &Velocity, cv::Vec4d &Acceleration) const;
+
+	//Filtered pose : filtered translation, and measured rotation turned around Z to match the filtered yaw
+	cv::Affine3d GetFilteredLocation(int Slot, const cv::Affine3d &Measured) const;
+
+	static double GetYaw(const cv::Affine3d &Location);
+};
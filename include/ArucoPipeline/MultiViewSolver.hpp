@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <opencv2/core.hpp>
+#include <opencv2/core/affine.hpp>
+
+//Joint pose solver for an object seen by multiple cameras at once
+//Minimises the reprojection error of all the seen corners in all the cameras with a small Levenberg-Marquardt on the 6 DoF of the object
+//Everything is stored in fixed-size arrays and Matx, so that solving does not allocate
+class MultiViewSolver
+{
+public:
+	static constexpr int MaxViews = 8;
+	static constexpr int MaxObservations = 256;
+	static constexpr int MaxDistortionCoefficients = 8; //k1, k2, p1, p2, k3, k4, k5, k6
+
+	struct Result
+	{
+		cv::Affine3d Location; //object to world
+		cv::Matx66d Covariance; //rotation (rad, world axis) then translation (m, world space)
+		double ReprojectionError; //RMS, in pixels
+		int Iterations;
+	};
+
+private:
+	struct View
+	{
+		cv::Matx33d CameraMatrix;
+		cv::Vec<double, MaxDistortionCoefficients> Distortion;
+		cv::Affine3d WorldToCamera;
+	};
+
+	struct Observation
+	{
+		cv::Point3d ObjectPoint; //object space
+		cv::Point2f ImagePoint; //pixels
+		int ViewIndex;
+	};
+
+	std::array<View, MaxViews> Views;
+	std::array<Observation, MaxObservations> Observations;
+	int NumViews = 0;
+	int NumObservations = 0;
+
+public:
+	void Clear()
+	{
+		NumViews = 0;
+		NumObservations = 0;
+	}
+
+	int GetNumViews() const
+	{
+		return NumViews;
+	}
+
+	int GetNumObservations() const
+	{
+		return NumObservations;
+	}
+
+	//Returns the index of the view, or -1 if there are too many views
+	int AddView(const cv::Mat &CameraMatrix, const cv::Mat &DistanceCoefficients, const cv::Affine3d &CameraTransform);
+
+	//Returns false if there are too many observations
+	bool AddObservation(int ViewIndex, const cv::Point3d &ObjectPoint, const cv::Point2f &ImagePoint);
+
+	//Refine the pose starting from Seed (object to world). Returns false if the solve diverged or isn't constrained enough.
+	bool Solve(const cv::Affine3d &Seed, Result &Out, int MaxIterations = 10) const;
+
+private:
+	static cv::Matx33d ExpRotation(const cv::Vec3d &Omega);
+
+	static bool Project(const View &InView, const cv::Vec3d &WorldPoint, cv::Vec2d &Pixel);
+
+	//Sum of the squared reprojection errors. Also fills JtJ and Jtr when they are given.
+	bool Evaluate(const cv::Matx33d &Rotation, const cv::Vec3d &Translation, double &Cost,
+		cv::Matx66d *JtJ = nullptr, cv::Vec6d *Jtr = nullptr) const;
+};
@@ -90,6 +90,17 @@ const std::map<ObjectType, std::string> ObjectTypeNames =
 
 std::ostream& operator << (std::ostream& out, ObjectType Type);
 
+//Filtered motion of an object, x, y, z in m/s (or m/s²) and yaw in rad/s (or rad/s²)
+struct ObjectKinematics
+{
+	cv::Vec4d Velocity = cv::Vec4d::all(0);
+	cv::Vec4d Acceleration = cv::Vec4d::all(0);
+	bool Valid = false;
+
+	//Move the location forward by dt seconds
+	cv::Affine3d Extrapolate(const cv::Affine3d &Location, double dt) const;
+};
+
 struct ObjectData
 {
 	typedef std::chrono::steady_clock Clock;
@@ -99,6 +110,8 @@ struct ObjectData
 	cv::Affine3d location;
 	TimePoint LastSeen;
 	nlohmann::json metadata;
+	ObjectKinematics kinematics;
+	int instance = -1; //Instance number of a non unique object, -1 if the object is unique
 
 	std::vector<ObjectData> Childs;
 
@@ -116,8 +129,13 @@ struct ObjectData
 
 	std::optional<struct GLObject> ToGLObject() const;
 
+	static std::optional<struct GLObject> ToGLObject(ObjectType Type, const cv::Affine3d &Location, const nlohmann::json &Metadata);
+
 	static std::vector<GLObject> ToGLObjects(const std::vector<ObjectData>& data, Clock::duration maxAge = std::chrono::milliseconds(500));
 
+	//Extrapolate the location to the given time using the kinematics, the extrapolation is capped to MaxHorizon
+	cv::Affine3d PredictLocation(TimePoint At, Clock::duration MaxHorizon = std::chrono::milliseconds(250)) const;
+
 	cv::Vec2d GetPos2D() const
 	{
 		return cv::Vec2d(location.translation().val);
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <opencv2/core.hpp>
+#include <ArucoPipeline/ObjectIdentity.hpp>
+
+class ObjectSnapshot;
+
+//Index of the root objects of a tick, partitioned by type then by cell of a grid over the table
+//Built in a single counting sort pass, queries only visit the cells of the wanted type that overlap the query
+class ObjectIndex
+{
+public:
+	struct Entry
+	{
+		cv::Vec2d Position;
+		ObjectData::TimePoint LastSeen;
+		int Index; //In the list the index was built from : ObjectData vector or ObjectSnapshot records
+		CDFRTeam Team; //Found from the name at build, Unknown if the name has no team
+	};
+
+private:
+	static constexpr int NumTypes = (int)ObjectType::Team + 1;
+	cv::Vec2d Origin;
+	double CellSize;
+	int Width, Height, NumCells;
+	std::vector<Entry> Entries; //Sorted by type then cell
+	std::vector<int> CellStart; //Entries of type t in cell c are [CellStart[t*NumCells+c], CellStart[t*NumCells+c+1])
+	//Build scratch
+	std::vector<Entry> Unsorted;
+	std::vector<int> Keys;
+
+	//Clamped as double before the cast, out of range double to int conversion is undefined
+	int GetCellX(double x) const
+	{
+		return std::clamp(std::floor((x - Origin[0]) / CellSize), 0.0, double(Width-1));
+	}
+
+	int GetCellY(double y) const
+	{
+		return std::clamp(std::floor((y - Origin[1]) / CellSize), 0.0, double(Height-1));
+	}
+
+	void Add(ObjectType Type, const cv::Affine3d& Location, ObjectData::TimePoint LastSeen, const std::string& Name, int Index);
+
+	void Sort();
+
+	//Calls Callback(Entry) for the entries of the type in the cells overlapping the box
+	template<class F>
+	void VisitCells(ObjectType Type, cv::Vec2d Min, cv::Vec2d Max, F&& Callback) const
+	{
+		if (CellStart.empty() || !std::isfinite(Min[0]) || !std::isfinite(Min[1]) || !std::isfinite(Max[0]) || !std::isfinite(Max[1]))
+		{
+			return;
+		}
+		int xmin = GetCellX(Min[0]), xmax = GetCellX(Max[0]);
+		int ymin = GetCellY(Min[1]), ymax = GetCellY(Max[1]);
+		int typeoffset = (int)Type*NumCells;
+		for (int y = ymin; y <= ymax; y++)
+		{
+			int rowoffset = typeoffset + y*Width;
+			//cells of a row are contiguous
+			for (int i = CellStart[rowoffset+xmin]; i < CellStart[rowoffset+xmax+1]; i++)
+			{
+				Callback(Entries[i]);
+			}
+		}
+	}
+
+public:
+	ObjectIndex(cv::Vec2d Min = cv::Vec2d(-1.5, -1), cv::Vec2d Max = cv::Vec2d(1.5, 1), double InCellSize = 0.1);
+
+	//Index of the objects, childs are not indexed
+	void Build(const std::vector<ObjectData>& Objects);
+
+	//Index of the root records of the snapshot
+	void Build(const ObjectSnapshot& Snapshot);
+
+	//Calls Callback(Entry) for all the objects of the type
+	template<class F>
+	void ForEach(ObjectType Type, F&& Callback) const
+	{
+		if (CellStart.empty())
+		{
+			return;
+		}
+		for (int i = CellStart[(int)Type*NumCells]; i < CellStart[((int)Type+1)*NumCells]; i++)
+		{
+			Callback(Entries[i]);
+		}
+	}
+
+	//Calls Callback(Entry) for the objects of the type inside the rectangle
+	template<class F>
+	void QueryRect(ObjectType Type, const cv::Rect2d& Rect, F&& Callback) const
+	{
+		VisitCells(Type, cv::Vec2d(Rect.x, Rect.y), cv::Vec2d(Rect.x+Rect.width, Rect.y+Rect.height),
+		[&Rect, &Callback](const Entry& entry)
+		{
+			if (Rect.contains(cv::Point2d(entry.Position)))
+			{
+				Callback(entry);
+			}
+		});
+	}
+
+	//Calls Callback(Entry) for the objects of the type closer than Radius to Center
+	template<class F>
+	void QueryRadius(ObjectType Type, cv::Vec2d Center, double Radius, F&& Callback) const
+	{
+		VisitCells(Type, Center - cv::Vec2d::all(Radius), Center + cv::Vec2d::all(Radius),
+		[&Center, Radius, &Callback](const Entry& entry)
+		{
+			cv::Vec2d delta = entry.Position - Center;
+			if (delta.ddot(delta) < Radius*Radius)
+			{
+				Callback(entry);
+			}
+		});
+	}
+};
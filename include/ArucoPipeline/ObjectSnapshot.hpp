@@ -0,0 +1,113 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <ArucoPipeline/ObjectIdentity.hpp>
+#include <ArucoPipeline/ObjectIndex.hpp>
+
+//Global table of interned strings (object names and metadata keys)
+//Strings are never removed, so IDs stay valid for the lifetime of the program
+class NameTable
+{
+private:
+	mutable std::shared_mutex Mutex;
+	std::deque<std::string> Names; //deque so that references and views stay valid
+	std::unordered_map<std::string_view, uint32_t> Lookup;
+
+	NameTable() = default;
+public:
+	static NameTable& Get();
+
+	uint32_t Intern(std::string_view Name);
+
+	const std::string& GetName(uint32_t ID) const;
+};
+
+//Flat record of an object, no heap memory
+struct ObjectRecord
+{
+	ObjectType Type;
+	uint32_t NameID; //in NameTable
+	int32_t Parent; //Index of the parent record, -1 for root objects. Location is relative to the parent.
+	int32_t Instance; //Instance number of a non unique object, -1 if unique
+	cv::Affine3d Location;
+	ObjectData::TimePoint LastSeen;
+	uint32_t MetadataBegin, MetadataCount; //Range in ObjectSnapshot::Metadata
+	ObjectKinematics Kinematics;
+
+	const std::string& GetName() const
+	{
+		return NameTable::Get().GetName(NameID);
+	}
+
+	cv::Affine3d PredictLocation(ObjectData::TimePoint At, ObjectData::Clock::duration MaxHorizon = std::chrono::milliseconds(250)) const;
+};
+
+//Typed metadata value, stored in a side table of the snapshot
+struct MetadataEntry
+{
+	enum class Kind : uint8_t
+	{
+		Int,
+		Double,
+		Bool,
+		String, //Int is the ID in NameTable
+		DoubleArray //Begin and Count index ObjectSnapshot::ArrayValues
+	};
+	uint32_t KeyID; //in NameTable
+	Kind Type;
+	int64_t Int;
+	double Double;
+	uint32_t Begin, Count;
+};
+
+//All the objects of a tick, stored as contiguous arrays
+//Records of children follow their parent. Clearing keeps the memory, so a reused snapshot does not allocate once warmed up.
+class ObjectSnapshot
+{
+public:
+	std::vector<ObjectRecord> Records;
+	std::vector<MetadataEntry> Metadata;
+	std::vector<double> ArrayValues;
+	ObjectIndex Index; //Spatial index of the root records, for zone queries
+	ObjectData::TimePoint CaptureTime; //Grab time of the frames of the tick
+
+	void Clear();
+
+	//Call once all the records are added
+	void BuildIndex();
+
+	//Adds the object and it's childs, returns the index of the object's record
+	int Add(const ObjectData& Data, int Parent = -1);
+
+	void Add(const std::vector<ObjectData>& Data);
+
+	nlohmann::json GetMetadataJson(const ObjectRecord& Record) const;
+
+	//Conversion to the working format, childs are rebuilt
+	ObjectData ToObjectData(int Index) const;
+
+	//Root objects and their childs
+	std::vector<ObjectData> ToObjectData() const;
+
+	//World space GL objects, childs are placed relative to their parents
+	std::vector<struct GLObject> ToGLObjects(ObjectData::Clock::duration maxAge = std::chrono::milliseconds(500)) const;
+};
+
+//Hands out snapshots that no reader holds anymore, so that publishing a tick does not allocate
+class ObjectSnapshotPool
+{
+private:
+	std::mutex Mutex;
+	std::vector<std::shared_ptr<ObjectSnapshot>> Pool;
+public:
+	//Returns a cleared snapshot
+	std::shared_ptr<ObjectSnapshot> Acquire();
+};
@@ -3,7 +3,11 @@
 #include <opencv2/core.hpp>
 #include <ArucoPipeline/TrackedObject.hpp>
 #include <ArucoPipeline/ArucoTypes.hpp>
+#include <ArucoPipeline/MultiViewSolver.hpp>
+#include <ArucoPipeline/LocationFilter.hpp>
 #include <array>
+#include <cstdint>
+#include <optional>
 
 //Class that handles the objects, and holds information about each tag's size
 //Registered objects will have their locations solved and turned into a vector of ObjectData for display and data sending
@@ -13,6 +17,60 @@ private:
 	std::vector<std::shared_ptr<TrackedObject>> objects;
 	std::array<int, ARUCO_DICT_SIZE> ArucoMap; //Which object owns the tag at index i ? objects[ArucoMap[TagID]]
 	std::array<double, ARUCO_DICT_SIZE> ArucoSizes; //Size of the aruco tag
+	MultiViewSolver Solver; //Joint solve for objects seen by multiple cameras
+	std::vector<TrackedObject::ArucoViewCameraLocal> SeenMarkersScratch;
+	LocationFilter Filter; //Position and yaw filter for all the objects and instances
+
+	//Physical instance of a non unique object, tracked over time
+	struct ObjectInstance
+	{
+		int ID; //Stable for as long as the instance is tracked
+		cv::Affine3d Location;
+		TrackedObject::TimePoint LastSeen;
+		int FilterSlot;
+		std::optional<cv::Matx66d> Covariance; //Set when solved from multiple cameras
+	};
+
+	//Tracking state of each object, kept here as objects can be registered to multiple trackers
+	struct ObjectState
+	{
+		int FilterSlot;
+		std::vector<ObjectInstance> Instances; //Only used if the object is not unique
+		int NextInstanceID = 0;
+	};
+	std::vector<ObjectState> states; //Same indices as objects
+
+	//Scratch storage for the instance association of non unique objects
+	struct InstanceCluster
+	{
+		cv::Affine3d Location; //location of the best candidate, then solved from all the cameras
+		std::optional<cv::Matx66d> Covariance;
+		uint32_t CameraMask;
+		int NumCandidates;
+		std::array<int, MultiViewSolver::MaxViews> Candidates; //in CandidateScratch, best first
+	};
+	struct InstancePair
+	{
+		double Distance;
+		int InstanceIdx, ClusterIdx;
+
+		bool operator<(const InstancePair& other) const
+		{
+			return Distance < other.Distance;
+		}
+	};
+	std::vector<TrackedObject::InstanceCandidate> CandidateScratch;
+	std::vector<InstanceCluster> ClusterScratch;
+	std::vector<InstancePair> PairScratch;
+	std::vector<uint8_t> InstanceAssigned, ClusterAssigned;
+
+public:
+	double MultiViewMaxReprojectionError = 10; //pixels RMS, above that the multi-camera solve is discarded
+	double MultiViewMaxHeightError = 0.03; //m, a multi-camera solve further than that from the expected height of the object is discarded
+	bool FilterLocations = true;
+	double InstanceMergeDistance = 0.08; //m, candidates from different cameras closer than that are the same instance
+	double InstanceGateDistance = 0.3; //m, max distance between the predicted location of an instance and a new detection
+	TrackedObject::Clock::duration InstanceTimeout = std::chrono::seconds(2); //instances not seen for that long are forgotten
 
 public:
 	ObjectTracker(/* args */);
@@ -39,4 +97,15 @@ public:
 private:
 
 	void RegisterArucoRecursive(std::shared_ptr<TrackedObject> object, int index);
+
+	//Track the instances of a non unique object : detections from all the cameras are merged,
+	//then associated to the existing instances with a gated nearest neighbour on the predicted locations
+	void SolveInstances(int ObjIdx, std::vector<CameraFeatureData>& CameraData, 
+		std::vector<std::map<int, ArucoCornerArray>> &ReprojectedCorners, TrackedObject::TimePoint Tick);
+
+	//Is the multi-camera solve good enough to be used ? Checks the reprojection error and the expected height
+	bool IsMultiViewSolveValid(const TrackedObject &object, const MultiViewSolver::Result &solved) const;
+
+	//Joint solve of an instance seen by several cameras, seeded with the best candidate
+	bool SolveCluster(TrackedObject &object, const std::vector<CameraFeatureData>& CameraData, InstanceCluster &cluster);
 };
\ No newline at end of file
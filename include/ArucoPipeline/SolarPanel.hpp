@@ -34,6 +34,12 @@ public:
 
 	virtual bool SetLocation(cv::Affine3d InLocation, TimePoint Tick) override;
 
+	//Each panel rotates on its own
+	virtual bool HasRigidLocation() const override
+	{
+		return false;
+	}
+
 	virtual std::vector<ObjectData> ToObjectData() const override;
 
 	virtual std::vector<std::vector<cv::Point3d>> GetPointsOfInterest() const override;
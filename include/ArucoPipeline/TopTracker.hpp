@@ -9,12 +9,25 @@ class TopTracker : public TrackedObject
 private:
 	std::optional<double> ExpectedHeight;
 	bool Robot;
+
+	//Solve the location of a single seen tag, relative to the camera
+	cv::Affine3d SolveMarker(const CameraFeatureData& CameraData, const ArucoViewCameraLocal &marker, float& ReprojectionError, 
+		std::map<int, ArucoCornerArray> &ReprojectedCorners) const;
 public:
 	TopTracker(int MarkerIdx, double MarkerSize, std::string InName, std::optional<double> InExpectedHeight, bool InRobot);
 	~TopTracker();
 
 	virtual cv::Affine3d GetObjectTransform(const CameraFeatureData& CameraData, float& Surface, float& ReprojectionError, 
 		std::map<int, ArucoCornerArray> &ReprojectedCorners) override;
+
+	//Each seen tag is a different instance
+	virtual void GetInstanceCandidates(const CameraFeatureData& CameraData, int CameraIdx, std::vector<InstanceCandidate> &Candidates, 
+		std::map<int, ArucoCornerArray> &ReprojectedCorners) override;
 		
+	virtual std::optional<double> GetExpectedHeight() const override
+	{
+		return ExpectedHeight;
+	}
+
 	virtual std::vector<ObjectData> ToObjectData() const override;
 };
\ No newline at end of file
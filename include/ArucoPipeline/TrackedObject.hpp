@@ -1,8 +1,9 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
+#include <optional>
 #include <opencv2/core.hpp>				// Basic OpenCV structures (Mat, Scalar)
-#include <opencv2/video/tracking.hpp>	//Kalman filter
 #include <ArucoPipeline/ObjectIdentity.hpp>
 #include <Communication/ProcessedTypes.hpp>
 
@@ -19,7 +20,7 @@ public:
 	cv::Affine3d Pose; //Location relative to it's parent
 
 private:
-	mutable std::array<cv::Point3d, 4> ObjectPointsNoOffset;
+	std::array<cv::Point3d, 4> ObjectPointsNoOffset;
 
 public:
 	static std::array<cv::Point3d, 4> GetObjectPointsNoOffset(double SideLength);
@@ -29,7 +30,8 @@ public:
 	ArucoMarker()
 		:sideLength(0.05),
 		number(-1),
-		Pose(cv::Affine3d::Identity())
+		Pose(cv::Affine3d::Identity()),
+		ObjectPointsNoOffset(GetObjectPointsNoOffset(0.05))
 	{}
 
 	ArucoMarker(double InSideLength, int InNumber)
@@ -59,10 +61,22 @@ public:
 	{
 		cv::Affine3d AccumulatedTransform; //transform to marker, not including the marker's transform relative to it's parent
 		ArucoMarker* Marker; //pointer to source marker
-		ArucoCornerArray CameraCornerPositions; //corner positions, in space relative to the calling object's coordinates
-		std::vector<cv::Point3d> LocalMarkerCorners; //corner positions in camera image space
+		const ArucoCornerArray* CameraCornerPositions; //corner positions in camera image space, points into the CameraFeatureData
+		const cv::Point3d* LocalMarkerCorners; //ARUCO_CORNERS_PER_TAG corner positions, in space relative to the calling object's coordinates, points into the geometry cache
 		int IndexInCameraData; //index where this marker was found in the camera
 	};
+
+	//Possible location of one instance of this object, seen by a single camera
+	struct InstanceCandidate
+	{
+		static constexpr int MaxMarkers = 8;
+		cv::Affine3d Location; //world space
+		float Surface;
+		float ReprojectionError;
+		int CameraIdx;
+		int NumMarkers = 0;
+		std::array<int, MaxMarkers> MarkerIndices; //IndexInCameraData of the tags it was solved from, for the multi-camera solve
+	};
 public:
 	std::vector<ArucoMarker> markers; //Should be populated before adding to the Object Tracker
 	std::vector<std::shared_ptr<TrackedObject>> childs; //Should be populated before adding to the Object Tracker
@@ -73,16 +87,36 @@ public:
 protected:
 	cv::Affine3d Location;
 	TimePoint LastSeenTick;
-	cv::KalmanFilter LocationFilter;
+	std::optional<cv::Matx66d> LocationCovariance; //Set when solved from multiple cameras, rotation then translation
+
+	//Geometry cache of all the markers of this object and it's childs, built once as markers and childs do not move after registration
+	struct CachedMarker
+	{
+		ArucoMarker* Marker;
+		cv::Affine3d AccumulatedTransform; //transform to the marker's parent
+	};
+	bool GeometryCacheBuilt = false;
+	std::vector<CachedMarker> CachedMarkers;
+	std::vector<cv::Point3d> CachedCorners; //ARUCO_CORNERS_PER_TAG corners per cached marker, in this object's space
+	std::array<int16_t, ARUCO_DICT_SIZE> CachedMarkerIndex; //Tag ID to index in CachedMarkers, -1 if the tag isn't on this object
 
 public:
 
 	TrackedObject();
 
-	//Set location. Bypass kalman filter if tick is UINT64_MAX
+	//Set location and the time it was seen at. Filtering is done in batch by the ObjectTracker
 	virtual bool SetLocation(cv::Affine3d InLocation, TimePoint Tick);
 	TimePoint GetLastSeenTick() const { return LastSeenTick; }
 
+	void SetLocationCovariance(std::optional<cv::Matx66d> InCovariance) { LocationCovariance = InCovariance; }
+	const std::optional<cv::Matx66d>& GetLocationCovariance() const { return LocationCovariance; }
+
+	//Can the location be solved as a single rigid body from all the cameras at once ?
+	virtual bool HasRigidLocation() const { return true; }
+
+	//Height the object is known to be at (world space, m), checked after the multi-camera solve
+	virtual std::optional<double> GetExpectedHeight() const { return std::nullopt; }
+
 	virtual bool ShouldBeDisplayed(TimePoint Tick) const;
 	virtual cv::Affine3d GetLocation() const;
 
@@ -92,8 +126,12 @@ public:
 	//Returns all the corners in 3D space of this object and it's childs, with the marker ID. Does not clear the array at start.
 	virtual void GetObjectPoints(std::vector<std::vector<cv::Point3d>>& MarkerCorners, std::vector<int>& MarkerIDs, cv::Affine3d rootTransform = cv::Affine3d::Identity(), std::vector<int> filter = {});
 
+	//Precompute the corners of all the markers of this object and it's childs. Called by the ObjectTracker at registration, or on first use.
+	void BuildGeometryCache();
+
 	//Returns the surface area, markers that are seen by the camera that belong to this object or it's childs are stored in MarkersSeen
-	virtual float GetSeenMarkers(const CameraFeatureData& CameraData, std::vector<ArucoViewCameraLocal> &MarkersSeen, cv::Affine3d AccumulatedTransform = cv::Affine3d::Identity());
+	//Does not clear MarkersSeen
+	virtual float GetSeenMarkers(const CameraFeatureData& CameraData, std::vector<ArucoViewCameraLocal> &MarkersSeen);
 
 	float ReprojectSeenMarkers(const std::vector<ArucoViewCameraLocal> &MarkersSeen, const cv::Mat &rvec, const cv::Mat &tvec, 
 		const CameraFeatureData &CameraData, std::map<int, ArucoCornerArray> &ReprojectedCorners);
@@ -104,6 +142,15 @@ public:
 	virtual cv::Affine3d GetObjectTransform(const CameraFeatureData& CameraData, float& Surface, float& ReprojectionError, 
 		std::map<int, ArucoCornerArray> &ReprojectedCorners);
 
+	//Same as GetObjectTransform, using only the given markers. SeenMarkers can be modified.
+	cv::Affine3d SolveSeenMarkers(const CameraFeatureData& CameraData, std::vector<ArucoViewCameraLocal> &SeenMarkers, float& ReprojectionError, 
+		std::map<int, ArucoCornerArray> &ReprojectedCorners);
+
+	//Used for non unique objects : a camera can see several instances of the object at once
+	//Default implementation gives a single candidate using GetObjectTransform
+	virtual void GetInstanceCandidates(const CameraFeatureData& CameraData, int CameraIdx, std::vector<InstanceCandidate> &Candidates, 
+		std::map<int, ArucoCornerArray> &ReprojectedCorners);
+
 	virtual std::vector<ObjectData> GetMarkersAndChilds() const;
 
 	virtual std::vector<ObjectData> ToObjectData() const;
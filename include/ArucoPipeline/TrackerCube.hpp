@@ -6,10 +6,15 @@
 class TrackerCube : public TrackedObject
 {
 private:
+	double Diameter;
 
 public:
-	TrackerCube(std::vector<int> MarkerIdx, double MarkerSize, double Diameter, cv::String InName);
+	TrackerCube(std::vector<int> MarkerIdx, double MarkerSize, double InDiameter, cv::String InName);
 	~TrackerCube();
 
+	//Tags are grouped by the center of the cube they imply, each group is a different cube
+	virtual void GetInstanceCandidates(const CameraFeatureData& CameraData, int CameraIdx, std::vector<InstanceCandidate> &Candidates, 
+		std::map<int, ArucoCornerArray> &ReprojectedCorners) override;
+
 	virtual std::vector<ObjectData> ToObjectData() const override;
 };
\ No newline at end of file
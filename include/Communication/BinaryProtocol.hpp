@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+//Binary framing of the json api, selected per client with CONFIG {"data": {"framing": "BINARY"}}
+//Queries are still json lines, responses are packets : a PacketHeader followed by Length bytes of payload.
+//All values are little endian and the structures are packed, so they can be read in place by a microcontroller.
+namespace BinaryProtocol
+{
+	static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "The binary protocol is written from memory, big endian hosts need swapping");
+
+	constexpr uint16_t Magic = 0xC7C1;
+	constexpr uint8_t Version = 2; //2 : ObjectEntry::Instance is 32 bits
+
+	enum class PacketType : uint8_t
+	{
+		Json = 0, //Json response as in the text protocol, without the newline. Empty payload for keep alive.
+		Names = 1, //NameEntry followed by its characters (no terminator), repeated. Names are only sent once per connection.
+		Objects = 2, //ObjectsHeader, then NumObjects ObjectEntry
+		Features = 3, //FeaturesHeader, then per camera : CameraEntry, NumAruco ArucoEntry, NumYolo YoloEntry
+		Image = 4 //ImageHeader, then the JPEG file. One packet per camera.
+	};
+
+#pragma pack(push, 1)
+	struct PacketHeader
+	{
+		uint16_t Magic;
+		uint8_t Version;
+		uint8_t Type; //PacketType
+		uint32_t Length; //Payload bytes after this header
+	};
+
+	struct NameEntry
+	{
+		uint32_t ID;
+		uint16_t Length;
+	};
+
+	struct ObjectsHeader
+	{
+		int32_t Index; //"index" of the query, -1 if none or for subscription updates
+		uint32_t Tick; //Subscription tick, 0 for queries
+		uint16_t NumObjects;
+		uint16_t Reserved;
+	};
+
+	struct ObjectEntry
+	{
+		uint8_t Type; //ObjectType, in the order of ArucoPipeline/ObjectIdentity.hpp
+		uint8_t Reserved[3];
+		int32_t Instance; //-1 if the object is unique, never negative otherwise
+		uint32_t NameID; //Sent in a Names packet before its first use
+		float Position[3]; //m, world space, centered on the table
+		float Rotation[4]; //Quaternion w x y z
+		uint32_t Age; //ms since last seen
+	};
+
+	struct FeaturesHeader
+	{
+		int32_t Index;
+		uint32_t Tick;
+		uint16_t NumCameras;
+		uint16_t Reserved;
+	};
+
+	struct CameraEntry
+	{
+		uint32_t NameID;
+		uint16_t Width, Height; //pixels
+		float XFov, YFov; //degrees
+		uint16_t NumAruco, NumYolo;
+	};
+
+	struct ArucoEntry
+	{
+		uint16_t Index; //Tag number
+		int16_t Corners[4][2]; //x y, pixels
+	};
+
+	struct YoloEntry
+	{
+		uint8_t Class;
+		uint8_t Confidence; //percent
+		int16_t TLX, TLY, BRX, BRY; //pixels
+	};
+
+	struct ImageHeader
+	{
+		int32_t Index; //"index" of the query, -1 if none
+		uint32_t NameID; //Camera name
+		uint16_t Width, Height; //pixels, after reduction
+		uint16_t CameraIndex, NumCameras; //The response is complete once NumCameras images are received
+	};
+#pragma pack(pop)
+
+	static_assert(sizeof(PacketHeader) == 8);
+	static_assert(sizeof(ObjectEntry) == 44);
+	static_assert(sizeof(CameraEntry) == 20);
+
+	//Appends packets to a buffer. The buffer is kept by the caller and reused, so no allocation once warmed up.
+	class Writer
+	{
+	private:
+		std::vector<uint8_t> &Buffer;
+		size_t PacketStart = 0;
+	public:
+		Writer(std::vector<uint8_t> &InBuffer)
+			:Buffer(InBuffer)
+		{}
+
+		size_t GetOffset() const
+		{
+			return Buffer.size();
+		}
+
+		void Write(const void* Data, size_t Length)
+		{
+			size_t pos = Buffer.size();
+			Buffer.resize(pos + Length);
+			if (Length > 0)
+			{
+				memcpy(&Buffer[pos], Data, Length);
+			}
+		}
+
+		template<class T>
+		void Write(const T &Value)
+		{
+			Write(&Value, sizeof(T));
+		}
+
+		//Overwrites a value written earlier, to fill counts once known
+		template<class T>
+		void WriteAt(size_t Offset, const T &Value)
+		{
+			memcpy(&Buffer[Offset], &Value, sizeof(T));
+		}
+
+		void BeginPacket(PacketType Type)
+		{
+			PacketStart = Buffer.size();
+			PacketHeader header{Magic, Version, (uint8_t)Type, 0};
+			Write(header);
+		}
+
+		void EndPacket()
+		{
+			uint32_t length = Buffer.size() - PacketStart - sizeof(PacketHeader);
+			WriteAt(PacketStart + offsetof(PacketHeader, Length), length);
+		}
+	};
+
+	//Finds the first packet in Data. Returns the number of bytes it takes, 0 if incomplete, -1 if the stream is corrupted.
+	inline long ReadPacket(const uint8_t* Data, size_t Size, PacketHeader &Header, const uint8_t* &Payload)
+	{
+		if (Size < sizeof(PacketHeader))
+		{
+			return 0;
+		}
+		memcpy(&Header, Data, sizeof(PacketHeader));
+		if (Header.Magic != Magic || Header.Version != Version)
+		{
+			return -1;
+		}
+		if (Size < sizeof(PacketHeader) + Header.Length)
+		{
+			return 0;
+		}
+		Payload = Data + sizeof(PacketHeader);
+		return sizeof(PacketHeader) + Header.Length;
+	}
+}
@@ -4,13 +4,17 @@
 #include <thread>
 #include <vector>
 #include <set>
+#include <map>
+#include <memory>
 #include <chrono>
 #include <opencv2/core/affine.hpp>
 #include <nlohmann/json.hpp>
 #include <ArucoPipeline/ObjectIdentity.hpp>
-#include <Misc/Task.hpp>
+#include <Communication/ProcessedTypes.hpp>
+#include <Communication/LineFramer.hpp>
+#include <Communication/Transport/TCPTransport.hpp>
+#include <Cameras/ImageTypes.hpp>
 
-class TCPTransport;
 
 //Get Cameras
 //Get image from camera #
@@ -23,14 +27,90 @@ class TCPTransport;
 //	-stated
 
 class TCPJsonHost;
+class ObjectSnapshot;
+namespace BinaryProtocol
+{
+	class Writer;
+}
+
+//Camera image compressed for the IMAGE action
+struct EncodedImage
+{
+	cv::Size Size;
+	std::vector<uchar> Jpeg;
+	std::string Base64; //Only for json clients, encoded on first use
+};
+
+//Data of a detection tick, shared by all the listeners for queries and subscription updates
+struct JsonTick
+{
+	uint64_t Index = 0;
+	std::shared_ptr<const ObjectSnapshot> Snapshot;
+	std::vector<CameraFeatureData> FeatureData;
+	bool HasImages = false; //Images are only fetched when asked for
+	std::vector<CameraImageData> ImageData;
+	std::map<std::pair<size_t, int>, EncodedImage> Images; //By camera index and reduction in percent
+	std::map<std::string, std::string> Serialized; //Dumped "data" fields already built this tick, by filters, mode, predict and max age
+};
 
-class JsonListener : public Task
+//Handles the queries of a single client. Driven by the TCPJsonHost event loop, it has no thread of its own.
+class JsonListener
 {
 private:
-	std::vector<char> ReceiveBuffer;
+	LineFramer Framer; //Incoming queries, one per line
+	size_t ReportedDroppedFrames = 0;
+	bool killed = false;
+	bool Closing = false; //No more queries are read, the connection is closed once the queued output is sent
+
+	//"Received action" logs are limited to one per interval, the others are counted
+	std::chrono::duration<double> ActionLogInterval;
+	std::chrono::steady_clock::time_point LastActionLog;
+	size_t SkippedActionLogs = 0;
+
+	//Fields of a DATA query, read without building the json document.
+	//Kept between queries so that the strings are reused.
+	struct DataQuery
+	{
+		std::string Action;
+		bool HasIndex = false;
+		int64_t Index = 0;
+		bool HasFilters = false;
+		std::vector<std::string> Filters;
+		size_t NumFilters = 0;
+		int MaxAge = 0;
+		bool Predict = true;
+		bool Supported = true; //False if the query has something only the full parse handles
+	};
+	DataQuery FastQuery;
+	class DataQuerySax; //Fills FastQuery
+	std::vector<std::string> LastFilters; //Filters of the last fast DATA query, and the types they gave
+	std::set<ObjectType> LastAllowedTypes;
+	std::string ResponseBuffer; //Reused for the DATA responses
+	std::string SerializedKey; //Reused for the lookups in JsonTick::Serialized
+
+	//Data pushed to the client after every tick, set with SUBSCRIBE
+	struct Subscription
+	{
+		std::set<ObjectType> AllowedTypes;
+		int MaxAge = 0; //ms, 0 to send everything
+		bool Predict = true;
+		bool Delta = false; //Only send the objects that changed since the last update, and the ones that disappeared
+		std::chrono::steady_clock::duration MinInterval = std::chrono::steady_clock::duration(0); //Rate limit
+		std::chrono::steady_clock::time_point LastSent;
+		std::map<std::string, nlohmann::json> LastObjects; //Delta mode : objects of the last update without their age, by identity
+	};
+	std::unique_ptr<Subscription> Subscribed;
+
+	//Binary framing, see Communication/BinaryProtocol.hpp
+	bool BinaryFraming = false;
+	std::vector<uint8_t> BinaryBuffer; //Reused between packets
+	size_t BinaryNamesLength = 0; //Names packet at the start of BinaryBuffer, from SerializeBinary
+	std::vector<uint32_t> BinaryCameraNames; //Name ID of each camera, reused between packets
+	std::vector<uint8_t> SentNames; //By NameTable ID, names already sent to the client
 public:
 	TCPTransport *Transport = nullptr;
-	std::string ClientName = "none";
+	TCPTransport::ConnectionHandle Handle; //Everything sent or received goes through it
+	std::string ClientName = "none"; //For logs
 	TCPJsonHost *Parent = nullptr;
 	std::chrono::steady_clock::time_point LastAliveSent, LastAliveReceived;
 	enum class TransformMode
@@ -47,7 +127,7 @@ public:
 	TransformMode ObjectMode = TransformMode::Millimeter2D;
 
 
-	JsonListener(TCPTransport* InTransport, std::string InClientName, class TCPJsonHost* InParent);
+	JsonListener(TCPTransport* InTransport, TCPTransport::ConnectionHandle InHandle, class TCPJsonHost* InParent);
 
 	~JsonListener();
 
@@ -56,24 +136,101 @@ public:
 		return killed;
 	}
 
+	void Kill()
+	{
+		killed = true;
+	}
+
+	//The client won't send anything more, but the replies already queued are still sent
+	void Close()
+	{
+		Closing = true;
+	}
+
+	bool IsClosing() const
+	{
+		return Closing;
+	}
+
+	//Killed, or closing with nothing left to send
+	bool IsDone() const
+	{
+		return killed || (Closing && !HasPendingOutput());
+	}
+
+	//Reads everything available from the client and handles the complete queries
+	void OnReadable();
+
+	//Sends what the socket couldn't take earlier
+	void OnWritable();
+
+	bool HasPendingOutput() const;
+
+	//Pokes the client if it's been quiet, kills the listener if it stays quiet
+	void CheckAlive();
+
+	bool IsSubscribed() const
+	{
+		return Subscribed != nullptr;
+	}
+
+	//Pushes the tick to the client if subscribed and not rate limited
+	void OnTick(JsonTick &Tick);
+
 private:
 
 	static CDFRTeam StringToTeam(std::string team);
 
-	nlohmann::json ObjectToJson(const struct ObjectData& Object);
+	//If Predict is true, the location is extrapolated to now using the object's kinematics
+	nlohmann::json ObjectToJson(const class ObjectSnapshot& Snapshot, const struct ObjectRecord& Object, bool Predict = false);
 
 	static std::string JavaCapitalize(std::string source);
 
+	//Capitalized names, computed once per type and once per name
+	static const std::string& GetJavaTypeName(ObjectType Type);
+
+	static const std::string& GetJavaName(uint32_t NameID);
+
 	std::set<ObjectType> GetFilterClasses(const nlohmann::json &filter);
 
+	static std::set<ObjectType> GetFilterClasses(const std::set<std::string> &FilterStrings);
+
+	//Filters of FastQuery, only looked up again when they change
+	const std::set<ObjectType>& GetFastFilterClasses();
+
 	ObjectData::TimePoint GetCutoffTime(const nlohmann::json &Query);
 
-	//Get data from external monitor
-	bool GetData(const nlohmann::json &Query, nlohmann::json &Response);
+	//Fills Data with the objects ("data3D") and camera features ("data2D") that pass the filters
+	void SerializeData(const ObjectSnapshot &Snapshot, const std::vector<CameraFeatureData> &FeatureData, 
+		const std::set<ObjectType> &AllowedTypes, ObjectData::TimePoint OldCutoff, bool Predict, nlohmann::json &Data);
+
+	static constexpr int MaxAgeBucket = 10; //ms, queries with max ages in the same bucket share the serialized data
+
+	//Dumped "data" field for these filters, serialized once per tick for all the clients
+	const std::string& GetSerializedData(JsonTick &Tick, const std::set<ObjectType> &AllowedTypes, int MaxAge, bool Predict);
+
+	//Adds the name to the Names packet if the client doesn't know it yet. Opens the packet if HasNames is false.
+	void WriteName(BinaryProtocol::Writer &writer, uint32_t NameID, bool &HasNames);
+
+	//Same as SerializeData, as binary Names, Objects and Features packets in BinaryBuffer
+	void SerializeBinary(int32_t Index, uint32_t Tick, const ObjectSnapshot &Snapshot, const std::vector<CameraFeatureData> &FeatureData, 
+		const std::set<ObjectType> &AllowedTypes, ObjectData::TimePoint OldCutoff, bool Predict);
+
+	//Get data from external monitor. Sends the response itself if the query is valid.
+	bool GetData(const nlohmann::json &Query);
+
+	//Sends the DATA response. Index is the dumped "index" of the query, empty if none.
+	void SendData(const std::set<ObjectType> &AllowedTypes, int MaxAge, bool Predict, int32_t BinaryIndex, std::string_view Index);
+
+	bool Subscribe(const nlohmann::json &Query, nlohmann::json &Response);
 
 	bool GetZone(const nlohmann::json &Query, nlohmann::json &Response);
 
-	bool GetImage(double reduction, nlohmann::json &Response);
+	//Compressed image of a camera at a reduction, encoded once per tick for all the clients
+	EncodedImage& GetEncodedImage(JsonTick &Tick, size_t CameraIndex, double Reduction);
+
+	//Sends the response itself : json with base64 images, or one Image packet per camera in binary
+	bool GetImage(const nlohmann::json &Query);
 
 	bool GetStartingZone(const nlohmann::json query, nlohmann::json &response);
 
@@ -85,11 +242,17 @@ private:
 
 	bool IsQuery(const nlohmann::json &object);
 
-	void HandleJson(const std::string &command);
+	void LogAction(std::string_view Frame);
 
+	//Answers DATA queries straight from the frame, hands the others to HandleJson
+	void HandleFrame(std::string_view Frame);
+
+	void HandleJson(std::string_view Frame);
+
+	//Droppable data is dropped if the client doesn't keep up, for subscription updates
 	void SendJson(const nlohmann::json &object);
 
-	void CheckAlive();
+	void SendBinary(bool Droppable = false);
 
-	virtual void ThreadEntryPoint() override;
+	void SendRaw(const std::string &Buffer, bool Droppable = false);
 };
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+//Splits a byte stream into newline terminated frames, in a ring buffer allocated once.
+//Data is received directly into the ring, and frames are handed out as views, so nothing is copied or allocated per frame.
+//A frame longer than the max size is dropped up to its newline, the connection is kept.
+class LineFramer
+{
+private:
+	std::vector<char> Ring; //Power of two sized
+	size_t Mask;
+	size_t MaxFrameSize;
+	//Monotonic positions, wrapped with Mask : Head is the start of the current frame, Tail the end of the received data
+	size_t Head = 0, Tail = 0;
+	size_t ScanPos = 0; //Bytes before this one were already checked for a newline
+	bool Skipping = false; //Dropping an oversized frame until its newline
+	size_t DroppedFrames = 0;
+	std::string Unwrapped; //Frames that wrap around the end of the ring are copied here, reserved to the max size
+
+public:
+	LineFramer(size_t InMaxFrameSize);
+
+	//Contiguous free space to receive into. Available is 0 if the ring is full.
+	char* GetWriteSpace(size_t &Available);
+
+	//Length bytes were written at GetWriteSpace
+	void CommitWrite(size_t Length);
+
+	//Next complete frame without its newline (and carriage return). The view is valid until the next call to the framer.
+	bool NextFrame(std::string_view &Frame);
+
+	size_t GetDroppedFrames() const
+	{
+		return DroppedFrames;
+	}
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <Communication/Transport/UDPTransport.hpp>
+
+class ObjectSnapshot;
+
+//Datagram sent on every interface's broadcast address after each detection tick, with the robots and PAMIs.
+//Same conventions as the binary json framing : little endian, packed. A PositionHeader then NumObjects PositionEntry.
+//UDP has no head of line blocking : a lost packet is just replaced by the next one.
+namespace PositionProtocol
+{
+	constexpr uint16_t Magic = 0xC7C3;
+	constexpr uint8_t Version = 2; //2 : PositionEntry::Instance is 32 bits
+
+#pragma pack(push, 1)
+	struct PositionHeader
+	{
+		uint16_t Magic;
+		uint8_t Version;
+		uint8_t NumObjects; //Objects past 255 are not sent
+		uint32_t Sequence; //+1 per tick, packets older than the last one received should be dropped
+		uint64_t CaptureTime; //us, monotonic clock of the sender, grab time of the frames the positions come from
+		uint32_t SendDelay; //us from capture to send, to tell how old the data is on arrival
+	};
+
+	struct PositionEntry
+	{
+		uint8_t Type; //ObjectType, Robot or Pami
+		uint8_t Team; //CDFRTeam
+		uint16_t Age; //ms since last seen, at capture
+		int32_t Instance; //-1 if the object is unique, never negative otherwise
+		char Name[12]; //Zero padded, not terminated if 12 long
+		float X, Y; //m, centered on the table
+		float Yaw; //rad, rotation around Z
+	};
+#pragma pack(pop)
+
+	static_assert(sizeof(PositionHeader) == 20);
+	static_assert(sizeof(PositionEntry) == 32);
+}
+
+class PositionBroadcaster
+{
+private:
+	std::vector<std::unique_ptr<UDPTransport>> Transports; //One per network interface
+	uint32_t Sequence = 0;
+	bool WarnedTooMany = false;
+	std::vector<uint8_t> Buffer; //Reused between ticks
+public:
+	PositionBroadcaster(int Port);
+
+	//Sends the robots and PAMIs of the tick. Called from the detection thread, so it only does a few sendto.
+	void Publish(const ObjectSnapshot &Snapshot);
+};
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <chrono>
 #include <opencv2/core.hpp>
 #include <opencv2/core/affine.hpp>
 #include <ArucoPipeline/ArucoTypes.hpp>
@@ -11,6 +12,16 @@ struct YoloDetection
 	cv::Rect2f Corners;
 	int Class;
 	float Confidence;
+	bool BottomCut = false; //Bottom on the bottom edge of the tile it was found in, inside the frame : the object may go further down
+};
+
+//Yolo detection placed on the table
+struct YoloProjection
+{
+	cv::Vec2d Position; //World space, on the table
+	int Class;
+	float Confidence;
+	const std::string* Name; //Class name, owned by the detector
 };
 
 struct CameraFeatureData
@@ -27,7 +38,9 @@ struct CameraFeatureData
 	std::vector<int> ArucoIndices; 						//Filled by ArucoDetect
 	std::vector<cv::Rect> ArucoSegments;				//Filled by ArucoDetect
 
-	std::vector<YoloDetection> YoloDetections; 	//Filled by YoloDetect
+	std::vector<YoloDetection> YoloDetections; 	//Filled by YoloDetect or YoloInferenceService
+	std::chrono::steady_clock::time_point YoloGrabTime; //Grab time of the frame the yolo detections come from, can be older than the aruco data
+	std::vector<YoloProjection> YoloProjections; //Filled by YoloDetect::Project
 
 	void Clear();
 	void CopyEssentials(const struct CameraImageData &source);
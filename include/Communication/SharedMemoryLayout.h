@@ -0,0 +1,180 @@
+#pragma once
+
+/*
+ * Layout of the shared memory endpoint, for consumers on the same machine as cyclops.
+ * Plain C so that it can be used from any language with a C FFI, see tools/shm_reader.c for an example.
+ *
+ * cyclops creates the object CYCLOPS_SHM_NAME (shm_open) holding a cyclops_shm_region.
+ * After each detection tick it writes the objects and camera features to the next slot of a small ring,
+ * under that slot's seqlock, then points "latest" to it. Readers copy the latest slot and retry if its sequence
+ * changed while they were reading : no lock, no syscall on the read path.
+ * Readers that want to sleep until the next tick can futex wait on "tick_futex" (cyclops_shm_wait).
+ *
+ * Times are in microseconds of CLOCK_MONOTONIC, which is the same clock for all the processes of the machine.
+ * Needs POSIX and syscall() : with a strict -std=c11, define _GNU_SOURCE before including.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CYCLOPS_SHM_NAME "/cyclops"
+#define CYCLOPS_SHM_MAGIC 0x43594331u /* "CYC1" */
+#define CYCLOPS_SHM_VERSION 2u /* 2 : 32 bit instance */
+
+#define CYCLOPS_SHM_SLOTS 4
+#define CYCLOPS_SHM_MAX_OBJECTS 256
+#define CYCLOPS_SHM_MAX_CAMERAS 8
+#define CYCLOPS_SHM_MAX_ARUCO 64
+#define CYCLOPS_SHM_MAX_YOLO 64
+#define CYCLOPS_SHM_NAME_LENGTH 32
+#define CYCLOPS_SHM_READ_RETRIES 1000 /* a writer that died mid-write leaves its slot odd, readers give up after that many tries */
+
+/* Root object of the tick. type and team are the ObjectType and CDFRTeam enums of ArucoPipeline/ObjectIdentity.hpp */
+typedef struct
+{
+	uint8_t type;
+	uint8_t team;
+	uint16_t reserved;
+	int32_t instance; /* -1 if the object is unique, never negative otherwise */
+	char name[CYCLOPS_SHM_NAME_LENGTH]; /* zero padded, not terminated if full */
+	float position[3]; /* m, world space, centered on the table */
+	float rotation[4]; /* quaternion w x y z */
+	uint32_t age_ms; /* since last seen, at capture */
+} cyclops_shm_object;
+
+typedef struct
+{
+	uint16_t index; /* tag number */
+	int16_t corners[4][2]; /* x y, pixels */
+} cyclops_shm_aruco;
+
+typedef struct
+{
+	uint8_t class_id;
+	uint8_t confidence; /* percent */
+	int16_t tlx, tly, brx, bry; /* pixels */
+} cyclops_shm_yolo;
+
+typedef struct
+{
+	char name[CYCLOPS_SHM_NAME_LENGTH];
+	uint16_t width, height; /* pixels */
+	float x_fov, y_fov; /* degrees */
+	uint16_t num_aruco, num_yolo;
+	cyclops_shm_aruco aruco[CYCLOPS_SHM_MAX_ARUCO];
+	cyclops_shm_yolo yolo[CYCLOPS_SHM_MAX_YOLO];
+} cyclops_shm_camera;
+
+/* Data of a tick, what readers copy out */
+typedef struct
+{
+	uint64_t tick; /* increasing tick number */
+	uint64_t capture_time_us; /* grab time of the frames */
+	uint64_t publish_time_us; /* when the writer finished the slot */
+	uint32_t num_objects, num_cameras;
+	cyclops_shm_object objects[CYCLOPS_SHM_MAX_OBJECTS];
+	cyclops_shm_camera cameras[CYCLOPS_SHM_MAX_CAMERAS];
+} cyclops_shm_frame;
+
+typedef struct
+{
+	uint32_t sequence; /* seqlock : odd while the slot is being written */
+	uint32_t reserved;
+	cyclops_shm_frame frame;
+} cyclops_shm_slot;
+
+typedef struct
+{
+	uint32_t magic; /* CYCLOPS_SHM_MAGIC once the region is initialised */
+	uint32_t version; /* CYCLOPS_SHM_VERSION */
+	uint64_t size; /* sizeof(cyclops_shm_region) of the writer, readers must check it against theirs */
+	uint32_t latest; /* slot of the latest complete tick */
+	uint32_t tick_futex; /* incremented after every tick, futex word */
+	uint32_t waiters; /* readers in cyclops_shm_wait, the writer only wakes if there are some */
+	uint32_t reserved;
+	cyclops_shm_slot slots[CYCLOPS_SHM_SLOTS];
+} cyclops_shm_region;
+
+static inline uint64_t cyclops_shm_now_us(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+}
+
+/* Writer side : returns the slot to fill, marked as being written */
+static inline cyclops_shm_frame* cyclops_shm_begin_write(cyclops_shm_region* region)
+{
+	uint32_t next = (__atomic_load_n(&region->latest, __ATOMIC_RELAXED) + 1) % CYCLOPS_SHM_SLOTS;
+	cyclops_shm_slot* slot = &region->slots[next];
+	__atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return &slot->frame;
+}
+
+/* Writer side : publishes the slot filled since cyclops_shm_begin_write, and wakes the waiting readers */
+static inline void cyclops_shm_end_write(cyclops_shm_region* region)
+{
+	uint32_t next = (__atomic_load_n(&region->latest, __ATOMIC_RELAXED) + 1) % CYCLOPS_SHM_SLOTS;
+	cyclops_shm_slot* slot = &region->slots[next];
+	slot->frame.publish_time_us = cyclops_shm_now_us();
+	__atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&region->latest, next, __ATOMIC_RELEASE);
+	/* sequentially consistent with the waiters count of cyclops_shm_wait : either the reader sees the new tick, or the writer sees the reader */
+	__atomic_add_fetch(&region->tick_futex, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&region->waiters, __ATOMIC_SEQ_CST) > 0)
+	{
+		syscall(SYS_futex, &region->tick_futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+/* Reader side : copies the latest tick to out. Returns 0, or -1 if nothing was published yet or the slot stayed busy
+ * for CYCLOPS_SHM_READ_RETRIES tries (the writer may have died : back off, and remap if it restarts) */
+static inline int cyclops_shm_read(const cyclops_shm_region* region, cyclops_shm_frame* out)
+{
+	for (int tries = 0; tries < CYCLOPS_SHM_READ_RETRIES; tries++)
+	{
+		if (__atomic_load_n(&region->tick_futex, __ATOMIC_ACQUIRE) == 0)
+		{
+			return -1;
+		}
+		uint32_t latest = __atomic_load_n(&region->latest, __ATOMIC_ACQUIRE);
+		const cyclops_shm_slot* slot = &region->slots[latest % CYCLOPS_SHM_SLOTS];
+		uint32_t before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		if (before & 1u)
+		{
+			continue; /* the writer lapped the ring, the slot is being rewritten */
+		}
+		memcpy(out, &slot->frame, sizeof(*out));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == before)
+		{
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Reader side : sleeps until a tick after last_tick_futex is published, or the timeout (NULL to wait forever).
+ * Returns the new value of tick_futex, to pass as last_tick_futex next time. */
+static inline uint32_t cyclops_shm_wait(cyclops_shm_region* region, uint32_t last_tick_futex, const struct timespec* timeout)
+{
+	__atomic_add_fetch(&region->waiters, 1, __ATOMIC_SEQ_CST);
+	/* the kernel only sleeps if the word still holds last_tick_futex, so a tick published in between is not missed */
+	syscall(SYS_futex, &region->tick_futex, FUTEX_WAIT, last_tick_futex, timeout, NULL, 0);
+	__atomic_sub_fetch(&region->waiters, 1, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&region->tick_futex, __ATOMIC_ACQUIRE);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <Communication/SharedMemoryLayout.h>
+#include <Communication/ProcessedTypes.hpp>
+
+class ObjectSnapshot;
+
+//Publishes every tick to the shared memory endpoint, for consumers on the same machine (see Communication/SharedMemoryLayout.h)
+class SharedMemoryPublisher
+{
+private:
+	std::string Name;
+	int FileDescriptor = -1;
+	cyclops_shm_region* Region = nullptr;
+	uint64_t Tick = 0;
+public:
+	SharedMemoryPublisher(std::string InName = CYCLOPS_SHM_NAME);
+	~SharedMemoryPublisher();
+
+	//Called from the detection thread : copies into the next slot of the ring, no syscall unless a reader waits
+	void Publish(const ObjectSnapshot &Snapshot, const std::vector<CameraFeatureData> &FeatureData);
+};
@@ -1,18 +1,37 @@
 #pragma once
 
 #include <memory>
-#include <set>
+#include <map>
+#include <vector>
 #include <thread>
 #include <atomic>
+#include <cstdint>
 #include <Communication/Transport/GenericTransport.hpp>
+#include <Communication/JsonListener.hpp>
 
+class TCPTransport;
+
+//Serves the json api on all network interfaces.
+//A single thread waits on epoll for new connections and incoming data of all clients, and handles the queries inline.
+//Sends never block : what a socket does not take is queued, and sent when epoll reports it writable.
 class TCPJsonHost
 {
 private:
-	std::set<std::unique_ptr<std::thread>> ThreadHandles;
+	std::unique_ptr<std::thread> ThreadHandle;
 	int Port;
-	bool killed;
+	std::atomic<bool> killed = false;
 	std::atomic<int> NumClients = 0;
+	int EpollFD = -1;
+	int WakeFD = -1; //eventfd, to get the event loop out of epoll_wait
+	std::atomic<bool> TickPending = false;
+	uint64_t TickIndex = 0;
+	JsonTick CurrentTick; //Latest data and what was already serialized from it
+	static constexpr int LoopTimeoutMs = 1000; //Keep alive checks are done at least this often
+
+	std::vector<std::unique_ptr<TCPTransport>> Transports; //One server per network interface
+	std::map<int, TCPTransport*> ListenSockets; //Server socket to transport
+	std::map<int, std::shared_ptr<JsonListener>> Listeners; //Client socket to listener
+	std::map<int, uint32_t> WatchedEvents; //Epoll events of each client socket
 public:
 	class CDFRExternal* ExternalRunner = nullptr;
 	class CDFRInternal* InternalRunner = nullptr;
@@ -24,6 +43,36 @@ public:
 		return killed;
 	}
 
+	//Gets the event loop out of its wait, can be called from any thread
+	void Wake();
+
+	//New data was published by the external runner : pushes it to the subscribed clients from the event loop
+	void NotifyTick();
+
+	//Latest published data, shared by all the clients. Only valid from the event loop.
+	JsonTick& GetCurrentTick();
+
+	//Only valid from the event loop
+	const std::map<int, std::shared_ptr<JsonListener>>& GetListeners() const
+	{
+		return Listeners;
+	}
+
 private:
-	void ThreadEntryPoint(GenericTransport::NetworkInterface interface);
-};
\ No newline at end of file
+	bool Watch(int fd, uint32_t events);
+
+	void Unwatch(int fd);
+
+	//Watches the client sockets for EPOLLOUT while they have queued output, and only then.
+	//Closing clients are only watched for EPOLLOUT.
+	void UpdateWatchedEvents();
+
+	void AcceptClients(TCPTransport* Transport);
+
+	//Removes the killed listeners, and the closing ones once their output is sent
+	void RemoveKilledListeners();
+
+	void PublishTick();
+
+	void ThreadEntryPoint();
+};
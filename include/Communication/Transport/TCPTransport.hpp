@@ -4,6 +4,8 @@
 
 #include <shared_mutex>
 #include <vector>
+#include <deque>
+#include <cstdint>
 #include <netinet/in.h>
 
 #include <Misc/Task.hpp>
@@ -14,12 +16,41 @@
 
 class TCPTransport : public GenericTransport, public Task
 {
+public:
+	//Stable identifier of a server side connection, O(1) to resolve.
+	//Slots are reused by later connections with a new generation, so a handle never reaches the next connection of its slot.
+	struct ConnectionHandle
+	{
+		uint32_t Slot = 0;
+		uint32_t Generation = 0; //Generations start at 1, a default handle is invalid
+	};
+
+	//Outbound queue of a client, for STATUS
+	struct QueueStats
+	{
+		size_t QueuedBytes = 0;
+		size_t QueuedMessages = 0;
+		size_t DroppedMessages = 0;
+	};
+
 private:
+	//What the socket didn't take yet, sent when it becomes writable
+	struct OutboundMessage
+	{
+		std::vector<uint8_t> Data;
+		size_t Sent = 0;
+		bool Droppable = false; //Streaming data, the next message supersedes it
+	};
+
 	struct TCPConnection
 	{
-		int filedescriptor;
+		int filedescriptor = -1; //-1 if the slot is free
+		uint32_t Generation = 0;
 		sockaddr_in address;
 		std::string name;
+		std::deque<OutboundMessage> Queue;
+		size_t QueuedBytes = 0;
+		size_t DroppedMessages = 0;
 	};
 
 	bool Server;
@@ -28,7 +59,12 @@ private:
 	int sockfd;
 	bool Connected;
 	mutable std::shared_mutex listenmutex; //protects connections
-	std::vector<TCPConnection> connections;
+	std::vector<TCPConnection> connections; //By slot, slots are not removed
+	std::vector<uint32_t> FreeSlots;
+	//Over the high water mark, droppable messages that aren't started are dropped, oldest first.
+	//Over the max, the client is too slow and the send fails.
+	size_t HighWaterMark = 1<<20;
+	size_t MaxQueuedBytes = 16<<20;
 public:
 
 	TCPTransport(bool inServer, std::string inIP, int inPort, std::string inInterface);
@@ -41,7 +77,13 @@ private:
 	void CheckConnection();
 	void LowerLatency(int fd);
 	void DeleteSocket(int fd);
-	void ServerDeleteSocket(int clientidx);
+	void ServerDeleteSocket(TCPConnection &connection);
+	//Writes the buffers if nothing is waiting, queues what the socket doesn't take. False if the connection failed or is too slow.
+	bool QueueSend(TCPConnection &connection, const struct iovec* buffers, int count, bool Droppable);
+	bool FlushQueue(TCPConnection &connection);
+	//nullptr if the connection was closed
+	TCPConnection* FindConnection(ConnectionHandle Handle);
+	const TCPConnection* FindConnection(ConnectionHandle Handle) const;
 public:
 
 	virtual std::vector<std::string> GetClients() const override;
@@ -50,9 +92,40 @@ public:
 
 	virtual bool Send(const void* buffer, int length, std::string client) override;
 
-	std::vector<std::string> AcceptNewConnections();
+	//Server side, by handle : sends are never blocking, what the socket doesn't take is queued and sent by Flush.
+	//Droppable data can be dropped if the client is too slow, the rest is always sent in full.
+	bool Send(const void* buffer, int length, ConnectionHandle Handle, bool Droppable=false);
+
+	//Sends the buffers one after the other without copying them together
+	bool Send(const struct iovec* buffers, int count, ConnectionHandle Handle, bool Droppable=false);
+
+	//Number of bytes read, 0 if the client disconnected, -1 if there is nothing to read
+	int Receive(void *buffer, int maxlength, ConnectionHandle Handle);
+
+	//Sends what was queued for the client, to be called when its socket is writable. False if the connection failed.
+	bool Flush(ConnectionHandle Handle);
+
+	bool HasPendingOutput(ConnectionHandle Handle) const;
+
+	QueueStats GetQueueStats(ConnectionHandle Handle) const;
+
+	void SetQueueLimits(size_t InHighWaterMark, size_t InMaxQueuedBytes);
+
+	std::vector<ConnectionHandle> AcceptNewConnections();
+
+	//Server socket, readable when connections are waiting to be accepted
+	int GetListenFileDescriptor() const
+	{
+		return Server ? sockfd : -1;
+	}
+
+	//Socket of a connected client, -1 if not connected
+	int GetFileDescriptor(ConnectionHandle Handle) const;
+
+	//Address and port of the client, for logs
+	std::string GetClientName(ConnectionHandle Handle) const;
 
-	void DisconnectClient(std::string client);
+	void DisconnectClient(ConnectionHandle Handle);
 	
 	virtual void ThreadEntryPoint() override;
 };
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+//Runtime used to run the yolo network
+//Input is a normalised NCHW float blob, outputs are float matrices with one detection per row (x, y, width, height, confidence, classes...),
+//stored image after image when the input has several images
+class InferenceBackend
+{
+public:
+	virtual ~InferenceBackend() {}
+
+	virtual std::string GetName() const = 0;
+
+	//New backend with the same runtime and settings, to be loaded. Reuses what this one already computed, if loaded.
+	virtual std::unique_ptr<InferenceBackend> CreateSimilar() const = 0;
+
+	//ModelBase is the path to the model without extension, each backend picks the file it needs
+	virtual bool Load(const std::filesystem::path& ModelBase) = 0;
+
+	//Size of the images expected by the network
+	virtual cv::Size GetInputSize() const = 0;
+
+	virtual bool Infer(const cv::Mat& InputBlob, std::vector<cv::Mat>& Outputs) = 0;
+
+	//Median time of an inference of a single image, in seconds. INFINITY if inference fails or Runs is 0
+	double Benchmark(int Runs);
+};
+
+//All the backends available on this host, loaded
+std::vector<std::unique_ptr<InferenceBackend>> CreateInferenceBackends(const std::filesystem::path& ModelBase);
+
+//Benchmarks all the backends and returns the fastest one, nullptr if none work
+std::unique_ptr<InferenceBackend> SelectFastestBackend(std::vector<std::unique_ptr<InferenceBackend>> Backends, int Runs = 5);
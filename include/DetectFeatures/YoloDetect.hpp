@@ -3,43 +3,86 @@
 #include <Cameras/ImageTypes.hpp>
 #include <Communication/ProcessedTypes.hpp>
 #include <ArucoPipeline/ObjectIdentity.hpp>
-#include <opencv2/dnn.hpp>
 #include <opencv2/core.hpp>
 #include <vector>
+#include <memory>
+#include <cstdint>
 #include <filesystem>
 
 class YoloDetect
 {
 private:
-	struct Detection
+	//Outputs of the network for an image that passed the confidence threshold, before non maximum suppression
+	struct Candidates
 	{
-		cv::Rect BoundingBox;
-		float Confidence;
-		std::vector<float> Classes;
+		std::vector<cv::Rect> Boxes;
+		std::vector<float> Scores;
+		std::vector<int> ClassIds;
+		std::vector<uint8_t> BottomCut;
 
-		Detection(const cv::Rect &InBoundingBox, float InConfidence, const std::vector<float> &InClasses)
-			:BoundingBox(InBoundingBox), Confidence(InConfidence), Classes(InClasses)
-		{}
+		void Clear();
+	};
+	float ConfidenceThreshold = 0.4;
+	float NMSThreshold = 0.5;
+	//Physical size of the objects of a class, used to place them on the table
+	struct ClassShape
+	{
+		double Height; //m
+		double Footprint; //m, diameter seen from above
 	};
 	std::string ModelName;
 	std::vector<std::string> ClassNames;
-	cv::dnn::Net network;
+	std::vector<ClassShape> ClassShapes; //Same indices as ClassNames
+	std::unique_ptr<class InferenceBackend> Backend; //Fastest backend available on this host
+	cv::Size InputSize;
+	//Reused between calls
+	std::vector<cv::UMat> InputFrames; //Full frames or tiles
+	std::vector<std::pair<int, cv::Rect>> InputWindows; //Frame index and location in the frame of each input
+	cv::Mat InputBlob;
+	std::vector<cv::Mat> OutputBlobs;
+	Candidates FrameCandidates;
+	std::vector<int> KeptIndices;
 	std::filesystem::path GetNetworkPath(std::string extension = "") const;
 	void loadNames();
-	void loadNet();
-	void Preprocess(const cv::UMat& frame, cv::Size inpSize, float scale, const cv::Scalar& mean, bool swapRB);
-	std::vector<Detection> Postprocess(const std::vector<cv::Mat> &outputBlobs, const std::vector<std::string> &layerNames, cv::Rect window);
+	void loadNet(const class InferenceBackend* ReferenceBackend);
+	//Packs all the frames into a single NCHW blob
+	void Preprocess(const std::vector<cv::UMat>& frames, float scale, const cv::Scalar& mean, bool swapRB);
+	//Appends the detections of the image at BatchIndex in the last forward pass, in the coordinates of window
+	//Rows are rejected on objectness several at a time with SIMD, the class is picked in place
+	//Boxes touching the bottom of the window are marked as cut, unless the window ends at the bottom of the frame
+	void Postprocess(int BatchIndex, int BatchSize, cv::Rect window, int FrameHeight, Candidates& Out) const;
+	//Class aware non maximum suppression, across all the tiles of a frame
+	void Suppress(const Candidates& In, std::vector<YoloDetection>& Out);
 public:
-	YoloDetect(std::string inModelName = "cdfr", int inNumclasses = 4);
+	//Without a reference backend, all the backends are benchmarked to pick the fastest. With one, the same kind of backend is used.
+	YoloDetect(std::string inModelName = "cdfr", int inNumclasses = 4, const class InferenceBackend* ReferenceBackend = nullptr);
 	virtual ~YoloDetect();
 	
 	const std::string& GetClassName(int index) const;
 
 	int GetNumClasses() const;
 
+	//nullptr if no backend could be loaded
+	const class InferenceBackend* GetBackend() const
+	{
+		return Backend.get();
+	}
+
 	int Detect(CameraImageData InData, CameraFeatureData *OutData);
 
-	std::vector<ObjectData> Project(const CameraImageData &ImageData, const CameraFeatureData& FeatureData);
+	//Runs all the frames through the network in a single forward pass, Detections[i] is filled with the detections of Frames[i]
+	//If Tiles[i] is given and not empty, only those parts of Frames[i] are processed, each at the network's resolution
+	//Returns the total number of detections
+	int DetectBatch(const std::vector<CameraImageData>& Frames, std::vector<std::vector<YoloDetection>>& Detections, 
+		const std::vector<std::vector<cv::Rect>>& Tiles = {});
+
+	//Tiles of InputSize*TileScale pixels covering the regions of interest (in image space), with some overlap
+	//Returns no tiles if there are no regions
+	std::vector<cv::Rect> GetTiles(const std::vector<cv::Rect>& Regions, cv::Size FrameSize, double TileScale) const;
+
+	//Places all the detections of a camera on the table, into FeatureData.YoloProjections
+	//The bottom centre of the box is the point of the object closest to the camera on the ground. If the bottom is cut by the frame or by the edge of a tile, the top centre is used instead.
+	void Project(const CameraImageData &ImageData, CameraFeatureData& FeatureData) const;
 };
 
 
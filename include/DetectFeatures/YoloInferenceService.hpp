@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Cameras/ImageTypes.hpp>
+#include <Communication/ProcessedTypes.hpp>
+
+class YoloDetect;
+
+//Runs yolo on its own threads, so that the detection tick is not slowed down by inference
+//Only the latest frame of each camera is kept : if inference is slower than the cameras, older frames are dropped
+//Frames of all the cameras waiting are batched in a single forward pass
+class YoloInferenceService
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+	typedef Clock::time_point TimePoint;
+
+private:
+	struct CameraSlot
+	{
+		CameraImageData Pending;
+		std::vector<cv::Rect> PendingTiles; //Empty to process the full frame
+		bool HasPending = false;
+		bool Busy = false; //A worker is running inference for this camera
+		std::vector<YoloDetection> Detections;
+		TimePoint GrabTime; //Grab time of the frame the detections come from
+	};
+
+	struct Worker
+	{
+		std::unique_ptr<YoloDetect> Detector; //Each worker has it's own network, cv::dnn::Net is not thread safe
+		std::thread Thread;
+	};
+
+	mutable std::mutex Mutex;
+	std::condition_variable WorkAvailable;
+	std::map<std::string, CameraSlot> Slots; //Keyed by camera name, cameras can come and go
+	std::vector<Worker> Workers;
+	bool Stopping = false;
+	int MaxBatchSize; //Max number of cameras processed in a single forward pass
+
+	void WorkerEntryPoint(YoloDetect* Detector);
+
+public:
+	YoloInferenceService(std::string ModelName = "cdfr", int NumClasses = 4, int NumWorkers = 1, int InMaxBatchSize = 8);
+	~YoloInferenceService();
+
+	//Queue the frame for inference, replacing any frame from the same camera that wasn't processed yet
+	//The image is not copied, the camera must not write to it afterwards
+	//If tiles are given, only those parts of the frame are processed
+	void Submit(const CameraImageData& Frame, const std::vector<cv::Rect>& Tiles = {});
+
+	//Latest detections of the camera, with the grab time of the frame they were found on
+	//Returns false if there is no result for this camera yet
+	bool GetLatest(const std::string& CameraName, std::vector<YoloDetection>& Detections, TimePoint& GrabTime) const;
+
+	//For class names and projection, does not touch the network
+	const YoloDetect& GetDetector() const;
+};
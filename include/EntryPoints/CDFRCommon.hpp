@@ -36,6 +36,7 @@ namespace CDFRCommon
 		bool SegmentedDetection = true;
 		bool POIDetection = false;
 		bool YoloDetection = true;
+		bool YoloTiled = false; //Run yolo on tiles covering the table and the zones instead of the whole downscaled frame
 		bool Denoising = false;
 		bool DistortedDetection = true;
 		bool SolveCameraLocation = true;
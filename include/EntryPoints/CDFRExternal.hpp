@@ -5,14 +5,17 @@
 #include <array>
 #include <memory>
 #include <filesystem>
+#include <functional>
+#include <mutex>
 
 #include <Communication/ProcessedTypes.hpp>
 #include <ArucoPipeline/ObjectIdentity.hpp>
+#include <ArucoPipeline/ObjectSnapshot.hpp>
 #include <ArucoPipeline/ObjectTracker.hpp>
 #include <Cameras/ImageTypes.hpp>
 #include <Misc/FrameCounter.hpp>
 #include <Misc/Task.hpp>
-#include <PostProcessing/PostProcess.hpp>
+#include <PostProcessing/PostProcessGraph.hpp>
 
 class CDFRExternal : public Task
 {
@@ -34,12 +37,14 @@ protected:
 private:
 	std::filesystem::path RecordRootPath;
 
-	std::unique_ptr<class YoloDetect> YoloDetector;
+	std::unique_ptr<class YoloInferenceService> YoloService;
+	ObjectData::Clock::duration YoloMaxAge = std::chrono::milliseconds(500); //Yolo detections older than that are not used
+	double YoloTileScale = 2; //In tiled mode, tiles are this many times the network's input size
 
 	//Camera manager
 	std::unique_ptr<class CameraManager> CameraMan;
 
-	std::vector<std::unique_ptr<PostProcess>> PostProcesses;
+	PostProcessGraph PostProcesses;
 
 protected:
 	//3D viz
@@ -55,13 +60,21 @@ private:
 	ObjectTracker BlueTracker, YellowTracker, UnknownTracker;
 	std::array<std::vector<CameraImageData>, 3> ImageData;
 	std::array<std::vector<CameraFeatureData>, 3> FeatureData;
-	std::array<std::vector<ObjectData>, 3> ObjData;
+	std::vector<ObjectData> ObjData; //Working data, reused between ticks
+	ObjectIndex WorkingIndex; //Index of ObjData for the post processes
+	ObjectSnapshotPool SnapshotPool;
+	std::shared_ptr<const ObjectSnapshot> LatestSnapshot; //Published objects, use atomic_load/atomic_store
+	std::mutex TickListenersMutex;
+	std::vector<std::function<void()>> TickListeners;
 
 	CDFRTeam GetTeamFromCameraPosition(std::vector<class Camera*> Cameras);
 
 	void UpdateDirectImage(const std::vector<class Camera*> &Cameras, const std::vector<CameraFeatureData> &FeatureDataLocal);
 
 protected:
+	//World space volumes where yolo should look for objects : the table and the zones of the post processes
+	void GetYoloRegionsOfInterest(std::vector<std::vector<cv::Point3d>> &Regions) const;
+
 	void Open3DVisualizer();
 
 	void OpenDirectVisualizer();
@@ -91,6 +104,15 @@ public:
 
 	CDFRTeam GetTeam();
 
+	//Spatial index of the objects, valid during post processing
+	const ObjectIndex& GetWorkingIndex() const
+	{
+		return WorkingIndex;
+	}
+
+	//Called from the detection thread every time new data is readable, keep it short
+	void AddTickListener(std::function<void()> Listener);
+
 	virtual void ThreadEntryPoint() override;
 
 	int GetReadBufferIndex() const;
@@ -99,6 +121,10 @@ public:
 
 	std::vector<CameraFeatureData> GetFeatureData() const;
 
+	//Latest published objects. The snapshot stays valid for as long as it is held.
+	std::shared_ptr<const ObjectSnapshot> GetObjectSnapshot() const;
+
+	//Copy of the latest objects in the working format, prefer GetObjectSnapshot
 	std::vector<ObjectData> GetObjectData() const;
 
 	CDFRExternal();
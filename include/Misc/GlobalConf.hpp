@@ -47,6 +47,19 @@ struct KeepAliveSettings
 
 KeepAliveSettings GetKeepAliveSettings();
 
+struct JsonHostSettings
+{
+	int MaxFrameSize; //bytes, longer queries are dropped
+	double ActionLogInterval; //seconds between two "Received action" logs of a client
+	int SendHighWaterMark; //bytes queued for a client before subscription updates are dropped
+	int MaxQueuedBytes; //bytes queued for a client before it's disconnected
+};
+
+JsonHostSettings GetJsonHostSettings();
+
+//Names of the post processes to run, in order (see PostProcessGraph)
+const std::vector<std::string>& GetPostProcessNames();
+
 //list of resolutions in the end
 cv::Size GetArucoReduction();
 
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <opencv2/core.hpp>
+
+//Uniform 2D grid holding item indices, for neighbour queries on the table
+//Positions outside of the grid are stored in the border cells, non-finite positions are not stored
+class SpatialGrid
+{
+private:
+	cv::Vec2d Origin;
+	double CellSize;
+	int Width, Height;
+	std::vector<std::vector<int>> Cells;
+	std::vector<int> UsedCells; //Cells that may not be empty, so that clearing does not touch the whole grid
+
+	//Clamped as double before the cast, out of range double to int conversion is undefined
+	int GetCellX(double x) const
+	{
+		return std::clamp(std::floor((x - Origin[0]) / CellSize), 0.0, double(Width-1));
+	}
+
+	int GetCellY(double y) const
+	{
+		return std::clamp(std::floor((y - Origin[1]) / CellSize), 0.0, double(Height-1));
+	}
+
+public:
+	SpatialGrid(cv::Vec2d Min, cv::Vec2d Max, double InCellSize);
+
+	void Clear();
+
+	//-1 if the position is not finite
+	int GetCellIndex(cv::Vec2d Position) const
+	{
+		if (!std::isfinite(Position[0]) || !std::isfinite(Position[1]))
+		{
+			return -1;
+		}
+		return GetCellY(Position[1])*Width + GetCellX(Position[0]);
+	}
+
+	void Insert(int Item, cv::Vec2d Position);
+
+	void Remove(int Item, cv::Vec2d Position);
+
+	//Only touches the grid if the item changes cell
+	void Move(int Item, cv::Vec2d From, cv::Vec2d To);
+
+	//Calls Callback(Item) for every item in the cells overlapping the circle
+	//Items can be further than Radius, the caller checks the exact distance
+	template<class F>
+	void Query(cv::Vec2d Center, double Radius, F&& Callback) const
+	{
+		if (!std::isfinite(Center[0]) || !std::isfinite(Center[1]) || !std::isfinite(Radius))
+		{
+			return;
+		}
+		int xmin = GetCellX(Center[0]-Radius), xmax = GetCellX(Center[0]+Radius);
+		int ymin = GetCellY(Center[1]-Radius), ymax = GetCellY(Center[1]+Radius);
+		for (int y = ymin; y <= ymax; y++)
+		{
+			for (int x = xmin; x <= xmax; x++)
+			{
+				for (int Item : Cells[y*Width+x])
+				{
+					Callback(Item);
+				}
+			}
+		}
+	}
+};
@@ -20,8 +20,28 @@ class PostProcessJardinieres : public PostProcess
 		ObjectData::Clock::duration TimeSpentContacting;
 	};
 	std::array<StockStatus, 6> Stocks;
+
+	//Planters seen by all the cameras are warped into a single strip image, one slot under the other, then masked in one pass
+	struct StripSlot
+	{
+		int ZoneIdx;
+		double Weight; //Higher for cameras that see the planter from above
+		cv::Rect ROI; //In the strip, without padding
+	};
+	static constexpr int AdaptiveBlockSize = 3;
+	static constexpr int DilationAmount = 2, ErosionAmount = DilationAmount+1; //Kernel radii
+	static_assert(AdaptiveBlockSize % 2 == 1 && AdaptiveBlockSize > 1, "adaptiveThreshold needs an odd block size");
+	//Rows replicated around each slot, so that the filters don't bleed between slots : the filters are chained, their reaches add up
+	static constexpr int SlotPadding = AdaptiveBlockSize/2 + DilationAmount + ErosionAmount;
+	const cv::Size SlotSize;
+	std::vector<StripSlot> Slots;
+	cv::Mat Strip, StripValue, StripColour, StripAdaptive, StripDilated, StripEroded;
+	cv::Mat DilationKernel, ErosionKernel;
+	std::array<double, 6> WeightedPixels, TotalWeight;
 public:
 	PostProcessJardinieres(CDFRExternal* InOwner);
 
-	virtual void Process(std::vector<CameraImageData> &ImageData, std::vector<CameraFeatureData> &FeatureData, std::vector<ObjectData> &Objects) override;
+	virtual void Process(const std::vector<CameraImageData> &ImageData, const std::vector<CameraFeatureData> &FeatureData, const std::vector<ObjectData> &Objects, std::vector<ObjectData> &Output) override;
+
+	virtual void GetRegionsOfInterest(std::vector<std::vector<cv::Point3d>> &Regions) const override;
 };
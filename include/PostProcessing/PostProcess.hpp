@@ -3,21 +3,44 @@
 #include <Cameras/ImageTypes.hpp>
 #include <Communication/ProcessedTypes.hpp>
 #include <ArucoPipeline/ObjectIdentity.hpp>
+#include <ArucoPipeline/ObjectIndex.hpp>
 #include <vector>
 #include <set>
 #include <functional>
 
 class CDFRExternal;
 
+//A stage run after solving. Stages declare the object types they read and write, 
+//so that stages that don't depend on each other can run at the same time (see PostProcessGraph)
 class PostProcess
 {
 protected:
 	CDFRExternal* Owner;
+	std::set<ObjectType> Reads; //Types this stage looks for in Objects
+	std::set<ObjectType> Writes; //Types this stage adds to Output
 public:
 	PostProcess(CDFRExternal* InOwner);
 	virtual ~PostProcess();
 
-	std::vector<ObjectData> GetEnemyRobots(std::vector<ObjectData> &Objects) const;
+	//Spatial index of Objects, refreshed before each post process
+	const ObjectIndex& GetIndex() const;
+
+	std::vector<ObjectData> GetEnemyRobots(const std::vector<ObjectData> &Objects) const;
+
+	const std::set<ObjectType>& GetReads() const
+	{
+		return Reads;
+	}
+
+	const std::set<ObjectType>& GetWrites() const
+	{
+		return Writes;
+	}
 	
-	virtual void Process(std::vector<CameraImageData> &ImageData, std::vector<CameraFeatureData> &FeatureData, std::vector<ObjectData> &Objects);
+	//Objects is the list as of the start of the stage, indexed by GetIndex(). Created objects go to Output.
+	//Stages may run concurrently : only touch the stage's own state.
+	virtual void Process(const std::vector<CameraImageData> &ImageData, const std::vector<CameraFeatureData> &FeatureData, const std::vector<ObjectData> &Objects, std::vector<ObjectData> &Output);
+
+	//World space volumes this post process needs yolo detections in, as point clouds. Does not clear Regions.
+	virtual void GetRegionsOfInterest(std::vector<std::vector<cv::Point3d>> &Regions) const;
 };
\ No newline at end of file
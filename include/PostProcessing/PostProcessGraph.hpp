@@ -0,0 +1,57 @@
+#pragma once
+
+#include <PostProcessing/PostProcess.hpp>
+#include <Misc/ManualProfiler.hpp>
+#include <vector>
+#include <map>
+#include <memory>
+#include <string>
+#include <functional>
+
+//Runs the post processes as a graph : a stage waits for the earlier stages that write a type it reads.
+//Stages with no dependency between them run in parallel, each writing to its own output.
+//Outputs are appended level by level, in declaration order within a level, so that the result doesn't depend on scheduling.
+class PostProcessGraph
+{
+public:
+	typedef std::function<std::unique_ptr<PostProcess>(CDFRExternal*)> Factory;
+	typedef ManualProfiler<false> ProfType;
+
+private:
+	struct Stage
+	{
+		std::string Name;
+		std::unique_ptr<PostProcess> Process;
+		int Level = 0; //Stages of the same level run together
+		std::vector<ObjectData> Output;
+		ProfType Profiler;
+	};
+	std::vector<Stage> Stages;
+	std::vector<std::vector<int>> Levels; //Indices in Stages, per level
+
+	static std::map<std::string, Factory>& GetRegistry();
+
+public:
+	//Makes a post process available to the config under that name
+	static void Register(const std::string &Name, Factory Create);
+
+	//Creates the stage from the registry and schedules it after the previously added ones
+	bool Add(const std::string &Name, CDFRExternal* Owner);
+
+	//Runs all stages. Index is rebuilt from Objects before each level, and the outputs are appended to Objects.
+	void Run(const std::vector<CameraImageData> &ImageData, const std::vector<CameraFeatureData> &FeatureData,
+		std::vector<ObjectData> &Objects, ObjectIndex &Index);
+
+	void GetRegionsOfInterest(std::vector<std::vector<cv::Point3d>> &Regions) const;
+
+	//Adds the time spent in each stage to Profiler
+	template<bool enabled>
+	void GatherProfile(ManualProfiler<enabled> &Profiler)
+	{
+		for (auto &stage : Stages)
+		{
+			Profiler += stage.Profiler;
+			stage.Profiler = ProfType();
+		}
+	}
+};
@@ -17,5 +17,7 @@ class PostProcessStockPlants : public PostProcess
 public:
 	PostProcessStockPlants(CDFRExternal* InOwner);
 
-	virtual void Process(std::vector<CameraImageData> &ImageData, std::vector<CameraFeatureData> &FeatureData, std::vector<ObjectData> &Objects) override;
+	virtual void Process(const std::vector<CameraImageData> &ImageData, const std::vector<CameraFeatureData> &FeatureData, const std::vector<ObjectData> &Objects, std::vector<ObjectData> &Output) override;
+
+	virtual void GetRegionsOfInterest(std::vector<std::vector<cv::Point3d>> &Regions) const override;
 };
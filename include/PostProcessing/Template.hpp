@@ -7,7 +7,9 @@ class PostProcessTemplate : public PostProcess
 public:
 	PostProcessTemplate(CDFRExternal* InOwner)
 		:PostProcess(InOwner)
-	{}
+	{
+		Writes = {ObjectType::Team};
+	}
 
-	virtual void Process(std::vector<CameraImageData> &ImageData, std::vector<CameraFeatureData> &FeatureData, std::vector<ObjectData> &Objects) override;
+	virtual void Process(const std::vector<CameraImageData> &ImageData, const std::vector<CameraFeatureData> &FeatureData, const std::vector<ObjectData> &Objects, std::vector<ObjectData> &Output) override;
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <PostProcessing/PostProcess.hpp>
+#include <Misc/SpatialGrid.hpp>
 #include <vector>
 
 class PostProcessYoloDeflicker : public PostProcess
@@ -10,24 +11,26 @@ class PostProcessYoloDeflicker : public PostProcess
 		bool Associated;
 		ObjectData::TimePoint Lifetime;
 
-		YoloObject(ObjectData& obj)
-			:ObjectData(obj)
+		YoloObject(const YoloProjection& proj, ObjectData::TimePoint Seen, int TrackID)
+			:ObjectData(GetType(proj), *proj.Name, cv::Affine3d(cv::Vec3d::all(0), cv::Vec3d(proj.Position[0], proj.Position[1], 0)), Seen)
 		{
 			Associated = false;
-			Lifetime = obj.LastSeen;
-			*this += obj;
+			instance = TrackID; //Stays the same for as long as the object is in the cache
+			Lifetime = Seen;
+			metadata["confidence"] = int(proj.Confidence*100);
+			Merge(proj, Seen);
 		}
 
-		bool operator==(ObjectData& other)
+		bool Matches(const YoloProjection& proj) const
 		{
 			if (Associated)
 			{
 				return false;
 			}
-			
-			if (other.type != type)
+			ObjectType othertype = GetType(proj);
+			if (othertype != type)
 			{
-				if ((type == ObjectType::Fragile && other.type == ObjectType::Resistant) || (other.type == ObjectType::Fragile && type == ObjectType::Resistant))
+				if ((type == ObjectType::Fragile && othertype == ObjectType::Resistant) || (othertype == ObjectType::Fragile && type == ObjectType::Resistant))
 				{
 				}
 				else
@@ -35,30 +38,46 @@ class PostProcessYoloDeflicker : public PostProcess
 					return false;
 				}
 			}
-			cv::Vec3d delta = other.location.translation() - location.translation();
-			double distance = std::sqrt(delta.ddot(delta));
-			return distance < 0.02;
+			cv::Vec2d delta = proj.Position - GetPos2D();
+			return delta.ddot(delta) < AssociationRadius*AssociationRadius;
 		} 
 
-		void operator+=(ObjectData& other)
+		void Merge(const YoloProjection& proj, ObjectData::TimePoint Seen)
 		{
 			assert(!Associated);
-			cv::Vec3d mean = (other.location.translation() + location.translation())/2;
-			location.translation(mean);
-			int confidence = other.metadata.at("confidence");
+			cv::Vec2d mean = (proj.Position + GetPos2D())/2;
+			location.translation(cv::Vec3d(mean[0], mean[1], 0));
+			int confidence = proj.Confidence*100;
 			Lifetime += std::chrono::milliseconds(confidence*10);//if 100% confident, add 1s lifetime
 			Lifetime = std::max(Lifetime, ObjectData::Clock::now() + std::chrono::seconds(3)); //max 3s lifetime
-			LastSeen = other.LastSeen;
-			type = other.type;
+			LastSeen = Seen;
+			type = GetType(proj);
+			name = *proj.Name;
 		}
 	};
+	static constexpr double AssociationRadius = 0.02; //m, a detection closer than that to a cached object is the same object
+	static constexpr double RobotClearRadius = 0.15; //m, objects under a robot are forgotten
+
 	std::vector<YoloObject> CachedObjects;
+	SpatialGrid Grid; //Indices in CachedObjects, rebuilt every tick
+	std::vector<uint8_t> RemoveScratch;
+	int NextTrackID = 0;
 public:
 	PostProcessYoloDeflicker(CDFRExternal* InOwner)
-		:PostProcess(InOwner)
-	{}
+		:PostProcess(InOwner),
+		Grid(cv::Vec2d(-1.5, -1), cv::Vec2d(1.5, 1), 0.05) //table is 3m x 2m
+	{
+		Reads = {ObjectType::Robot};
+		Writes = {ObjectType::Fragile, ObjectType::Resistant, ObjectType::Pot, ObjectType::PottedPlant};
+	}
 
 	static bool IsYolo(const ObjectData& obj);
 
-	virtual void Process(std::vector<CameraImageData> &ImageData, std::vector<CameraFeatureData> &FeatureData, std::vector<ObjectData> &Objects) override;
+	//Yolo classes are in the same order as the object types, starting at Fragile
+	static ObjectType GetType(const YoloProjection& proj)
+	{
+		return (ObjectType)((int)ObjectType::Fragile + proj.Class);
+	}
+
+	virtual void Process(const std::vector<CameraImageData> &ImageData, const std::vector<CameraFeatureData> &FeatureData, const std::vector<ObjectData> &Objects, std::vector<ObjectData> &Output) override;
 };
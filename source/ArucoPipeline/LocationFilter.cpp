@@ -0,0 +1,190 @@
+#include "ArucoPipeline/LocationFilter.hpp"
+
+#include <cassert>
+#include <Misc/math2d.hpp>
+#include <Misc/math3d.hpp>
+
+using namespace cv;
+using namespace std;
+
+int LocationFilter::Allocate()
+{
+	int Slot;
+	if (FreeSlots.size() > 0)
+	{
+		Slot = FreeSlots.back();
+		FreeSlots.pop_back();
+	}
+	else
+	{
+		Slot = LastUpdate.size();
+		const size_t NewSize = Slot+1;
+		for (auto &axis : Axes)
+		{
+			for (auto *column : {&axis.Position, &axis.Velocity, &axis.Acceleration,
+				&axis.P00, &axis.P01, &axis.P02, &axis.P11, &axis.P12, &axis.P22, &axis.Measurement})
+			{
+				column->resize(NewSize, 0);
+			}
+		}
+		LastUpdate.resize(NewSize);
+		HasMeasurement.resize(NewSize, 0);
+		Initialised.resize(NewSize, 0);
+		DeltaTime.resize(NewSize, 0);
+	}
+	HasMeasurement[Slot] = 0;
+	Initialised[Slot] = 0;
+	return Slot;
+}
+
+void LocationFilter::Release(int Slot)
+{
+	assert(Slot >= 0 && Slot < (int)LastUpdate.size());
+	HasMeasurement[Slot] = 0;
+	Initialised[Slot] = 0;
+	FreeSlots.push_back(Slot);
+}
+
+double LocationFilter::GetYaw(const Affine3d &Location)
+{
+	return GetRotZ(Location.rotation());
+}
+
+void LocationFilter::SetMeasurement(int Slot, const Affine3d &Location)
+{
+	Vec3d translation = Location.translation();
+	for (int i = 0; i < 3; i++)
+	{
+		Axes[i].Measurement[Slot] = translation[i];
+	}
+	Axes[3].Measurement[Slot] = GetYaw(Location);
+	HasMeasurement[Slot] = 1;
+}
+
+void LocationFilter::Update(TimePoint Tick)
+{
+	const int NumSlots = LastUpdate.size();
+	//Slots that are too old or new restart from the measurement, DeltaTime 0 marks slots that aren't updated
+	for (int i = 0; i < NumSlots; i++)
+	{
+		DeltaTime[i] = 0;
+		if (!HasMeasurement[i])
+		{
+			continue;
+		}
+		double dt = chrono::duration<double>(Tick - LastUpdate[i]).count();
+		LastUpdate[i] = Tick;
+		if (Initialised[i] && dt > 0 && dt < Params.ResetTime)
+		{
+			DeltaTime[i] = dt;
+			continue;
+		}
+		Initialised[i] = 1;
+		for (int axisidx = 0; axisidx < NumAxes; axisidx++)
+		{
+			AxisState &axis = Axes[axisidx];
+			axis.Position[i] = axis.Measurement[i];
+			axis.Velocity[i] = 0;
+			axis.Acceleration[i] = 0;
+			axis.P00[i] = Params.MeasurementNoise[axisidx];
+			axis.P01[i] = axis.P02[i] = axis.P12[i] = 0;
+			axis.P11[i] = 1; //Up to 1 m/s or rad/s
+			axis.P22[i] = 4;
+		}
+	}
+
+	for (int axisidx = 0; axisidx < NumAxes; axisidx++)
+	{
+		AxisState &axis = Axes[axisidx];
+		const double q = Params.JerkNoise[axisidx];
+		const double r = Params.MeasurementNoise[axisidx];
+		const bool angular = axisidx == 3;
+		double *p = axis.Position.data(), *v = axis.Velocity.data(), *a = axis.Acceleration.data();
+		double *P00 = axis.P00.data(), *P01 = axis.P01.data(), *P02 = axis.P02.data();
+		double *P11 = axis.P11.data(), *P12 = axis.P12.data(), *P22 = axis.P22.data();
+		const double *z = axis.Measurement.data();
+		for (int i = 0; i < NumSlots; i++)
+		{
+			const double dt = DeltaTime[i];
+			if (dt <= 0)
+			{
+				continue;
+			}
+			const double dt2 = dt*dt, dt3 = dt2*dt;
+			const double h = dt2/2;
+
+			//Predict : x = F x
+			p[i] += v[i]*dt + a[i]*h;
+			v[i] += a[i]*dt;
+
+			//P = F P Ft + Q, with A = F P
+			const double A00 = P00[i] + dt*P01[i] + h*P02[i];
+			const double A01 = P01[i] + dt*P11[i] + h*P12[i];
+			const double A02 = P02[i] + dt*P12[i] + h*P22[i];
+			const double A11 = P11[i] + dt*P12[i];
+			const double A12 = P12[i] + dt*P22[i];
+			const double A22 = P22[i];
+			double p00 = A00 + dt*A01 + h*A02 + q*dt3*dt2/20;
+			double p01 = A01 + dt*A02 + q*dt2*dt2/8;
+			double p02 = A02 + q*dt3/6;
+			double p11 = A11 + dt*A12 + q*dt3/3;
+			double p12 = A12 + q*dt2/2;
+			double p22 = A22 + q*dt;
+
+			//Correct, only the position is measured
+			double innovation = z[i] - p[i];
+			if (angular)
+			{
+				innovation = wraptwopi(innovation);
+			}
+			const double S = p00 + r;
+			const double K0 = p00/S, K1 = p01/S, K2 = p02/S;
+			p[i] += K0*innovation;
+			v[i] += K1*innovation;
+			a[i] += K2*innovation;
+			if (angular)
+			{
+				p[i] = wraptwopi(p[i]);
+			}
+			P00[i] = p00 - K0*p00;
+			P01[i] = p01 - K0*p01;
+			P02[i] = p02 - K0*p02;
+			P11[i] = p11 - K1*p01;
+			P12[i] = p12 - K1*p02;
+			P22[i] = p22 - K2*p02;
+		}
+	}
+
+	for (int i = 0; i < NumSlots; i++)
+	{
+		HasMeasurement[i] = 0;
+	}
+}
+
+bool LocationFilter::GetState(int Slot, Vec4d &Position, Vec4d &Velocity, Vec4d &Acceleration) const
+{
+	if (Slot < 0 || Slot >= (int)LastUpdate.size() || !Initialised[Slot])
+	{
+		return false;
+	}
+	for (int i = 0; i < NumAxes; i++)
+	{
+		Position[i] = Axes[i].Position[Slot];
+		Velocity[i] = Axes[i].Velocity[Slot];
+		Acceleration[i] = Axes[i].Acceleration[Slot];
+	}
+	return true;
+}
+
+Affine3d LocationFilter::GetFilteredLocation(int Slot, const Affine3d &Measured) const
+{
+	Vec4d Position, Velocity, Acceleration;
+	if (!GetState(Slot, Position, Velocity, Acceleration))
+	{
+		return Measured;
+	}
+	double YawDelta = wraptwopi(Position[3] - GetYaw(Measured));
+	Affine3d Filtered = Affine3d(Vec3d(0, 0, YawDelta)) * Affine3d(Measured.rotation());
+	Filtered.translation(Vec3d(Position[0], Position[1], Position[2]));
+	return Filtered;
+}
@@ -0,0 +1,221 @@
+#include "ArucoPipeline/MultiViewSolver.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace cv;
+using namespace std;
+
+static double ReadMatValue(const Mat &Source, int row, int col)
+{
+	if (Source.depth() == CV_32F)
+	{
+		return Source.at<float>(row, col);
+	}
+	return Source.at<double>(row, col);
+}
+
+int MultiViewSolver::AddView(const Mat &CameraMatrix, const Mat &DistanceCoefficients, const Affine3d &CameraTransform)
+{
+	if (NumViews >= MaxViews)
+	{
+		return -1;
+	}
+	if (CameraMatrix.rows != 3 || CameraMatrix.cols != 3)
+	{
+		return -1;
+	}
+	View &view = Views[NumViews];
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			view.CameraMatrix(i,j) = ReadMatValue(CameraMatrix, i, j);
+		}
+	}
+	view.Distortion = Vec<double, MaxDistortionCoefficients>::all(0);
+	int numcoeffs = min<int>(DistanceCoefficients.total(), MaxDistortionCoefficients);
+	bool column = DistanceCoefficients.cols == 1;
+	for (int i = 0; i < numcoeffs; i++)
+	{
+		view.Distortion[i] = column ? ReadMatValue(DistanceCoefficients, i, 0) : ReadMatValue(DistanceCoefficients, 0, i);
+	}
+	view.WorldToCamera = CameraTransform.inv();
+	return NumViews++;
+}
+
+bool MultiViewSolver::AddObservation(int ViewIndex, const Point3d &ObjectPoint, const Point2f &ImagePoint)
+{
+	if (NumObservations >= MaxObservations || ViewIndex < 0 || ViewIndex >= NumViews)
+	{
+		return false;
+	}
+	Observation &obs = Observations[NumObservations++];
+	obs.ObjectPoint = ObjectPoint;
+	obs.ImagePoint = ImagePoint;
+	obs.ViewIndex = ViewIndex;
+	return true;
+}
+
+Matx33d MultiViewSolver::ExpRotation(const Vec3d &Omega)
+{
+	double theta = norm(Omega);
+	Matx33d K(0, -Omega[2], Omega[1],
+		Omega[2], 0, -Omega[0],
+		-Omega[1], Omega[0], 0);
+	if (theta < 1e-12)
+	{
+		return Matx33d::eye() + K;
+	}
+	double a = sin(theta)/theta;
+	double b = (1-cos(theta))/(theta*theta);
+	return Matx33d::eye() + a*K + b*(K*K);
+}
+
+bool MultiViewSolver::Project(const View &InView, const Vec3d &WorldPoint, Vec2d &Pixel)
+{
+	Vec3d CameraPoint = InView.WorldToCamera * WorldPoint;
+	if (CameraPoint[2] < 1e-6) //behind the camera
+	{
+		return false;
+	}
+	double x = CameraPoint[0]/CameraPoint[2], y = CameraPoint[1]/CameraPoint[2];
+	const auto &d = InView.Distortion;
+	double r2 = x*x+y*y, r4 = r2*r2, r6 = r4*r2;
+	double radial = (1 + d[0]*r2 + d[1]*r4 + d[4]*r6)/(1 + d[5]*r2 + d[6]*r4 + d[7]*r6);
+	double xd = x*radial + 2*d[2]*x*y + d[3]*(r2+2*x*x);
+	double yd = y*radial + d[2]*(r2+2*y*y) + 2*d[3]*x*y;
+	const Matx33d &K = InView.CameraMatrix;
+	Pixel = Vec2d(K(0,0)*xd + K(0,1)*yd + K(0,2), K(1,1)*yd + K(1,2));
+	return true;
+}
+
+bool MultiViewSolver::Evaluate(const Matx33d &Rotation, const Vec3d &Translation, double &Cost, Matx66d *JtJ, Vec6d *Jtr) const
+{
+	const double eps = 1e-6;
+	const bool Jacobian = JtJ != nullptr && Jtr != nullptr;
+	Cost = 0;
+	array<Matx33d, 3> PerturbedRotations;
+	if (Jacobian)
+	{
+		*JtJ = Matx66d::zeros();
+		*Jtr = Vec6d::all(0);
+		for (int k = 0; k < 3; k++)
+		{
+			Vec3d omega(0,0,0);
+			omega[k] = eps;
+			PerturbedRotations[k] = ExpRotation(omega) * Rotation;
+		}
+	}
+	for (int i = 0; i < NumObservations; i++)
+	{
+		const Observation &obs = Observations[i];
+		const View &view = Views[obs.ViewIndex];
+		Vec3d ObjectPoint(obs.ObjectPoint.x, obs.ObjectPoint.y, obs.ObjectPoint.z);
+		Vec2d pixel;
+		if (!Project(view, Rotation * ObjectPoint + Translation, pixel))
+		{
+			return false;
+		}
+		Vec2d residual = pixel - Vec2d(obs.ImagePoint.x, obs.ImagePoint.y);
+		Cost += residual.ddot(residual);
+		if (!Jacobian)
+		{
+			continue;
+		}
+		//Forward differences, rotation is perturbed in world space around the object's origin
+		Matx<double, 2, 6> J;
+		for (int k = 0; k < 6; k++)
+		{
+			Vec3d WorldPoint;
+			if (k < 3)
+			{
+				WorldPoint = PerturbedRotations[k] * ObjectPoint + Translation;
+			}
+			else
+			{
+				Vec3d PerturbedTranslation = Translation;
+				PerturbedTranslation[k-3] += eps;
+				WorldPoint = Rotation * ObjectPoint + PerturbedTranslation;
+			}
+			Vec2d perturbed;
+			if (!Project(view, WorldPoint, perturbed))
+			{
+				return false;
+			}
+			J(0,k) = (perturbed[0] - pixel[0])/eps;
+			J(1,k) = (perturbed[1] - pixel[1])/eps;
+		}
+		*JtJ += J.t() * J;
+		*Jtr += J.t() * residual;
+	}
+	return true;
+}
+
+bool MultiViewSolver::Solve(const Affine3d &Seed, Result &Out, int MaxIterations) const
+{
+	//Need more residuals than parameters to estimate the covariance
+	if (NumViews < 1 || 2*NumObservations <= 6)
+	{
+		return false;
+	}
+	Matx33d Rotation = Seed.rotation();
+	Vec3d Translation = Seed.translation();
+	Matx66d JtJ;
+	Vec6d Jtr;
+	double Cost;
+	if (!Evaluate(Rotation, Translation, Cost, &JtJ, &Jtr))
+	{
+		return false;
+	}
+	double Lambda = 1e-3;
+	int iteration;
+	for (iteration = 0; iteration < MaxIterations; iteration++)
+	{
+		Matx66d Damped = JtJ;
+		for (int k = 0; k < 6; k++)
+		{
+			Damped(k,k) += Lambda * max(JtJ(k,k), 1e-9);
+		}
+		Vec6d Step = Damped.solve(-Jtr, DECOMP_CHOLESKY);
+		Vec3d Omega(Step[0], Step[1], Step[2]), Tau(Step[3], Step[4], Step[5]);
+		Matx33d CandidateRotation = ExpRotation(Omega) * Rotation;
+		Vec3d CandidateTranslation = Translation + Tau;
+		double CandidateCost;
+		if (Evaluate(CandidateRotation, CandidateTranslation, CandidateCost) && CandidateCost < Cost)
+		{
+			double Improvement = Cost - CandidateCost;
+			Rotation = CandidateRotation;
+			Translation = CandidateTranslation;
+			Lambda = max(Lambda*0.1, 1e-9);
+			if (!Evaluate(Rotation, Translation, Cost, &JtJ, &Jtr))
+			{
+				return false;
+			}
+			if (Improvement < 1e-9 * Cost || norm(Step) < 1e-9)
+			{
+				break;
+			}
+		}
+		else
+		{
+			Lambda *= 10;
+			if (Lambda > 1e6)
+			{
+				break;
+			}
+		}
+	}
+	bool invertible = false;
+	Matx66d InvJtJ = JtJ.inv(DECOMP_CHOLESKY, &invertible);
+	if (!invertible)
+	{
+		return false;
+	}
+	double variance = Cost / (2*NumObservations - 6);
+	Out.Location = Affine3d(Rotation, Translation);
+	Out.Covariance = InvJtJ * variance;
+	Out.ReprojectionError = sqrt(Cost / NumObservations);
+	Out.Iterations = iteration;
+	return true;
+}
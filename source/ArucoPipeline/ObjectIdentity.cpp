@@ -3,6 +3,7 @@
 #include <Visualisation/BoardGL.hpp>
 #include <cassert>
 #include <map>
+#include <algorithm>
 #include <iostream>
 using namespace std;
 
@@ -32,6 +33,11 @@ std::ostream& operator << (std::ostream& out, ObjectType Type)
 }
 
 std::optional<GLObject> ObjectData::ToGLObject() const
+{
+	return ToGLObject(type, location, metadata);
+}
+
+std::optional<GLObject> ObjectData::ToGLObject(ObjectType Type, const cv::Affine3d &Location, const nlohmann::json &Metadata)
 {
 	static const map<ObjectType, MeshNames> PacketToMesh = 
 	{
@@ -48,7 +54,7 @@ std::optional<GLObject> ObjectData::ToGLObject() const
 		{ObjectType::PottedPlant,		MeshNames::potted_plant}
 	};
 
-	auto foundmesh = PacketToMesh.find(type);
+	auto foundmesh = PacketToMesh.find(Type);
 	if (foundmesh == PacketToMesh.end())
 	{
 		return nullopt;
@@ -56,8 +62,8 @@ std::optional<GLObject> ObjectData::ToGLObject() const
 
 	GLObject obj;
 	obj.type = foundmesh->second;
-	obj.location = Affine3DToGLM(location);
-	obj.metadata = metadata;
+	obj.location = Affine3DToGLM(Location);
+	obj.metadata = Metadata;
 	return obj;
 }
 
@@ -88,4 +94,21 @@ vector<GLObject> ObjectData::ToGLObjects(const vector<ObjectData>& data, Clock::
 		outobj.insert(outobj.end(), childs.begin(), childs.end());
 	}
 	return outobj;
-}
\ No newline at end of file
+}
+cv::Affine3d ObjectKinematics::Extrapolate(const cv::Affine3d &Location, double dt) const
+{
+	cv::Vec4d Delta = Velocity*dt + Acceleration*(dt*dt/2);
+	cv::Affine3d Predicted = cv::Affine3d(cv::Vec3d(0, 0, Delta[3])) * cv::Affine3d(Location.rotation());
+	Predicted.translation(Location.translation() + cv::Vec3d(Delta[0], Delta[1], Delta[2]));
+	return Predicted;
+}
+
+cv::Affine3d ObjectData::PredictLocation(TimePoint At, Clock::duration MaxHorizon) const
+{
+	if (!kinematics.Valid)
+	{
+		return location;
+	}
+	double dt = chrono::duration<double>(clamp<Clock::duration>(At - LastSeen, Clock::duration::zero(), MaxHorizon)).count();
+	return kinematics.Extrapolate(location, dt);
+}
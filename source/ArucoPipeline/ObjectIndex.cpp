@@ -0,0 +1,96 @@
+#include "ArucoPipeline/ObjectIndex.hpp"
+
+#include <ArucoPipeline/ObjectSnapshot.hpp>
+
+using namespace std;
+using namespace cv;
+
+ObjectIndex::ObjectIndex(Vec2d Min, Vec2d Max, double InCellSize)
+	:Origin(Min), CellSize(InCellSize)
+{
+	Width = max<int>(ceil((Max[0] - Min[0]) / CellSize), 1);
+	Height = max<int>(ceil((Max[1] - Min[1]) / CellSize), 1);
+	NumCells = Width*Height;
+}
+
+void ObjectIndex::Add(ObjectType Type, const Affine3d& Location, ObjectData::TimePoint LastSeen, const string& Name, int Index)
+{
+	Entry entry;
+	entry.Position = Vec2d(Location.translation().val);
+	//Not indexed, it could not be found by a query anyway
+	if (!isfinite(entry.Position[0]) || !isfinite(entry.Position[1]))
+	{
+		return;
+	}
+	entry.LastSeen = LastSeen;
+	entry.Index = Index;
+	entry.Team = CDFRTeam::Unknown;
+	//Team is only looked up once per object per tick
+	if (Type == ObjectType::Robot || Type == ObjectType::Pami)
+	{
+		for (CDFRTeam team : {CDFRTeam::Blue, CDFRTeam::Yellow})
+		{
+			if (Name.rfind(TeamNames.at(team), 0) == 0)
+			{
+				entry.Team = team;
+				break;
+			}
+		}
+	}
+	Unsorted.push_back(entry);
+	Keys.push_back((int)Type*NumCells + GetCellY(entry.Position[1])*Width + GetCellX(entry.Position[0]));
+}
+
+void ObjectIndex::Sort()
+{
+	//counting sort on type and cell
+	CellStart.assign(NumTypes*NumCells+1, 0);
+	for (int key : Keys)
+	{
+		CellStart[key+1]++;
+	}
+	for (size_t i = 1; i < CellStart.size(); i++)
+	{
+		CellStart[i] += CellStart[i-1];
+	}
+	Entries.resize(Unsorted.size());
+	for (size_t i = 0; i < Unsorted.size(); i++)
+	{
+		//CellStart[key] is used as the insertion point, and ends up at the start of the next cell
+		Entries[CellStart[Keys[i]]++] = Unsorted[i];
+	}
+	//shift back
+	for (size_t i = CellStart.size()-1; i > 0; i--)
+	{
+		CellStart[i] = CellStart[i-1];
+	}
+	CellStart[0] = 0;
+}
+
+void ObjectIndex::Build(const vector<ObjectData>& Objects)
+{
+	Unsorted.clear();
+	Keys.clear();
+	for (size_t i = 0; i < Objects.size(); i++)
+	{
+		auto &object = Objects[i];
+		Add(object.type, object.location, object.LastSeen, object.name, i);
+	}
+	Sort();
+}
+
+void ObjectIndex::Build(const ObjectSnapshot& Snapshot)
+{
+	Unsorted.clear();
+	Keys.clear();
+	for (size_t i = 0; i < Snapshot.Records.size(); i++)
+	{
+		auto &record = Snapshot.Records[i];
+		if (record.Parent >= 0)
+		{
+			continue;
+		}
+		Add(record.Type, record.Location, record.LastSeen, record.GetName(), i);
+	}
+	Sort();
+}
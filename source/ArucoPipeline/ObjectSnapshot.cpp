@@ -0,0 +1,253 @@
+#include "ArucoPipeline/ObjectSnapshot.hpp"
+
+#include <algorithm>
+#include <Misc/math3d.hpp>
+#include <Visualisation/BoardGL.hpp>
+
+using namespace std;
+
+NameTable& NameTable::Get()
+{
+	static NameTable Table;
+	return Table;
+}
+
+uint32_t NameTable::Intern(string_view Name)
+{
+	{
+		shared_lock lock(Mutex);
+		auto found = Lookup.find(Name);
+		if (found != Lookup.end())
+		{
+			return found->second;
+		}
+	}
+	unique_lock lock(Mutex);
+	auto found = Lookup.find(Name);
+	if (found != Lookup.end())
+	{
+		return found->second;
+	}
+	uint32_t ID = Names.size();
+	Names.emplace_back(Name);
+	Lookup.emplace(Names.back(), ID);
+	return ID;
+}
+
+const string& NameTable::GetName(uint32_t ID) const
+{
+	shared_lock lock(Mutex);
+	return Names.at(ID);
+}
+
+cv::Affine3d ObjectRecord::PredictLocation(ObjectData::TimePoint At, ObjectData::Clock::duration MaxHorizon) const
+{
+	if (!Kinematics.Valid)
+	{
+		return Location;
+	}
+	double dt = chrono::duration<double>(clamp<ObjectData::Clock::duration>(At - LastSeen, ObjectData::Clock::duration::zero(), MaxHorizon)).count();
+	return Kinematics.Extrapolate(Location, dt);
+}
+
+void ObjectSnapshot::Clear()
+{
+	Records.clear();
+	Metadata.clear();
+	ArrayValues.clear();
+	CaptureTime = ObjectData::TimePoint();
+}
+
+void ObjectSnapshot::BuildIndex()
+{
+	Index.Build(*this);
+}
+
+int ObjectSnapshot::Add(const ObjectData& Data, int Parent)
+{
+	NameTable &names = NameTable::Get();
+	ObjectRecord record;
+	record.Type = Data.type;
+	record.NameID = names.Intern(Data.name);
+	record.Parent = Parent;
+	record.Instance = Data.instance;
+	record.Location = Data.location;
+	record.LastSeen = Data.LastSeen;
+	record.MetadataBegin = Metadata.size();
+	record.Kinematics = Data.kinematics;
+	for (auto &[key, value] : Data.metadata.items())
+	{
+		MetadataEntry entry{};
+		entry.KeyID = names.Intern(key);
+		if (value.is_boolean())
+		{
+			entry.Type = MetadataEntry::Kind::Bool;
+			entry.Int = value.get<bool>();
+		}
+		else if (value.is_number_integer())
+		{
+			entry.Type = MetadataEntry::Kind::Int;
+			entry.Int = value.get<int64_t>();
+		}
+		else if (value.is_number())
+		{
+			entry.Type = MetadataEntry::Kind::Double;
+			entry.Double = value.get<double>();
+		}
+		else if (value.is_string())
+		{
+			entry.Type = MetadataEntry::Kind::String;
+			entry.Int = names.Intern(value.get_ref<const string&>());
+		}
+		else if (value.is_array())
+		{
+			entry.Type = MetadataEntry::Kind::DoubleArray;
+			entry.Begin = ArrayValues.size();
+			for (auto &element : value)
+			{
+				if (element.is_number())
+				{
+					ArrayValues.push_back(element.get<double>());
+				}
+			}
+			entry.Count = ArrayValues.size() - entry.Begin;
+		}
+		else //nested objects are not supported
+		{
+			continue;
+		}
+		Metadata.push_back(entry);
+	}
+	record.MetadataCount = Metadata.size() - record.MetadataBegin;
+	int index = Records.size();
+	Records.push_back(record);
+	for (auto &child : Data.Childs)
+	{
+		Add(child, index);
+	}
+	return index;
+}
+
+void ObjectSnapshot::Add(const vector<ObjectData>& Data)
+{
+	for (auto &object : Data)
+	{
+		Add(object, -1);
+	}
+}
+
+nlohmann::json ObjectSnapshot::GetMetadataJson(const ObjectRecord& Record) const
+{
+	NameTable &names = NameTable::Get();
+	nlohmann::json metadata = nlohmann::json::object();
+	for (uint32_t i = Record.MetadataBegin; i < Record.MetadataBegin + Record.MetadataCount; i++)
+	{
+		const MetadataEntry &entry = Metadata[i];
+		nlohmann::json &value = metadata[names.GetName(entry.KeyID)];
+		switch (entry.Type)
+		{
+		case MetadataEntry::Kind::Int:
+			value = entry.Int;
+			break;
+		case MetadataEntry::Kind::Double:
+			value = entry.Double;
+			break;
+		case MetadataEntry::Kind::Bool:
+			value = entry.Int != 0;
+			break;
+		case MetadataEntry::Kind::String:
+			value = names.GetName(entry.Int);
+			break;
+		case MetadataEntry::Kind::DoubleArray:
+			value = nlohmann::json::array();
+			for (uint32_t j = entry.Begin; j < entry.Begin + entry.Count; j++)
+			{
+				value.push_back(ArrayValues[j]);
+			}
+			break;
+		}
+	}
+	return metadata;
+}
+
+ObjectData ObjectSnapshot::ToObjectData(int Index) const
+{
+	const ObjectRecord &record = Records[Index];
+	ObjectData data(record.Type, record.GetName(), record.Location, record.LastSeen);
+	data.instance = record.Instance;
+	data.kinematics = record.Kinematics;
+	if (record.MetadataCount > 0)
+	{
+		data.metadata = GetMetadataJson(record);
+	}
+	//Descendants are stored right after their parent
+	for (size_t i = Index+1; i < Records.size() && Records[i].Parent >= Index; i++)
+	{
+		if (Records[i].Parent == Index)
+		{
+			data.Childs.push_back(ToObjectData(i));
+		}
+	}
+	return data;
+}
+
+vector<ObjectData> ObjectSnapshot::ToObjectData() const
+{
+	vector<ObjectData> data;
+	for (size_t i = 0; i < Records.size(); i++)
+	{
+		if (Records[i].Parent < 0)
+		{
+			data.push_back(ToObjectData(i));
+		}
+	}
+	return data;
+}
+
+vector<GLObject> ObjectSnapshot::ToGLObjects(ObjectData::Clock::duration maxAge) const
+{
+	vector<GLObject> outobj;
+	outobj.reserve(Records.size());
+	vector<int> GLIndex(Records.size(), -1); //index in outobj, -1 if not displayed
+	ObjectData::TimePoint OldCutoff = ObjectData::Clock::now() - maxAge;
+	for (size_t i = 0; i < Records.size(); i++)
+	{
+		const ObjectRecord &record = Records[i];
+		if (record.Parent >= 0 && GLIndex[record.Parent] < 0) //parent isn't displayed
+		{
+			continue;
+		}
+		if (record.LastSeen < OldCutoff)
+		{
+			continue;
+		}
+		auto obj = ObjectData::ToGLObject(record.Type, record.Location,
+			record.MetadataCount > 0 ? GetMetadataJson(record) : nlohmann::json());
+		if (!obj.has_value())
+		{
+			continue;
+		}
+		if (record.Parent >= 0)
+		{
+			obj->location = outobj[GLIndex[record.Parent]].location * obj->location; //apply parent transform to child
+		}
+		GLIndex[i] = outobj.size();
+		outobj.push_back(obj.value());
+	}
+	return outobj;
+}
+
+shared_ptr<ObjectSnapshot> ObjectSnapshotPool::Acquire()
+{
+	lock_guard lock(Mutex);
+	for (auto &snapshot : Pool)
+	{
+		if (snapshot.use_count() == 1) //Only held by the pool
+		{
+			snapshot->Clear();
+			return snapshot;
+		}
+	}
+	Pool.push_back(make_shared<ObjectSnapshot>());
+	return Pool.back();
+}
@@ -3,6 +3,9 @@
 
 #include <vector>
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <climits>
 
 #include <Misc/math3d.hpp>
 #include <ArucoPipeline/StaticObject.hpp>
@@ -28,6 +31,10 @@ void ObjectTracker::RegisterTrackedObject(shared_ptr<TrackedObject> object)
 {
 	int index = objects.size();
 	objects.push_back(object);
+	object->BuildGeometryCache();
+	ObjectState state;
+	state.FilterSlot = Filter.Allocate();
+	states.push_back(state);
 	RegisterArucoRecursive(object, index);
 }
 
@@ -37,6 +44,13 @@ void ObjectTracker::UnregisterTrackedObject(shared_ptr<TrackedObject> object)
 	auto objpos = find(objects.begin(), objects.end(), object);
 	if (objpos != objects.end())
 	{
+		ObjectState &state = states[objpos - objects.begin()];
+		Filter.Release(state.FilterSlot);
+		for (auto &instance : state.Instances)
+		{
+			Filter.Release(instance.FilterSlot);
+		}
+		states.erase(states.begin() + (objpos - objects.begin()));
 		objects.erase(objpos);
 	}
 	
@@ -47,9 +61,10 @@ struct ResolvedLocation
 	float score;
 	Affine3d AbsLoc;
 	Affine3d CameraLoc;
+	int CameraIdx;
 
-	ResolvedLocation(float InScore, Affine3d InObjLoc, Affine3d InCamLoc)
-	:score(InScore), AbsLoc(InObjLoc), CameraLoc(InCamLoc)
+	ResolvedLocation(float InScore, Affine3d InObjLoc, Affine3d InCamLoc, int InCameraIdx)
+	:score(InScore), AbsLoc(InObjLoc), CameraLoc(InCamLoc), CameraIdx(InCameraIdx)
 	{}
 
 	bool operator<(ResolvedLocation& other)
@@ -58,6 +73,41 @@ struct ResolvedLocation
 	}
 };
 
+//Intersect the rays from the 2 best cameras to the object, weighted by their scores. Keeps the rotation of the best view.
+static Affine3d IntersectTwoViews(const Affine3d &Best, const Affine3d &BestCamera, float BestScore, 
+	const Affine3d &Second, const Affine3d &SecondCamera, float SecondScore)
+{
+	Vec3d l1p = Best.translation();
+	Vec3d l2p = Second.translation();
+	Vec3d l1d = NormaliseVector(BestCamera.translation() - l1p);
+	Vec3d l2d = NormaliseVector(SecondCamera.translation() - l2p);
+	Vec3d l1i, l2i;
+	ClosestPointsOnTwoLine(l1p, l1d, l2p, l2d, l1i, l2i);
+	Vec3d locfinal = (l1i*BestScore+l2i*SecondScore)/(BestScore + SecondScore);
+	Affine3d combinedloc = Best;
+	combinedloc.translation(locfinal);
+	return combinedloc;
+}
+
+static float GetCandidateScore(const TrackedObject::InstanceCandidate &candidate)
+{
+	return candidate.Surface/(candidate.ReprojectionError + 0.1);
+}
+
+//Translation block of the covariance, m², in the metadata of the object
+static void ExportCovariance(ObjectData &data, const Matx66d &covariance)
+{
+	nlohmann::json &cov = data.metadata["covariance"];
+	cov = nlohmann::json::array();
+	for (int r = 3; r < 6; r++)
+	{
+		for (int c = 3; c < 6; c++)
+		{
+			cov.push_back(covariance(r,c));
+		}
+	}
+}
+
 bool ObjectTracker::SolveCameraLocation(CameraFeatureData& CameraData)
 {
 	CameraData.CameraTransform = Affine3d::Identity();
@@ -118,6 +168,11 @@ void ObjectTracker::SolveLocationsPerObject(vector<CameraFeatureData>& CameraDat
 					continue;
 				}
 			}
+			if (!object->Unique)
+			{
+				SolveInstances(ObjIdx, CameraData, ReprojectedCorners, Tick);
+				continue;
+			}
 			
 			vector<ResolvedLocation> locations;
 			for (size_t CameraIdx = 0; CameraIdx < CameraData.size(); CameraIdx++)
@@ -135,7 +190,7 @@ void ObjectTracker::SolveLocationsPerObject(vector<CameraFeatureData>& CameraDat
 				{
 					continue;
 				}
-				locations.emplace_back(ScoreThis, transformProposed, ThisCameraData.CameraTransform);
+				locations.emplace_back(ScoreThis, transformProposed, ThisCameraData.CameraTransform, CameraIdx);
 			}
 			if (locations.size() == 0)
 			{
@@ -144,26 +199,93 @@ void ObjectTracker::SolveLocationsPerObject(vector<CameraFeatureData>& CameraDat
 			if (locations.size() == 1)
 			{
 				object->SetLocation(locations[0].AbsLoc, Tick);
+				object->SetLocationCovariance(nullopt);
 				//cout << "Object " << object->Name << " is at location " << objects[ObjIdx]->GetLocation().translation() << " / score: " << locations[0].score << ", seen by 1 camera" << endl;
 				continue;
 			}
 			std::sort(locations.begin(), locations.end());
+			if (object->HasRigidLocation())
+			{
+				Solver.Clear();
+				//Best views first, so that they are kept if there are too many cameras
+				for (auto it = locations.rbegin(); it != locations.rend(); it++)
+				{
+					const CameraFeatureData& ThisCameraData = CameraData[it->CameraIdx];
+					int ViewIdx = Solver.AddView(ThisCameraData.CameraMatrix, ThisCameraData.DistanceCoefficients, ThisCameraData.CameraTransform);
+					if (ViewIdx < 0)
+					{
+						break;
+					}
+					SeenMarkersScratch.clear();
+					object->GetSeenMarkers(ThisCameraData, SeenMarkersScratch);
+					for (auto &seen : SeenMarkersScratch)
+					{
+						for (int j = 0; j < ARUCO_CORNERS_PER_TAG; j++)
+						{
+							Solver.AddObservation(ViewIdx, seen.LocalMarkerCorners[j], (*seen.CameraCornerPositions)[j]);
+						}
+					}
+				}
+				MultiViewSolver::Result solved;
+				if (Solver.Solve(locations.back().AbsLoc, solved) && IsMultiViewSolveValid(*object, solved))
+				{
+					object->SetLocation(solved.Location, Tick);
+					object->SetLocationCovariance(solved.Covariance);
+					continue;
+				}
+			}
+			//Fallback : intersect the rays of the 2 best cameras
 			ResolvedLocation &best = locations[locations.size()-1];
 			ResolvedLocation &secondbest = locations[locations.size()-2];
-			Vec3d l1p = best.AbsLoc.translation();
-			Vec3d l2p = secondbest.AbsLoc.translation();
-			Vec3d l1d = NormaliseVector(best.CameraLoc.translation() - l1p);
-			Vec3d l2d = NormaliseVector(secondbest.CameraLoc.translation() - l2p);
-			Vec3d l1i, l2i;
-			ClosestPointsOnTwoLine(l1p, l1d, l2p, l2d, l1i, l2i);
-			Vec3d locfinal = (l1i*best.score+l2i*secondbest.score)/(best.score + secondbest.score);
-			Affine3d combinedloc = best.AbsLoc;
-			combinedloc.translation(locfinal);
-			object->SetLocation(combinedloc, Tick);
+			object->SetLocation(IntersectTwoViews(best.AbsLoc, best.CameraLoc, best.score, secondbest.AbsLoc, secondbest.CameraLoc, secondbest.score), Tick);
+			object->SetLocationCovariance(nullopt);
 			//cout << "Object " << object->Name << " is at location " << objects[ObjIdx]->GetLocation().translation() << " / score: " << best.score+secondbest.score << ", seen by " << locations.size() << " cameras" << endl;
 		}
 	//});
 
+	if (FilterLocations)
+	{
+		//Filter all the objects seen this tick in one batch, then write back the filtered poses
+		//Instances of non unique objects already queued their measurements
+		for (size_t i = 0; i < objects.size(); i++)
+		{
+			auto &object = objects[i];
+			if (object->GetLastSeenTick() != Tick || !object->HasRigidLocation() || !object->Unique)
+			{
+				continue;
+			}
+			Filter.SetMeasurement(states[i].FilterSlot, object->GetLocation());
+		}
+		Filter.Update(Tick);
+		for (size_t i = 0; i < objects.size(); i++)
+		{
+			auto &object = objects[i];
+			if (object->GetLastSeenTick() != Tick || !object->HasRigidLocation())
+			{
+				continue;
+			}
+			if (object->Unique)
+			{
+				object->SetLocation(Filter.GetFilteredLocation(states[i].FilterSlot, object->GetLocation()), Tick);
+				continue;
+			}
+			bool first = true;
+			for (auto &instance : states[i].Instances)
+			{
+				if (instance.LastSeen != Tick)
+				{
+					continue;
+				}
+				instance.Location = Filter.GetFilteredLocation(instance.FilterSlot, instance.Location);
+				if (first)
+				{
+					object->SetLocation(instance.Location, Tick);
+					first = false;
+				}
+			}
+		}
+	}
+
 	for (int CamIdx = 0; CamIdx < NumCameras; CamIdx++)
 	{
 		for (auto it = ReprojectedCorners[CamIdx].begin(); it != ReprojectedCorners[CamIdx].end(); it++)
@@ -186,6 +308,46 @@ vector<ObjectData> ObjectTracker::GetObjectDataVector(TrackedObject::TimePoint T
 		}
 		
 		vector<ObjectData> lp = objects[i]->ToObjectData();
+		Vec4d Position;
+		if (!objects[i]->Unique)
+		{
+			//One entry per tracked instance, ToObjectData gives the template
+			if (lp.size() == 0)
+			{
+				continue;
+			}
+			for (auto &instance : states[i].Instances)
+			{
+				ObjectData data = lp[0];
+				data.location = instance.Location;
+				data.LastSeen = instance.LastSeen;
+				data.instance = instance.ID;
+				if (FilterLocations)
+				{
+					data.kinematics.Valid = Filter.GetState(instance.FilterSlot, Position, data.kinematics.Velocity, data.kinematics.Acceleration);
+				}
+				if (instance.Covariance.has_value())
+				{
+					ExportCovariance(data, *instance.Covariance);
+				}
+				ObjectDatas.push_back(data);
+			}
+			for (size_t j = 1; j < lp.size(); j++)
+			{
+				ObjectDatas.push_back(lp[j]);
+			}
+			continue;
+		}
+		if (FilterLocations && lp.size() > 0 && objects[i]->HasRigidLocation())
+		{
+			ObjectKinematics &kinematics = lp[0].kinematics;
+			kinematics.Valid = Filter.GetState(states[i].FilterSlot, Position, kinematics.Velocity, kinematics.Acceleration);
+		}
+		auto &covariance = objects[i]->GetLocationCovariance();
+		if (covariance.has_value() && lp.size() > 0)
+		{
+			ExportCovariance(lp[0], *covariance);
+		}
 		for (size_t j = 0; j < lp.size(); j++)
 		{
 			ObjectDatas.push_back(lp[j]);
@@ -237,4 +399,210 @@ void ObjectTracker::RegisterArucoRecursive(shared_ptr<TrackedObject> object, int
 	{
 		RegisterArucoRecursive(object->childs[i], index);
 	}
-}
\ No newline at end of file
+}
+
+void ObjectTracker::SolveInstances(int ObjIdx, vector<CameraFeatureData>& CameraData, 
+	vector<map<int, ArucoCornerArray>> &ReprojectedCorners, TrackedObject::TimePoint Tick)
+{
+	TrackedObject &object = *objects[ObjIdx];
+	ObjectState &state = states[ObjIdx];
+	CandidateScratch.clear();
+	for (size_t CameraIdx = 0; CameraIdx < CameraData.size(); CameraIdx++)
+	{
+		CameraFeatureData& ThisCameraData = CameraData[CameraIdx];
+		if (ThisCameraData.ArucoCorners.size() == 0) //Not seen
+		{
+			continue;
+		}
+		object.GetInstanceCandidates(ThisCameraData, CameraIdx, CandidateScratch, ReprojectedCorners[CameraIdx]);
+	}
+
+	//Merge the candidates from different cameras that are close enough to be the same instance, best candidates first
+	ClusterScratch.clear();
+	sort(CandidateScratch.begin(), CandidateScratch.end(), [](const TrackedObject::InstanceCandidate& a, const TrackedObject::InstanceCandidate& b)
+	{
+		return GetCandidateScore(a) > GetCandidateScore(b);
+	});
+	for (size_t CandidateIdx = 0; CandidateIdx < CandidateScratch.size(); CandidateIdx++)
+	{
+		auto &candidate = CandidateScratch[CandidateIdx];
+		if (GetCandidateScore(candidate) < 1 || candidate.ReprojectionError == INFINITY) //Bad solve
+		{
+			continue;
+		}
+		Vec3d translation = candidate.Location.translation();
+		uint32_t CameraBit = 1u << (candidate.CameraIdx % 32);
+		InstanceCluster* merged = nullptr;
+		for (auto &cluster : ClusterScratch)
+		{
+			//A camera cannot see the same instance twice
+			if ((cluster.CameraMask & CameraBit) == 0 && norm(cluster.Location.translation() - translation) < InstanceMergeDistance)
+			{
+				merged = &cluster;
+				break;
+			}
+		}
+		if (merged == nullptr)
+		{
+			InstanceCluster cluster;
+			cluster.Location = candidate.Location;
+			cluster.Covariance = nullopt;
+			cluster.CameraMask = CameraBit;
+			cluster.NumCandidates = 1;
+			cluster.Candidates[0] = CandidateIdx;
+			ClusterScratch.push_back(cluster);
+			continue;
+		}
+		merged->CameraMask |= CameraBit;
+		if (merged->NumCandidates < (int)merged->Candidates.size())
+		{
+			merged->Candidates[merged->NumCandidates++] = CandidateIdx;
+		}
+	}
+
+	//Instances seen by several cameras are solved from all of them, as unique objects are
+	for (auto &cluster : ClusterScratch)
+	{
+		if (cluster.NumCandidates < 2)
+		{
+			continue;
+		}
+		if (object.HasRigidLocation() && SolveCluster(object, CameraData, cluster))
+		{
+			continue;
+		}
+		auto &best = CandidateScratch[cluster.Candidates[0]];
+		auto &secondbest = CandidateScratch[cluster.Candidates[1]];
+		cluster.Location = IntersectTwoViews(best.Location, CameraData[best.CameraIdx].CameraTransform, GetCandidateScore(best),
+			secondbest.Location, CameraData[secondbest.CameraIdx].CameraTransform, GetCandidateScore(secondbest));
+	}
+
+	//Gated greedy nearest neighbour between the predicted instances and the clusters
+	auto &Instances = state.Instances;
+	PairScratch.clear();
+	for (size_t i = 0; i < Instances.size(); i++)
+	{
+		Vec3d Predicted = Instances[i].Location.translation();
+		Vec4d Position, Velocity, Acceleration;
+		if (Filter.GetState(Instances[i].FilterSlot, Position, Velocity, Acceleration))
+		{
+			double dt = min(chrono::duration<double>(Tick - Instances[i].LastSeen).count(), 0.25);
+			for (int axis = 0; axis < 3; axis++)
+			{
+				Predicted[axis] = Position[axis] + Velocity[axis]*dt + Acceleration[axis]*dt*dt/2;
+			}
+		}
+		for (size_t k = 0; k < ClusterScratch.size(); k++)
+		{
+			double distance = norm(ClusterScratch[k].Location.translation() - Predicted);
+			if (distance < InstanceGateDistance)
+			{
+				PairScratch.push_back({distance, (int)i, (int)k});
+			}
+		}
+	}
+	sort(PairScratch.begin(), PairScratch.end());
+	InstanceAssigned.assign(Instances.size(), 0);
+	ClusterAssigned.assign(ClusterScratch.size(), 0);
+	auto UpdateInstance = [&](ObjectInstance &instance, const InstanceCluster &cluster)
+	{
+		instance.Location = cluster.Location;
+		instance.Covariance = cluster.Covariance;
+		instance.LastSeen = Tick;
+		Filter.SetMeasurement(instance.FilterSlot, instance.Location);
+	};
+	for (auto &pair : PairScratch)
+	{
+		if (InstanceAssigned[pair.InstanceIdx] || ClusterAssigned[pair.ClusterIdx])
+		{
+			continue;
+		}
+		InstanceAssigned[pair.InstanceIdx] = 1;
+		ClusterAssigned[pair.ClusterIdx] = 1;
+		UpdateInstance(Instances[pair.InstanceIdx], ClusterScratch[pair.ClusterIdx]);
+	}
+
+	//Forget lost instances, then start new ones for the unassigned clusters
+	for (auto it = Instances.begin(); it != Instances.end();)
+	{
+		if (Tick - it->LastSeen > InstanceTimeout)
+		{
+			Filter.Release(it->FilterSlot);
+			it = Instances.erase(it);
+			continue;
+		}
+		it++;
+	}
+	for (size_t k = 0; k < ClusterScratch.size(); k++)
+	{
+		if (ClusterAssigned[k])
+		{
+			continue;
+		}
+		ObjectInstance instance;
+		instance.ID = state.NextInstanceID;
+		state.NextInstanceID = state.NextInstanceID == INT_MAX ? 0 : state.NextInstanceID+1; //wraps before reaching -1, which means unique
+		instance.FilterSlot = Filter.Allocate();
+		UpdateInstance(instance, ClusterScratch[k]);
+		Instances.push_back(instance);
+	}
+
+	//The object itself follows its oldest instance seen this tick
+	for (auto &instance : Instances)
+	{
+		if (instance.LastSeen == Tick)
+		{
+			object.SetLocation(instance.Location, Tick);
+			break;
+		}
+	}
+}
+
+bool ObjectTracker::IsMultiViewSolveValid(const TrackedObject &object, const MultiViewSolver::Result &solved) const
+{
+	if (solved.ReprojectionError >= MultiViewMaxReprojectionError)
+	{
+		return false;
+	}
+	//Cameras looking from the same side can agree on a pose that floats or sinks, the single camera path keeps known heights
+	auto ExpectedHeight = object.GetExpectedHeight();
+	return !ExpectedHeight.has_value() || abs(solved.Location.translation()[2] - *ExpectedHeight) < MultiViewMaxHeightError;
+}
+
+bool ObjectTracker::SolveCluster(TrackedObject &object, const vector<CameraFeatureData>& CameraData, InstanceCluster &cluster)
+{
+	Solver.Clear();
+	for (int i = 0; i < cluster.NumCandidates; i++)
+	{
+		const TrackedObject::InstanceCandidate &candidate = CandidateScratch[cluster.Candidates[i]];
+		const CameraFeatureData& ThisCameraData = CameraData[candidate.CameraIdx];
+		int ViewIdx = Solver.AddView(ThisCameraData.CameraMatrix, ThisCameraData.DistanceCoefficients, ThisCameraData.CameraTransform);
+		if (ViewIdx < 0)
+		{
+			break;
+		}
+		//Only the tags of this instance : the camera can see other instances of the same object
+		SeenMarkersScratch.clear();
+		object.GetSeenMarkers(ThisCameraData, SeenMarkersScratch);
+		for (auto &seen : SeenMarkersScratch)
+		{
+			auto MarkersEnd = candidate.MarkerIndices.begin() + candidate.NumMarkers;
+			if (find(candidate.MarkerIndices.begin(), MarkersEnd, seen.IndexInCameraData) == MarkersEnd)
+			{
+				continue;
+			}
+			for (int j = 0; j < ARUCO_CORNERS_PER_TAG; j++)
+			{
+				Solver.AddObservation(ViewIdx, seen.LocalMarkerCorners[j], (*seen.CameraCornerPositions)[j]);
+			}
+		}
+	}
+	MultiViewSolver::Result solved;
+	if (!Solver.Solve(cluster.Location, solved) || !IsMultiViewSolveValid(object, solved))
+	{
+		return false;
+	}
+	cluster.Location = solved.Location;
+	cluster.Covariance = solved.Covariance;
+	return true;
+}
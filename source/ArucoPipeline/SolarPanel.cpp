@@ -42,7 +42,7 @@ Affine3d SolarPanel::GetObjectTransform(const CameraFeatureData& CameraData, flo
 	fill(PanelSeenLastTick.begin(), PanelSeenLastTick.end(), false);
 	for (auto &marker : SeenMarkers)
 	{
-		auto& flatimg = marker.CameraCornerPositions;
+		auto& flatimg = *marker.CameraCornerPositions;
 
 		Point2d AimPos = (flatimg[0]+flatimg[1])/2.0;
 		int closest = -1;
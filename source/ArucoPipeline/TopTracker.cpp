@@ -3,6 +3,7 @@
 #include <ArucoPipeline/ObjectIdentity.hpp>
 
 #include <Misc/math3d.hpp>
+#include <opencv2/imgproc.hpp>
 
 #include <iostream>
 
@@ -27,26 +28,54 @@ TopTracker::~TopTracker()
 Affine3d TopTracker::GetObjectTransform(const CameraFeatureData& CameraData, float& Surface, float& ReprojectionError, 
 	map<int, ArucoCornerArray> &ReprojectedCorners)
 {
-
 	std::vector<ArucoViewCameraLocal> SeenMarkers;
-	Surface = GetSeenMarkers(CameraData, SeenMarkers);
+	GetSeenMarkers(CameraData, SeenMarkers);
+	Surface = 0;
+	ReprojectionError = INFINITY;
 	if (SeenMarkers.size() == 0)
 	{
 		return Affine3d::Identity();
 	}
-	
-	ReprojectionError = 0;
+	//If there are multiple instances, use the biggest one
+	size_t biggest = 0;
+	for (size_t i = 0; i < SeenMarkers.size(); i++)
+	{
+		float area = contourArea(*SeenMarkers[i].CameraCornerPositions);
+		if (area > Surface)
+		{
+			Surface = area;
+			biggest = i;
+		}
+	}
+	return SolveMarker(CameraData, SeenMarkers[biggest], ReprojectionError, ReprojectedCorners);
+}
+
+void TopTracker::GetInstanceCandidates(const CameraFeatureData& CameraData, int CameraIdx, vector<InstanceCandidate> &Candidates, 
+	map<int, ArucoCornerArray> &ReprojectedCorners)
+{
+	std::vector<ArucoViewCameraLocal> SeenMarkers;
+	GetSeenMarkers(CameraData, SeenMarkers);
+	for (auto &marker : SeenMarkers)
+	{
+		InstanceCandidate candidate;
+		candidate.Surface = contourArea(*marker.CameraCornerPositions);
+		candidate.Location = CameraData.CameraTransform * SolveMarker(CameraData, marker, candidate.ReprojectionError, ReprojectedCorners);
+		candidate.CameraIdx = CameraIdx;
+		candidate.NumMarkers = 1;
+		candidate.MarkerIndices[0] = marker.IndexInCameraData;
+		Candidates.push_back(candidate);
+	}
+}
+
+Affine3d TopTracker::SolveMarker(const CameraFeatureData& CameraData, const ArucoViewCameraLocal &marker, float& ReprojectionError, 
+	map<int, ArucoCornerArray> &ReprojectedCorners) const
+{
+	ReprojectionError = INFINITY;
 	Affine3d WorldToCam = CameraData.CameraTransform.inv();
 	auto UpVector = GetAxis(WorldToCam.rotation(), 2);
-	auto marker = SeenMarkers[0];
-	auto& flatimg = marker.CameraCornerPositions;
-	const auto& markerobj = markers[0];
+	auto& flatimg = *marker.CameraCornerPositions;
+	const auto& markerobj = *marker.Marker;
 	auto &flatobj = markerobj.GetObjectPointsNoOffset();
-	
-	if (SeenMarkers.size() > 1)
-	{
-		cerr << "Warning : more than 1 top tracker with tag " << markerobj.number << endl;
-	}
 
 	Mat rvec = Mat::zeros(3, 1, CV_64F), tvec = Mat::zeros(3, 1, CV_64F);
 	bool solved = false;
@@ -87,9 +116,12 @@ Affine3d TopTracker::GetObjectTransform(const CameraFeatureData& CameraData, flo
 	projectPoints(markerobj.GetObjectPointsNoOffset(), rvec, tvec, CameraData.CameraMatrix, CameraData.DistanceCoefficients, ReprojectedCornersDouble);
 	auto &ReprojectedCornersStorage = ReprojectedCorners[marker.IndexInCameraData];
 	ReprojectedCornersStorage.resize(ReprojectedCornersDouble.size());
+	ReprojectionError = 0;
 	for (size_t i = 0; i < ReprojectedCornersDouble.size(); i++)
 	{
 		ReprojectedCornersStorage[i] = ReprojectedCornersDouble[i];
+		Point2f diff = flatimg[i] - ReprojectedCornersStorage[i];
+		ReprojectionError += sqrt(diff.ddot(diff));
 	}
 	return localTransform;
 }
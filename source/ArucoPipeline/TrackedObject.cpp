@@ -28,13 +28,6 @@ array<Point3d, 4> ArucoMarker::GetObjectPointsNoOffset(double SideLength)
 
 const array<Point3d, 4>& ArucoMarker::GetObjectPointsNoOffset() const
 {
-	if (ObjectPointsNoOffset.size() != 4)
-	{
-		assert(sideLength > 0);
-		ObjectPointsNoOffset = GetObjectPointsNoOffset(sideLength);
-	}
-	
-	assert(ObjectPointsNoOffset.size() == 4);
 	return ObjectPointsNoOffset;
 }
 
@@ -43,50 +36,12 @@ TrackedObject::TrackedObject()
 	CoplanarTags(false),
 	Location(cv::Affine3d::Identity())
 {
-	LocationFilter = cv::KalmanFilter(9, 3, 0, CV_64F);
-
-	cv::setIdentity(LocationFilter.processNoiseCov, cv::Scalar::all(1e-5)); //0.1mm error
-	cv::setIdentity(LocationFilter.measurementNoiseCov, cv::Scalar::all(1e-1));//1mm error
-	cv::setIdentity(LocationFilter.errorCovPost, cv::Scalar::all(1));
 };
 
 bool TrackedObject::SetLocation(Affine3d InLocation, TimePoint Tick)
 {
 	Location = InLocation;
-	double dt = chrono::duration<double>(Tick - LastSeenTick).count();
 	LastSeenTick = Tick;
-	if (1) //disable kalman filtering
-	{
-		return true;
-	}
-	
-	
-	dt /= getTickFrequency();
-	LocationFilter.transitionMatrix = Mat::eye(9,9, CV_64F);
-	double v = dt*10;//filter 10Hz
-	double a = v*v/2;
-	for (int i = 0; i < 6; i++)
-	{
-		LocationFilter.transitionMatrix.at<double>(i, 3+i) = v;
-	}
-	for (int i = 0; i < 3; i++)
-	{
-		LocationFilter.transitionMatrix.at<double>(i, 6+i) = a;
-		LocationFilter.measurementMatrix.at<double>(i, i) = 1;
-		LocationFilter.measurementMatrix.at<double>(i, 3+i) = v;
-		LocationFilter.measurementMatrix.at<double>(i, 6+i) = a;
-	}
-	//cout << "Transition matrix: " << endl << LocationFilter.transitionMatrix << endl;
-	//cout << "Measurement matrix: " << endl << LocationFilter.measurementMatrix << endl;
-	Mat locmat(InLocation.translation());
-	//cout << "locmat: " <<endl << locmat << endl;
-	LocationFilter.correct(locmat);
-	LocationFilter.predict();
-	Mat correctmat = LocationFilter.statePost;
-	//cout << "corrmat: " << correctmat.t() << endl;
-	Vec3d correctloc(correctmat.rowRange(0, 3));
-
-	Location.translation(correctloc);
 	return true;
 }
 
@@ -149,40 +104,73 @@ void TrackedObject::GetObjectPoints(vector<vector<Point3d>>& MarkerCorners, vect
 	}
 }
 
-float TrackedObject::GetSeenMarkers(const CameraFeatureData& CameraData, vector<ArucoViewCameraLocal> &MarkersSeen, cv::Affine3d AccumulatedTransform)
+void TrackedObject::BuildGeometryCache()
 {
-	float surface = 0;
-	MarkersSeen.reserve(markers.size());
-	for (size_t i = 0; i < markers.size(); i++)
+	CachedMarkers.clear();
+	CachedCorners.clear();
+	CachedMarkerIndex.fill(-1);
+	//Depth first, same order as the childs
+	vector<pair<TrackedObject*, Affine3d>> stack = {{this, Affine3d::Identity()}};
+	while (stack.size() > 0)
 	{
-		for (size_t j = 0; j < CameraData.ArucoIndices.size(); j++)
+		auto [object, AccumulatedTransform] = stack.back();
+		stack.pop_back();
+		for (auto &marker : object->markers)
 		{
-			if (markers[i].number == CameraData.ArucoIndices[j])
+			if (marker.number < 0 || marker.number >= ARUCO_DICT_SIZE)
+			{
+				continue;
+			}
+			if (CachedMarkerIndex[marker.number] != -1)
+			{
+				cerr << "WARNING: Tag " << marker.number << " is present multiple times in object " << Name << endl;
+				continue;
+			}
+			CachedMarkerIndex[marker.number] = CachedMarkers.size();
+			CachedMarkers.push_back({&marker, AccumulatedTransform});
+			Affine3d TransformToObject = AccumulatedTransform * marker.Pose;
+			for (auto &corner : ArucoMarker::GetObjectPointsNoOffset(marker.sideLength))
 			{
-				//gotcha!
-				ArucoViewCameraLocal seen;
-				seen.Marker = &markers[i];
-				seen.IndexInCameraData = j;
-				seen.CameraCornerPositions = CameraData.ArucoCorners[j];
-				seen.AccumulatedTransform = AccumulatedTransform;
-				auto &cornersLocal = markers[i].GetObjectPointsNoOffset();
-				Affine3d TransformToObject = AccumulatedTransform * markers[i].Pose;
-				seen.LocalMarkerCorners.reserve(cornersLocal.size());
-				for (size_t k = 0; k < cornersLocal.size(); k++)
-				{
-					seen.LocalMarkerCorners.push_back(TransformToObject * cornersLocal[k]);
-				}
-				MarkersSeen.push_back(seen);
-				surface += contourArea(CameraData.ArucoCorners[j], false);
+				CachedCorners.push_back(TransformToObject * corner);
 			}
-			
 		}
-		
+		for (auto it = object->childs.rbegin(); it != object->childs.rend(); it++)
+		{
+			stack.emplace_back(it->get(), AccumulatedTransform * (*it)->Location);
+		}
 	}
-	for (size_t i = 0; i < childs.size(); i++)
+	GeometryCacheBuilt = true;
+}
+
+float TrackedObject::GetSeenMarkers(const CameraFeatureData& CameraData, vector<ArucoViewCameraLocal> &MarkersSeen)
+{
+	if (!GeometryCacheBuilt)
 	{
-		auto child = childs[i];
-		surface += child->GetSeenMarkers(CameraData, MarkersSeen, AccumulatedTransform * child->Location);
+		BuildGeometryCache();
+	}
+	float surface = 0;
+	for (size_t j = 0; j < CameraData.ArucoIndices.size(); j++)
+	{
+		int MarkerID = CameraData.ArucoIndices[j];
+		if (MarkerID < 0 || MarkerID >= ARUCO_DICT_SIZE)
+		{
+			continue;
+		}
+		int CacheIndex = CachedMarkerIndex[MarkerID];
+		if (CacheIndex < 0)
+		{
+			continue;
+		}
+		//gotcha!
+		const CachedMarker &cached = CachedMarkers[CacheIndex];
+		ArucoViewCameraLocal seen;
+		seen.Marker = cached.Marker;
+		seen.IndexInCameraData = j;
+		seen.CameraCornerPositions = &CameraData.ArucoCorners[j];
+		seen.AccumulatedTransform = cached.AccumulatedTransform;
+		seen.LocalMarkerCorners = &CachedCorners[CacheIndex*ARUCO_CORNERS_PER_TAG];
+		MarkersSeen.push_back(seen);
+		surface += contourArea(CameraData.ArucoCorners[j], false);
 	}
 	return surface;
 }
@@ -191,17 +179,18 @@ float TrackedObject::ReprojectSeenMarkers(const std::vector<ArucoViewCameraLocal
 	const CameraFeatureData &CameraData, map<int, ArucoCornerArray> &ReprojectedCorners)
 {
 	float ReprojectionError = 0;
+	array<Point2d, ARUCO_CORNERS_PER_TAG> cornersreproj;
 	for (size_t i = 0; i < MarkersSeen.size(); i++)
 	{
-		vector<Point2d> cornersreproj;
-		projectPoints(MarkersSeen[i].LocalMarkerCorners, rvec, tvec, CameraData.CameraMatrix, CameraData.DistanceCoefficients, cornersreproj);
+		projectPoints(_InputArray(MarkersSeen[i].LocalMarkerCorners, ARUCO_CORNERS_PER_TAG), rvec, tvec, 
+			CameraData.CameraMatrix, CameraData.DistanceCoefficients, cornersreproj);
 		//cout << "reprojecting " << MarkersSeen[i].IndexInCameraData << endl;
 		auto &reprojectedThisStorage = ReprojectedCorners[MarkersSeen[i].IndexInCameraData];
 		reprojectedThisStorage.resize(cornersreproj.size());
 		for (size_t j = 0; j < cornersreproj.size(); j++)
 		{
 			reprojectedThisStorage[j] = cornersreproj[j];
-			Point2f diff = MarkersSeen[i].CameraCornerPositions[j] - Point2f(cornersreproj[j]);
+			Point2f diff = (*MarkersSeen[i].CameraCornerPositions)[j] - Point2f(cornersreproj[j]);
 			ReprojectionError += sqrt(diff.ddot(diff));
 		}
 	}
@@ -211,8 +200,20 @@ float TrackedObject::ReprojectSeenMarkers(const std::vector<ArucoViewCameraLocal
 Affine3d TrackedObject::GetObjectTransform(const CameraFeatureData& CameraData, float& Surface, float& ReprojectionError, 
 	map<int, ArucoCornerArray> &ReprojectedCorners)
 {
-	vector<ArucoViewCameraLocal> SeenMarkers;
-	Surface = GetSeenMarkers(CameraData, SeenMarkers, Affine3d::Identity());
+	//Scratch storage, reused between calls to avoid allocations
+	static thread_local vector<ArucoViewCameraLocal> SeenMarkers;
+	SeenMarkers.clear();
+	Surface = GetSeenMarkers(CameraData, SeenMarkers);
+	return SolveSeenMarkers(CameraData, SeenMarkers, ReprojectionError, ReprojectedCorners);
+}
+
+Affine3d TrackedObject::SolveSeenMarkers(const CameraFeatureData& CameraData, vector<ArucoViewCameraLocal> &SeenMarkers, float& ReprojectionError, 
+	map<int, ArucoCornerArray> &ReprojectedCorners)
+{
+	static thread_local vector<Point3d> flatobj;
+	static thread_local vector<Point2f> flatimg;
+	flatobj.clear();
+	flatimg.clear();
 	ReprojectionError = INFINITY;
 	int nummarkersseen = SeenMarkers.size();
 
@@ -221,34 +222,24 @@ Affine3d TrackedObject::GetObjectTransform(const CameraFeatureData& CameraData,
 		return Affine3d::Identity();
 	}
 	Affine3d localTransform;
-	vector<Point3d> flatobj;
-	vector<Point2f> flatimg;
-	//vector<Point2d> flatreproj;
-	flatobj.reserve(nummarkersseen * ARUCO_CORNERS_PER_TAG);
-	flatimg.reserve(nummarkersseen * ARUCO_CORNERS_PER_TAG);
 	Mat rvec = Mat::zeros(3, 1, CV_64F), tvec = Mat::zeros(3, 1, CV_64F);
 	Affine3d objectToMarker;
 	int flags = 0;
 	if (nummarkersseen == 1)
 	{
 		auto& objpts = SeenMarkers[0].Marker->GetObjectPointsNoOffset();
-		flatobj = vector<Point3d>(objpts.begin(), objpts.end());
-		SeenMarkers[0].LocalMarkerCorners = flatobj; //hack to have ReprojectSeenMarkers work wih a single marker too
-		flatimg = vector<Point2f>(SeenMarkers[0].CameraCornerPositions.begin(), SeenMarkers[0].CameraCornerPositions.end());
+		flatobj.insert(flatobj.end(), objpts.begin(), objpts.end());
+		SeenMarkers[0].LocalMarkerCorners = objpts.data(); //hack to have ReprojectSeenMarkers work wih a single marker too
+		flatimg.insert(flatimg.end(), SeenMarkers[0].CameraCornerPositions->begin(), SeenMarkers[0].CameraCornerPositions->end());
 		objectToMarker = SeenMarkers[0].AccumulatedTransform * SeenMarkers[0].Marker->Pose;
 		flags |= SOLVEPNP_IPPE_SQUARE;
 	}
 	else
 	{
-		flatobj.reserve(nummarkersseen*ARUCO_CORNERS_PER_TAG);
-		flatimg.reserve(nummarkersseen*ARUCO_CORNERS_PER_TAG);
 		for (int i = 0; i < nummarkersseen; i++)
 		{
-			for (int j = 0; j < ARUCO_CORNERS_PER_TAG; j++)
-			{
-				flatobj.push_back(SeenMarkers[i].LocalMarkerCorners[j]);
-				flatimg.push_back(SeenMarkers[i].CameraCornerPositions[j]);
-			}
+			flatobj.insert(flatobj.end(), SeenMarkers[i].LocalMarkerCorners, SeenMarkers[i].LocalMarkerCorners + ARUCO_CORNERS_PER_TAG);
+			flatimg.insert(flatimg.end(), SeenMarkers[i].CameraCornerPositions->begin(), SeenMarkers[i].CameraCornerPositions->begin() + ARUCO_CORNERS_PER_TAG);
 		}
 		objectToMarker = Affine3d::Identity();
 		flags |= CoplanarTags ? SOLVEPNP_IPPE : SOLVEPNP_SQPNP;
@@ -278,6 +269,26 @@ Affine3d TrackedObject::GetObjectTransform(const CameraFeatureData& CameraData,
 	
 }
 
+void TrackedObject::GetInstanceCandidates(const CameraFeatureData& CameraData, int CameraIdx, vector<InstanceCandidate> &Candidates, 
+	map<int, ArucoCornerArray> &ReprojectedCorners)
+{
+	static thread_local vector<ArucoViewCameraLocal> SeenMarkers;
+	InstanceCandidate candidate;
+	candidate.Location = CameraData.CameraTransform * GetObjectTransform(CameraData, candidate.Surface, candidate.ReprojectionError, ReprojectedCorners);
+	candidate.CameraIdx = CameraIdx;
+	SeenMarkers.clear();
+	GetSeenMarkers(CameraData, SeenMarkers);
+	for (auto &seen : SeenMarkers)
+	{
+		if (candidate.NumMarkers == InstanceCandidate::MaxMarkers)
+		{
+			break;
+		}
+		candidate.MarkerIndices[candidate.NumMarkers++] = seen.IndexInCameraData;
+	}
+	Candidates.push_back(candidate);
+}
+
 vector<ObjectData> TrackedObject::GetMarkersAndChilds() const
 {
 	vector<ObjectData> datas;
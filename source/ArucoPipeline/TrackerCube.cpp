@@ -3,11 +3,16 @@
 #include <ArucoPipeline/ObjectIdentity.hpp>
 
 #include <Misc/math3d.hpp>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <iostream>
 
 using namespace cv;
 using namespace std;
 
-TrackerCube::TrackerCube(vector<int> MarkerIdx, double MarkerSize, double Diameter, String InName)
+TrackerCube::TrackerCube(vector<int> MarkerIdx, double MarkerSize, double InDiameter, String InName)
+	:Diameter(InDiameter)
 {
 	Unique = false;
 	Name = InName;
@@ -40,6 +45,87 @@ TrackerCube::~TrackerCube()
 {
 }
 
+void TrackerCube::GetInstanceCandidates(const CameraFeatureData& CameraData, int CameraIdx, vector<InstanceCandidate> &Candidates, 
+	map<int, ArucoCornerArray> &ReprojectedCorners)
+{
+	//Scratch storage, reused between calls to avoid allocations
+	static thread_local vector<ArucoViewCameraLocal> SeenMarkers, GroupMarkers;
+	static thread_local vector<Vec3d> Centers;
+	static thread_local vector<int> Groups;
+	SeenMarkers.clear();
+	GetSeenMarkers(CameraData, SeenMarkers);
+	const int NumSeen = SeenMarkers.size();
+	Centers.resize(NumSeen);
+	Groups.assign(NumSeen, -1);
+
+	//Center of the cube implied by each tag on its own
+	for (int i = 0; i < NumSeen; i++)
+	{
+		auto &seen = SeenMarkers[i];
+		Mat rvec = Mat::zeros(3, 1, CV_64F), tvec = Mat::zeros(3, 1, CV_64F);
+		try
+		{
+			solvePnP(seen.Marker->GetObjectPointsNoOffset(), *seen.CameraCornerPositions, CameraData.CameraMatrix, CameraData.DistanceCoefficients, 
+				rvec, tvec, false, SOLVEPNP_IPPE_SQUARE);
+		}
+		catch(const std::exception& e)
+		{
+			std::cerr << e.what() << '\n';
+			Groups[i] = -2; //Not used
+			continue;
+		}
+		Matx33d rotationMatrix;
+		Rodrigues(rvec, rotationMatrix);
+		Affine3d objectToMarker = seen.AccumulatedTransform * seen.Marker->Pose;
+		Centers[i] = (Affine3d(rotationMatrix, tvec) * objectToMarker.inv()).translation();
+	}
+
+	//Greedy grouping : two cubes cannot be closer than their diameter, and a cube has each tag once
+	const double GroupDistance = Diameter * 0.6;
+	for (int i = 0; i < NumSeen; i++)
+	{
+		if (Groups[i] != -1)
+		{
+			continue;
+		}
+		Groups[i] = i;
+		GroupMarkers.clear();
+		GroupMarkers.push_back(SeenMarkers[i]);
+		for (int j = i+1; j < NumSeen; j++)
+		{
+			if (Groups[j] != -1 || norm(Centers[j] - Centers[i]) > GroupDistance)
+			{
+				continue;
+			}
+			bool duplicate = false;
+			for (auto &grouped : GroupMarkers)
+			{
+				duplicate |= grouped.Marker == SeenMarkers[j].Marker;
+			}
+			if (duplicate)
+			{
+				continue;
+			}
+			Groups[j] = i;
+			GroupMarkers.push_back(SeenMarkers[j]);
+		}
+
+		InstanceCandidate candidate;
+		candidate.Surface = 0;
+		for (auto &grouped : GroupMarkers)
+		{
+			candidate.Surface += contourArea(*grouped.CameraCornerPositions, false);
+			if (candidate.NumMarkers < InstanceCandidate::MaxMarkers)
+			{
+				candidate.MarkerIndices[candidate.NumMarkers++] = grouped.IndexInCameraData;
+			}
+		}
+		candidate.Location = CameraData.CameraTransform * SolveSeenMarkers(CameraData, GroupMarkers, candidate.ReprojectionError, ReprojectedCorners);
+		candidate.CameraIdx = CameraIdx;
+		Candidates.push_back(candidate);
+	}
+}
+
 vector<ObjectData> TrackerCube::ToObjectData() const
 {
 	ObjectData robot(ObjectType::Robot, Name, Location, LastSeenTick);
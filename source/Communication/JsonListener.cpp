@@ -1,6 +1,7 @@
 #include "Communication/JsonListener.hpp"
 #include <Communication/Transport/TCPTransport.hpp>
 #include <Communication/TCPJsonHost.hpp>
+#include <Communication/BinaryProtocol.hpp>
 #include <Cameras/ImageTypes.hpp>
 #include <EntryPoints/CDFRExternal.hpp>
 #include <EntryPoints/CDFRInternal.hpp>
@@ -9,28 +10,37 @@
 #include <Misc/GlobalConf.hpp>
 
 #include <opencv2/imgcodecs.hpp>
+#include <opencv2/core/quaternion.hpp>
+#include <opencv2/imgproc.hpp>
+#include <sys/uio.h>
 #include <libbase64.h>
 
 #include <nlohmann/json.hpp>
 #include <iostream>
 #include <fstream>
 #include <set>
+#include <array>
+#include <cmath>
+#include <charconv>
+#include <limits>
 
 using namespace std;
 using namespace nlohmann;
 
-JsonListener::JsonListener(TCPTransport* InTransport, string InClientName, TCPJsonHost* InParent)
-	:Transport(InTransport), ClientName(InClientName), Parent(InParent)
+JsonListener::JsonListener(TCPTransport* InTransport, TCPTransport::ConnectionHandle InHandle, TCPJsonHost* InParent)
+	:Framer(GetJsonHostSettings().MaxFrameSize), Transport(InTransport), Handle(InHandle), Parent(InParent)
 {
+	ClientName = Transport->GetClientName(Handle);
+	ActionLogInterval = chrono::duration<double>(GetJsonHostSettings().ActionLogInterval);
 	LastAliveSent = chrono::steady_clock::now();
 	LastAliveReceived = LastAliveSent;
-	Start();
-	cout << "Json listen thread for " << ClientName << " started" << endl;
+	LastActionLog = LastAliveSent - chrono::duration_cast<chrono::steady_clock::duration>(ActionLogInterval);
+	cout << "Json listener for " << ClientName << " started" << endl;
 }
 
 JsonListener::~JsonListener()
 {
-	cout << "Json listen thread for " << ClientName << " stoppped" << endl;
+	cout << "Json listener for " << ClientName << " stoppped" << endl;
 }
 
 string JsonListener::JavaCapitalize(string source)
@@ -49,6 +59,38 @@ string JsonListener::JavaCapitalize(string source)
 	return source;
 }
 
+const string& JsonListener::GetJavaTypeName(ObjectType Type)
+{
+	static const vector<string> TypeNames = []()
+	{
+		vector<string> names((int)ObjectType::Team+1);
+		for (auto& [type,name] : ObjectTypeNames)
+		{
+			names[(int)type] = JavaCapitalize(name);
+		}
+		return names;
+	}();
+	return TypeNames.at((int)Type);
+}
+
+const string& JsonListener::GetJavaName(uint32_t NameID)
+{
+	//NameTable IDs are stable, so capitalized names never need to be invalidated
+	thread_local vector<string> Names;
+	thread_local vector<uint8_t> Valid;
+	if (Valid.size() <= NameID)
+	{
+		Valid.resize(NameID+1, 0);
+		Names.resize(NameID+1);
+	}
+	if (!Valid[NameID])
+	{
+		Names[NameID] = JavaCapitalize(NameTable::Get().GetName(NameID));
+		Valid[NameID] = 1;
+	}
+	return Names[NameID];
+}
+
 CDFRTeam JsonListener::StringToTeam(string team)
 {
 	string value = JavaCapitalize(team);
@@ -64,35 +106,40 @@ CDFRTeam JsonListener::StringToTeam(string team)
 	return Team;
 }
 
-json JsonListener::ObjectToJson(const ObjectData& Object)
+json JsonListener::ObjectToJson(const ObjectSnapshot& Snapshot, const ObjectRecord& Object, bool Predict)
 {
 	json objectified;
-	objectified["type"] = JavaCapitalize(ObjectTypeNames.at(Object.type));
-	objectified["name"] = JavaCapitalize(Object.name);
-	if (Object.metadata.size() > 0)
+	objectified["type"] = GetJavaTypeName(Object.Type);
+	objectified["name"] = GetJavaName(Object.NameID);
+	if (Object.Instance >= 0)
 	{
-		objectified["metadata"] = Object.metadata;
+		objectified["instance"] = Object.Instance;
+	}
+	if (Object.MetadataCount > 0)
+	{
+		objectified["metadata"] = Snapshot.GetMetadataJson(Object);
 	}
 	objectified["age"] = chrono::duration_cast<chrono::milliseconds>(ObjectData::Clock::now() - Object.LastSeen).count();
 	
-	bool requireCoord = Object.type != ObjectType::SolarPanel;
-	double rotZ = GetRotZ(Object.location.rotation());
+	const cv::Affine3d location = Predict ? Object.PredictLocation(ObjectData::Clock::now()) : Object.Location;
+	bool requireCoord = Object.Type != ObjectType::SolarPanel;
+	double rotZ = GetRotZ(location.rotation());
 	double rotZdeg = rotZ*180.0/M_PI;
 	switch (ObjectMode)
 	{
 	case TransformMode::Float2D:
 		if (requireCoord)
 		{
-			objectified["x"] = Object.location.translation()[0];
-			objectified["y"] = Object.location.translation()[1];
+			objectified["x"] = location.translation()[0];
+			objectified["y"] = location.translation()[1];
 		}
 		objectified["r"] = rotZ;
 		break;
 	case TransformMode::Millimeter2D:
 		if (requireCoord)
 		{
-			objectified["x"] = int(Object.location.translation()[0]*1000.0+1500.0);
-			objectified["y"] = int(Object.location.translation()[1]*1000.0+1000.0);
+			objectified["x"] = int(location.translation()[0]*1000.0+1500.0);
+			objectified["y"] = int(location.translation()[1]*1000.0+1000.0);
 		}
 
 		objectified["r"] = int(rotZdeg);
@@ -104,7 +151,7 @@ json JsonListener::ObjectToJson(const ObjectData& Object)
 		{
 			for (int j = 0; j < 4; j++)
 			{
-				objectified[string("r") + to_string(i)][string("c") + to_string(j)] = Object.location.matrix(i,j);
+				objectified[string("r") + to_string(i)][string("c") + to_string(j)] = location.matrix(i,j);
 			}
 		}
 		break;
@@ -112,7 +159,7 @@ json JsonListener::ObjectToJson(const ObjectData& Object)
 	default:
 		break;
 	}
-	if (Object.type == ObjectType::SolarPanel)
+	if (Object.Type == ObjectType::SolarPanel)
 	{
 		bool teamyellow = false, teamblue = false;
 		if (rotZdeg > 8)
@@ -155,11 +202,15 @@ std::set<ObjectType> JsonListener::GetFilterClasses(const nlohmann::json &filter
 	{
 		return {};
 	}
+	return GetFilterClasses(filterStrings);
+}
+
+std::set<ObjectType> JsonListener::GetFilterClasses(const set<string> &FilterStrings)
+{
 	set<ObjectType> AllowedTypes;
 	for (auto& [type,name] : ObjectTypeNames)
 	{
-		string java_name = JavaCapitalize(name);
-		if (filterStrings.find(java_name) != filterStrings.end())
+		if (FilterStrings.find(GetJavaTypeName(type)) != FilterStrings.end())
 		{
 			AllowedTypes.insert(type);
 		}
@@ -172,6 +223,23 @@ std::set<ObjectType> JsonListener::GetFilterClasses(const nlohmann::json &filter
 	return AllowedTypes;
 }
 
+const set<ObjectType>& JsonListener::GetFastFilterClasses()
+{
+	//Clients ask with the same filters every time
+	bool same = FastQuery.NumFilters == LastFilters.size();
+	for (size_t i = 0; same && i < FastQuery.NumFilters; i++)
+	{
+		same = FastQuery.Filters[i] == LastFilters[i];
+	}
+	if (same)
+	{
+		return LastAllowedTypes;
+	}
+	LastFilters.assign(FastQuery.Filters.begin(), FastQuery.Filters.begin() + FastQuery.NumFilters);
+	LastAllowedTypes = GetFilterClasses(set<string>(LastFilters.begin(), LastFilters.end()));
+	return LastAllowedTypes;
+}
+
 ObjectData::TimePoint JsonListener::GetCutoffTime(const nlohmann::json &Query)
 {
 	int maxagems = Query.at("data").value("maxAge", 0);
@@ -183,34 +251,20 @@ ObjectData::TimePoint JsonListener::GetCutoffTime(const nlohmann::json &Query)
 	return OldCutoff;
 }
 
-bool JsonListener::GetData(const json &Query, json &Response)
+void JsonListener::SerializeData(const ObjectSnapshot &Snapshot, const vector<CameraFeatureData> &FeatureData, 
+	const set<ObjectType> &AllowedTypes, ObjectData::TimePoint OldCutoff, bool Predict, json &Data)
 {
-	if (!Query.contains("data"))
-	{
-		return false;
-	}
-	auto &QueryData = Query.at("data");
-	if (!QueryData.contains("filters"))
-	{
-		return false;
-	}
-	if (!QueryData.at("filters").is_array())
-	{
-		return false;
-	}
-	ObjectData::TimePoint OldCutoff = GetCutoffTime(Query);
-	 
-	vector<CameraFeatureData> FeatureData = Parent->ExternalRunner->GetFeatureData();
-	vector<ObjectData> ObjData = Parent->ExternalRunner->GetObjectData();
-	set<ObjectType> AllowedTypes = GetFilterClasses(QueryData.at("filters"));
-
 	json jsondataarray = json::array({});
 	bool has3D = AllowedTypes.find(ObjectType::Data3D) != AllowedTypes.end(); 
 	bool has2D = AllowedTypes.find(ObjectType::Data2D) != AllowedTypes.end(); 
 	bool Has3DData = false;
-	for (auto &Object : ObjData)
+	for (auto &Object : Snapshot.Records)
 	{
-		if (!has3D && AllowedTypes.find(Object.type) == AllowedTypes.end())
+		if (Object.Parent >= 0) //childs are not sent
+		{
+			continue;
+		}
+		if (!has3D && AllowedTypes.find(Object.Type) == AllowedTypes.end())
 		{
 			continue;
 		}
@@ -218,13 +272,13 @@ bool JsonListener::GetData(const json &Query, json &Response)
 		{
 			continue;
 		}
-		json objectified = ObjectToJson(Object);
+		json objectified = ObjectToJson(Snapshot, Object, Predict);
 		jsondataarray.push_back(objectified);
 		Has3DData = true;
 	}
 	if (Has3DData)
 	{
-		Response["data"]["data3D"] = jsondataarray;
+		Data["data3D"] = jsondataarray;
 	}
 
 	bool Has2DData = false;
@@ -282,13 +336,356 @@ bool JsonListener::GetData(const json &Query, json &Response)
 	}
 	if (Has2DData)
 	{
-		Response["data"]["data2D"] = jsonfeaturearray;
+		Data["data2D"] = jsonfeaturearray;
+	}
+}
+
+void JsonListener::WriteName(BinaryProtocol::Writer &writer, uint32_t NameID, bool &HasNames)
+{
+	if (SentNames.size() <= NameID)
+	{
+		SentNames.resize(NameID+1, 0);
+	}
+	if (SentNames[NameID])
+	{
+		return;
+	}
+	if (!HasNames)
+	{
+		writer.BeginPacket(BinaryProtocol::PacketType::Names);
+		HasNames = true;
+	}
+	const string &name = NameTable::Get().GetName(NameID);
+	writer.Write(BinaryProtocol::NameEntry{NameID, (uint16_t)name.size()});
+	writer.Write(name.data(), name.size());
+	SentNames[NameID] = 1;
+}
+
+void JsonListener::SerializeBinary(int32_t Index, uint32_t Tick, const ObjectSnapshot &Snapshot, const vector<CameraFeatureData> &FeatureData, 
+	const set<ObjectType> &AllowedTypes, ObjectData::TimePoint OldCutoff, bool Predict)
+{
+	using namespace BinaryProtocol;
+	NameTable &names = NameTable::Get();
+	BinaryBuffer.clear();
+	Writer writer(BinaryBuffer);
+	bool has3D = AllowedTypes.find(ObjectType::Data3D) != AllowedTypes.end(); 
+	bool has2D = AllowedTypes.find(ObjectType::Data2D) != AllowedTypes.end(); 
+	bool hasAruco = has2D || AllowedTypes.find(ObjectType::Aruco) != AllowedTypes.end();
+	bool hasYolo = has2D || AllowedTypes.find(ObjectType::Yolo) != AllowedTypes.end();
+	auto IsSent = [&AllowedTypes, has3D, OldCutoff](const ObjectRecord& Object)
+	{
+		return Object.Parent < 0 
+			&& (has3D || AllowedTypes.find(Object.Type) != AllowedTypes.end())
+			&& Object.LastSeen >= OldCutoff;
+	};
+	
+	//Names the client doesn't know yet
+	bool HasNames = false;
+	for (auto &Object : Snapshot.Records)
+	{
+		if (IsSent(Object))
+		{
+			WriteName(writer, Object.NameID, HasNames);
+		}
+	}
+	BinaryCameraNames.resize(FeatureData.size());
+	if (hasAruco || hasYolo)
+	{
+		for (size_t i = 0; i < FeatureData.size(); i++)
+		{
+			BinaryCameraNames[i] = names.Intern(FeatureData[i].CameraName);
+			WriteName(writer, BinaryCameraNames[i], HasNames);
+		}
+	}
+	if (HasNames)
+	{
+		writer.EndPacket();
+	}
+	BinaryNamesLength = writer.GetOffset();
+
+	writer.BeginPacket(PacketType::Objects);
+	size_t HeaderOffset = writer.GetOffset();
+	ObjectsHeader objectsheader{Index, Tick, 0, 0};
+	writer.Write(objectsheader);
+	auto now = ObjectData::Clock::now();
+	for (auto &Object : Snapshot.Records)
+	{
+		if (!IsSent(Object))
+		{
+			continue;
+		}
+		const cv::Affine3d location = Predict ? Object.PredictLocation(now) : Object.Location;
+		cv::Quatd rotation = cv::Quatd::createFromRotMat(location.rotation());
+		ObjectEntry entry;
+		entry.Type = (uint8_t)Object.Type;
+		memset(entry.Reserved, 0, sizeof(entry.Reserved));
+		entry.Instance = Object.Instance;
+		entry.NameID = Object.NameID;
+		for (int i = 0; i < 3; i++)
+		{
+			entry.Position[i] = location.translation()[i];
+		}
+		entry.Rotation[0] = rotation.w;
+		entry.Rotation[1] = rotation.x;
+		entry.Rotation[2] = rotation.y;
+		entry.Rotation[3] = rotation.z;
+		entry.Age = chrono::duration_cast<chrono::milliseconds>(now - Object.LastSeen).count();
+		writer.Write(entry);
+		objectsheader.NumObjects++;
+	}
+	writer.WriteAt(HeaderOffset, objectsheader);
+	writer.EndPacket();
+
+	if (!hasAruco && !hasYolo)
+	{
+		return;
+	}
+	writer.BeginPacket(PacketType::Features);
+	writer.Write(FeaturesHeader{Index, Tick, (uint16_t)FeatureData.size(), 0});
+	for (size_t camidx = 0; camidx < FeatureData.size(); camidx++)
+	{
+		auto &data = FeatureData[camidx];
+		cv::Size2d fov = GetCameraFOV(data.FrameSize, data.CameraMatrix);
+		CameraEntry camera;
+		camera.NameID = BinaryCameraNames[camidx];
+		camera.Width = data.FrameSize.width;
+		camera.Height = data.FrameSize.height;
+		camera.XFov = fov.width;
+		camera.YFov = fov.height;
+		camera.NumAruco = hasAruco ? data.ArucoIndices.size() : 0;
+		camera.NumYolo = hasYolo ? data.YoloDetections.size() : 0;
+		writer.Write(camera);
+		for (size_t i = 0; i < camera.NumAruco; i++)
+		{
+			ArucoEntry aruco;
+			aruco.Index = data.ArucoIndices[i];
+			for (size_t j = 0; j < 4; j++)
+			{
+				aruco.Corners[j][0] = j < data.ArucoCorners[i].size() ? data.ArucoCorners[i][j].x : 0;
+				aruco.Corners[j][1] = j < data.ArucoCorners[i].size() ? data.ArucoCorners[i][j].y : 0;
+			}
+			writer.Write(aruco);
+		}
+		for (size_t i = 0; i < camera.NumYolo; i++)
+		{
+			auto& det = data.YoloDetections[i];
+			YoloEntry yolo;
+			yolo.Class = det.Class;
+			yolo.Confidence = det.Confidence*100;
+			yolo.TLX = det.Corners.tl().x;
+			yolo.TLY = det.Corners.tl().y;
+			yolo.BRX = det.Corners.br().x;
+			yolo.BRY = det.Corners.br().y;
+			writer.Write(yolo);
+		}
+	}
+	writer.EndPacket();
+}
+
+//Appends the number then the separator, without temporary strings
+static void AppendKeyPart(string &Key, int Value, char Separator)
+{
+	array<char, 12> digits;
+	auto end = to_chars(digits.data(), digits.data() + digits.size(), Value).ptr;
+	Key.append(digits.data(), end);
+	Key += Separator;
+}
+
+const string& JsonListener::GetSerializedData(JsonTick &Tick, const set<ObjectType> &AllowedTypes, int MaxAge, bool Predict)
+{
+	int MaxAgeBucketed = MaxAge > 0 ? (MaxAge + MaxAgeBucket - 1) / MaxAgeBucket : 0;
+	//The key buffer is kept, this runs for every DATA query
+	string &key = SerializedKey;
+	key.clear();
+	AppendKeyPart(key, (int)ObjectMode, '/');
+	AppendKeyPart(key, Predict, '/');
+	AppendKeyPart(key, MaxAgeBucketed, '/');
+	for (ObjectType type : AllowedTypes)
+	{
+		AppendKeyPart(key, (int)type, ',');
+	}
+	auto cached = Tick.Serialized.find(key);
+	if (cached != Tick.Serialized.end())
+	{
+		return cached->second;
 	}
+	ObjectData::TimePoint OldCutoff;
+	if (MaxAgeBucketed > 0)
+	{
+		OldCutoff = ObjectData::Clock::now() - chrono::milliseconds(MaxAgeBucketed*MaxAgeBucket);
+	}
+	json Data = json::object();
+	SerializeData(*Tick.Snapshot, Tick.FeatureData, AllowedTypes, OldCutoff, Predict, Data);
+	return Tick.Serialized.emplace(key, Data.dump()).first->second;
+}
+
+bool JsonListener::GetData(const json &Query)
+{
+	if (!Query.contains("data"))
+	{
+		return false;
+	}
+	auto &QueryData = Query.at("data");
+	if (!QueryData.contains("filters"))
+	{
+		return false;
+	}
+	if (!QueryData.at("filters").is_array())
+	{
+		return false;
+	}
+	int MaxAge = QueryData.value("maxAge", 0);
+	bool Predict = QueryData.value("predict", true); //latency compensation
+	set<ObjectType> AllowedTypes = GetFilterClasses(QueryData.at("filters"));
+	int32_t BinaryIndex = Query.contains("index") && Query["index"].is_number_integer() ? Query["index"].get<int32_t>() : -1;
+	string Index = Query.contains("index") ? Query["index"].dump() : "";
+	SendData(AllowedTypes, MaxAge, Predict, BinaryIndex, Index);
+	return true;
+}
+
+void JsonListener::SendData(const set<ObjectType> &AllowedTypes, int MaxAge, bool Predict, int32_t BinaryIndex, string_view Index)
+{
+	JsonTick &Tick = Parent->GetCurrentTick();
 
+	if (BinaryFraming)
+	{
+		//The packets are the response, with the index of the query
+		ObjectData::TimePoint OldCutoff;
+		if (MaxAge > 0)
+		{
+			OldCutoff = ObjectData::Clock::now() - chrono::milliseconds(MaxAge);
+		}
+		SerializeBinary(BinaryIndex, 0, *Tick.Snapshot, Tick.FeatureData, AllowedTypes, OldCutoff, Predict);
+		SendBinary();
+		return;
+	}
+
+	//The data is shared with the other clients, the rest of the response is built around it (keys in the order dump() uses)
+	const string &Data = GetSerializedData(Tick, AllowedTypes, MaxAge, Predict);
+	ResponseBuffer.clear();
+	ResponseBuffer += "{\"action\":\"DATA\",";
+	if (Data != "{}")
+	{
+		ResponseBuffer += "\"data\":";
+		ResponseBuffer += Data;
+		ResponseBuffer += ",";
+	}
+	if (!Index.empty())
+	{
+		ResponseBuffer += "\"index\":";
+		ResponseBuffer += Index;
+		ResponseBuffer += ",";
+	}
+	ResponseBuffer += "\"status\":\"OK\"}\n";
+	SendRaw(ResponseBuffer);
+}
+
+bool JsonListener::Subscribe(const json &Query, json &Response)
+{
+	if (!Query.contains("data"))
+	{
+		return false;
+	}
+	auto &QueryData = Query.at("data");
+	if (!QueryData.contains("filters") || !QueryData.at("filters").is_array())
+	{
+		return false;
+	}
+	auto subscription = make_unique<Subscription>();
+	subscription->AllowedTypes = GetFilterClasses(QueryData.at("filters"));
+	subscription->MaxAge = QueryData.value("maxAge", 0);
+	subscription->Predict = QueryData.value("predict", true);
+	subscription->Delta = QueryData.value("delta", false);
+	double rate = QueryData.value("rate", 0.0);
+	if (rate > 0)
+	{
+		subscription->MinInterval = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0/rate));
+	}
+	Subscribed = move(subscription);
 	Response["status"] = "OK";
 	return true;
 }
 
+void JsonListener::OnTick(JsonTick &Tick)
+{
+	if (!Subscribed || killed || Closing)
+	{
+		return;
+	}
+	auto &sub = *Subscribed;
+	auto now = chrono::steady_clock::now();
+	if (now - sub.LastSent < sub.MinInterval)
+	{
+		return;
+	}
+	sub.LastSent = now;
+	ObjectData::TimePoint OldCutoff;
+	if (sub.MaxAge > 0)
+	{
+		OldCutoff = ObjectData::Clock::now() - chrono::milliseconds(sub.MaxAge);
+	}
+	if (BinaryFraming)
+	{
+		SerializeBinary(-1, Tick.Index, *Tick.Snapshot, Tick.FeatureData, sub.AllowedTypes, OldCutoff, sub.Predict);
+		SendBinary(true);
+		return;
+	}
+	if (!sub.Delta)
+	{
+		//Clients with the same subscription share the serialized data
+		const string &Data = GetSerializedData(Tick, sub.AllowedTypes, sub.MaxAge, sub.Predict);
+		SendRaw("{\"action\":\"UPDATE\",\"data\":" + Data + ",\"tick\":" + to_string(Tick.Index) + "}\n", true);
+		return;
+	}
+	json Update;
+	Update["action"] = "UPDATE";
+	Update["tick"] = Tick.Index;
+	json Data = json::object();
+	SerializeData(*Tick.Snapshot, Tick.FeatureData, sub.AllowedTypes, OldCutoff, sub.Predict, Data);
+	//Objects are identified by type, name and instance, and compared without their age
+	map<string, json> CurrentObjects;
+	json changed = json::array();
+	if (Data.contains("data3D"))
+	{
+		for (auto &object : Data["data3D"])
+		{
+			json compared = object;
+			compared.erase("age");
+			string identity = object["type"].get<string>() + "/" + object["name"].get<string>() + "/" + to_string(object.value("instance", -1));
+			auto last = sub.LastObjects.find(identity);
+			if (last == sub.LastObjects.end() || last->second != compared)
+			{
+				changed.push_back(object);
+			}
+			CurrentObjects.emplace(identity, move(compared));
+		}
+	}
+	json removed = json::array();
+	for (auto &[identity, object] : sub.LastObjects)
+	{
+		if (CurrentObjects.find(identity) != CurrentObjects.end())
+		{
+			continue;
+		}
+		json gone;
+		gone["type"] = object["type"];
+		gone["name"] = object["name"];
+		if (object.contains("instance"))
+		{
+			gone["instance"] = object["instance"];
+		}
+		removed.push_back(gone);
+	}
+	sub.LastObjects = move(CurrentObjects);
+	Update["data"]["data3D"] = changed;
+	Update["data"]["removed"] = removed;
+	if (Data.contains("data2D"))
+	{
+		Update["data"]["data2D"] = Data["data2D"];
+	}
+	SendJson(Update);
+}
+
 bool JsonListener::GetZone(const json &Query, json &Response)
 {
 	if (!Query.contains("data"))
@@ -321,7 +718,7 @@ bool JsonListener::GetZone(const json &Query, json &Response)
 		AllowedTypes = GetFilterClasses(QueryData.at("classes"));
 	}
 	
-	auto ObjData = Parent->ExternalRunner->GetObjectData();
+	auto Snapshot = Parent->ExternalRunner->GetObjectSnapshot();
 
 	vector<pair<string, cv::Rect2d>> PositionFilters;
 	for (auto &elem : QueryData.at("zones"))
@@ -360,21 +757,17 @@ bool JsonListener::GetZone(const json &Query, json &Response)
 	
 	set<string> SeenZones;
 
-	for (auto &Object : ObjData)
+	//Each zone only visits the cells it overlaps in the snapshot's index
+	for (auto &zone : PositionFilters)
 	{
-		if (AllowedTypes.find(Object.type) == AllowedTypes.end())
+		bool found = false;
+		for (ObjectType type : AllowedTypes)
 		{
-			continue;
-		}
-		if (Object.LastSeen < OldCutoff)
-		{
-			continue;
-		}
-		for (auto &zone : PositionFilters)
-		{
-			cv::Vec3d pos3d = Object.location.translation();
-			cv::Vec2d pos2d(pos3d.val);
-			if (zone.second.contains(pos2d))
+			Snapshot->Index.QueryRect(type, zone.second, [&found, OldCutoff](const ObjectIndex::Entry& entry)
+			{
+				found |= entry.LastSeen >= OldCutoff;
+			});
+			if (found)
 			{
 				SeenZones.insert(zone.first);
 				break;
@@ -386,7 +779,31 @@ bool JsonListener::GetZone(const json &Query, json &Response)
 	return true;
 }
 
-bool JsonListener::GetImage(double reduction, json &Response)
+EncodedImage& JsonListener::GetEncodedImage(JsonTick &Tick, size_t CameraIndex, double Reduction)
+{
+	auto key = make_pair(CameraIndex, (int)round(Reduction*100));
+	auto cached = Tick.Images.find(key);
+	if (cached != Tick.Images.end())
+	{
+		return cached->second;
+	}
+	EncodedImage &encoded = Tick.Images[key];
+	auto &this_cam = Tick.ImageData[CameraIndex];
+	cv::UMat image;
+	if (Reduction <= 1)
+	{
+		image = this_cam.Image;
+	}
+	else
+	{
+		cv::resize(this_cam.Image, image, cv::Size(0,0), 1/Reduction, 1/Reduction);
+	}
+	encoded.Size = image.size();
+	cv::imencode(".jpg", image, encoded.Jpeg);
+	return encoded;
+}
+
+bool JsonListener::GetImage(const json &Query)
 {
 	if (!Parent)
 	{
@@ -396,32 +813,90 @@ bool JsonListener::GetImage(double reduction, json &Response)
 	{
 		return false;
 	}
-	auto cameras = Parent->ExternalRunner->GetImage();
-	Response["data"]["cameras"] = json::array({});
-	for (size_t i = 0; i < cameras.size(); i++)
+	double reduction = 1.0;
+	if (Query.contains("data")) {
+		reduction = Query["data"].value("reduction", 1.0);
+	}
+	JsonTick &Tick = Parent->GetCurrentTick();
+	if (!Tick.HasImages)
 	{
-		cv::UMat image;
-		auto & this_cam = cameras[i];
-		if (reduction <= 1)
+		//Only holds references to the frames, the detection thread never waits on the encoding
+		Tick.ImageData = Parent->ExternalRunner->GetImage();
+		Tick.HasImages = true;
+	}
+	const size_t NumCameras = Tick.ImageData.size();
+	if (BinaryFraming && NumCameras == 0)
+	{
+		//No Image packet to send, the response is a Json packet like the errors
+		json Response;
+		Response["action"] = "IMAGE";
+		Response["data"]["cameras"] = json::array();
+		if (Query.contains("index"))
 		{
-			image = this_cam.Image;
+			Response["index"] = Query["index"];
 		}
-		else
+		Response["status"] = "OK";
+		SendJson(Response);
+		return true;
+	}
+	if (BinaryFraming)
+	{
+		//Header in BinaryBuffer, JPEG straight from the cache
+		int32_t index = Query.contains("index") && Query["index"].is_number_integer() ? Query["index"].get<int32_t>() : -1;
+		NameTable &names = NameTable::Get();
+		for (size_t i = 0; i < NumCameras; i++)
+		{
+			EncodedImage &encoded = GetEncodedImage(Tick, i, reduction);
+			uint32_t NameID = names.Intern(Tick.ImageData[i].CameraName);
+			BinaryBuffer.clear();
+			BinaryProtocol::Writer writer(BinaryBuffer);
+			bool HasNames = false;
+			WriteName(writer, NameID, HasNames);
+			if (HasNames)
+			{
+				writer.EndPacket();
+			}
+			writer.BeginPacket(BinaryProtocol::PacketType::Image);
+			size_t PacketStart = writer.GetOffset() - sizeof(BinaryProtocol::PacketHeader);
+			writer.Write(BinaryProtocol::ImageHeader{index, NameID, (uint16_t)encoded.Size.width, (uint16_t)encoded.Size.height, (uint16_t)i, (uint16_t)NumCameras});
+			writer.EndPacket();
+			uint32_t length = sizeof(BinaryProtocol::ImageHeader) + encoded.Jpeg.size();
+			writer.WriteAt(PacketStart + offsetof(BinaryProtocol::PacketHeader, Length), length);
+			array<iovec, 2> buffers{{{BinaryBuffer.data(), BinaryBuffer.size()}, {encoded.Jpeg.data(), encoded.Jpeg.size()}}};
+			if (!Transport->Send(buffers.data(), buffers.size(), Handle))
+			{
+				killed = true;
+				return true;
+			}
+		}
+		return true;
+	}
+	//Json : the response is built around the cached base64, keys in the order dump() uses
+	string SendBuffer = "{\"action\":\"IMAGE\",\"data\":{\"cameras\":[";
+	for (size_t i = 0; i < NumCameras; i++)
+	{
+		EncodedImage &encoded = GetEncodedImage(Tick, i, reduction);
+		if (encoded.Base64.empty() && !encoded.Jpeg.empty())
+		{
+			size_t b64size = encoded.Jpeg.size()*4/3+16;
+			encoded.Base64.resize(b64size);
+			base64_encode(reinterpret_cast<char*>(encoded.Jpeg.data()), encoded.Jpeg.size(),
+				encoded.Base64.data(), &b64size, 0);
+			encoded.Base64.resize(b64size);
+		}
+		if (i > 0)
 		{
-			cv::resize(this_cam.Image, image, cv::Size(0,0), 1/reduction, 1/reduction);
+			SendBuffer += ",";
 		}
-		std::vector<uchar> jpgenc, b64enc;
-		cv::imencode(".jpg", image, jpgenc);
-		size_t b64size = jpgenc.size()*4/3+16;
-		b64enc.resize(b64size);
-		base64_encode(reinterpret_cast<char*>(jpgenc.data()), jpgenc.size(),
-			reinterpret_cast<char*>(b64enc.data()), &b64size, 0);
-		b64enc.resize(b64size);
-		json this_camera_json;
-		this_camera_json["name"] = this_cam.CameraName;
-		this_camera_json["data"] = reinterpret_cast<char*>(b64enc.data());
-		Response["data"]["cameras"].push_back(this_camera_json);
+		SendBuffer += "{\"data\":\"" + encoded.Base64 + "\",\"name\":" + json(Tick.ImageData[i].CameraName).dump() + "}";
+	}
+	SendBuffer += "]}";
+	if (Query.contains("index"))
+	{
+		SendBuffer += ",\"index\":" + Query["index"].dump();
 	}
+	SendBuffer += ",\"status\":\"OK\"}\n";
+	SendRaw(SendBuffer);
 	return true;
 }
 
@@ -439,39 +914,33 @@ bool JsonListener::GetStartingZone(const nlohmann::json query, nlohmann::json &r
 			return false;
 		}
 	}
-	auto data = Parent->ExternalRunner->GetObjectData();
-	ObjectData robot;
-	robot.LastSeen = ObjectData::TimePoint();
-	for (auto &&i : data)
+	auto Snapshot = Parent->ExternalRunner->GetObjectSnapshot();
+	const ObjectRecord* robot = nullptr;
+	Snapshot->Index.ForEach(ObjectType::Robot, [&robot, &Snapshot, team](const ObjectIndex::Entry& entry)
 	{
-		if (i.type != ObjectType::Robot)
+		if (entry.Team != team)
 		{
-			continue;
-		}
-		if (i.name.rfind(TeamNames.at(team), 0) != 0) //must start with robot
-		{
-			continue;
+			return;
 		}
-		if (i.LastSeen < robot.LastSeen)
+		if (robot != nullptr && entry.LastSeen < robot->LastSeen)
 		{
-			continue;
+			return;
 		}
-		
-		robot = i;
-	}
-	if (robot.LastSeen == ObjectData::TimePoint())
+		robot = &Snapshot->Records[entry.Index];
+	});
+	if (robot == nullptr || robot->LastSeen == ObjectData::TimePoint())
 	{
 		response["status"] = "NO_DATA";
 		return true;
 	}
 	
 	string position = "";
-	position += robot.location.translation()[0] > 0 ? "EAST" : "WEST";
-	if (robot.location.translation()[1]>0.38)
+	position += robot->Location.translation()[0] > 0 ? "EAST" : "WEST";
+	if (robot->Location.translation()[1]>0.38)
 	{
 		position += "_NORTH";
 	}
-	else if (robot.location.translation()[1]<-0.38)
+	else if (robot->Location.translation()[1]<-0.38)
 	{
 		position += "_SOUTH";
 	}
@@ -518,6 +987,7 @@ void JsonListener::HandleQuery(const json &Query)
 	const string &ActionStr = Query.value("action", "invalid");
 	json Response;
 	Response["action"] = ActionStr;
+	int NewFraming = -1; //Applied once the response is sent, so that it's in the framing the client asked with
 	if (Query.contains("index"))
 	{
 		Response["index"] = Query["index"];
@@ -551,11 +1021,25 @@ void JsonListener::HandleQuery(const json &Query)
 				Response["errorMessage"] = "Unknown Mode";
 			}
 		}
+		if (Query.contains("data") && Query["data"].contains("framing"))
+		{
+			string framing = Query["data"].value("framing", "none");
+			if (framing == "JSON" || framing == "BINARY")
+			{
+				Response["status"] = Response.value("status", "OK");
+				NewFraming = framing == "BINARY";
+			}
+			else
+			{
+				Response["status"] = "ERROR";
+				Response["errorMessage"] = "Unknown Framing";
+			}
+		}
 		goto send;
 	}
 	if (ActionStr == "EXIT")
 	{
-		killed = true;
+		Closing = true;
 		Response["status"] = "OK";
 		goto send;
 	}
@@ -612,6 +1096,24 @@ void JsonListener::HandleQuery(const json &Query)
 		
 
 		Response["data"]["mode"] = TransformModeNames.at(ObjectMode);
+		Response["data"]["framing"] = BinaryFraming ? "BINARY" : "JSON";
+
+		//Outbound queues, to spot the clients that don't keep up
+		if (Parent)
+		{
+			json clients = json::array();
+			for (auto &[fd, listener] : Parent->GetListeners())
+			{
+				auto stats = listener->Transport->GetQueueStats(listener->Handle);
+				json client;
+				client["name"] = listener->ClientName;
+				client["queuedBytes"] = stats.QueuedBytes;
+				client["queuedMessages"] = stats.QueuedMessages;
+				client["droppedMessages"] = stats.DroppedMessages;
+				clients.push_back(client);
+			}
+			Response["data"]["clients"] = clients;
+		}
 
 		goto send;
 	}
@@ -634,8 +1136,9 @@ void JsonListener::HandleQuery(const json &Query)
 		
 		if (ActionStr == "DATA") //2D or 3D data
 		{
-			if(GetData(Query, Response))
+			if(GetData(Query)) //already sent
 			{
+				return;
 			}
 			else
 			{
@@ -643,6 +1146,20 @@ void JsonListener::HandleQuery(const json &Query)
 			}
 			goto send;
 		}
+		if (ActionStr == "SUBSCRIBE") //Push DATA to the client after every tick
+		{
+			if(!Subscribe(Query, Response))
+			{
+				Response["status"] = "ERROR";
+			}
+			goto send;
+		}
+		if (ActionStr == "UNSUBSCRIBE")
+		{
+			Subscribed.reset();
+			Response["status"] = "OK";
+			goto send;
+		}
 		if (ActionStr == "ZONE") //Get if zone empty or not
 		{
 			if(GetZone(Query, Response))
@@ -656,12 +1173,11 @@ void JsonListener::HandleQuery(const json &Query)
 		}
 		if (ActionStr == "IMAGE")
 		{
-			double reduction = 1.0;
-			if (Query.contains("data")) {
-				reduction = Query["data"].value("reduction", 1.0);
+			if (GetImage(Query)) //already sent
+			{
+				return;
 			}
-			GetImage(reduction, Response);
-			Response["status"] = "OK";
+			Response["status"] = "ERROR";
 			goto send;
 		}
 		if (ActionStr == "IDLE")
@@ -706,6 +1222,10 @@ void JsonListener::HandleQuery(const json &Query)
 	}
 send:
 	SendJson(Response);
+	if (NewFraming >= 0)
+	{
+		BinaryFraming = NewFraming;
+	}
 }
 
 void JsonListener::HandleResponse(const json &Response)
@@ -718,12 +1238,223 @@ bool JsonListener::IsQuery(const json &object)
 	return object.contains("action") && !object.contains("status");
 }
 
-void JsonListener::HandleJson(const string &command)
+//Reads the fields of a DATA query as the parser goes, and stops at anything else
+class JsonListener::DataQuerySax : public json::json_sax_t
+{
+private:
+	DataQuery &Query;
+	enum class Field
+	{
+		None,
+		Action,
+		Index,
+		Data,
+		Filters,
+		MaxAge,
+		Predict
+	};
+	Field Current = Field::None;
+	int Depth = 0; //Objects only, the filters are the only array
+	bool InFilters = false;
+
+	bool Unsupported()
+	{
+		Query.Supported = false;
+		return false; //Stops the parse
+	}
+
+public:
+	DataQuerySax(DataQuery &InQuery)
+		:Query(InQuery)
+	{
+		Query.Action.clear();
+		Query.HasIndex = false;
+		Query.HasFilters = false;
+		Query.NumFilters = 0;
+		Query.MaxAge = 0;
+		Query.Predict = true;
+		Query.Supported = true;
+	}
+
+	bool null() override
+	{
+		return Unsupported();
+	}
+
+	bool boolean(bool val) override
+	{
+		if (Depth != 2 || Current != Field::Predict)
+		{
+			return Unsupported();
+		}
+		Query.Predict = val;
+		return true;
+	}
+
+	bool number_integer(number_integer_t val) override
+	{
+		if (Depth == 1 && Current == Field::Index)
+		{
+			Query.HasIndex = true;
+			Query.Index = val;
+			return true;
+		}
+		if (Depth == 2 && Current == Field::MaxAge)
+		{
+			Query.MaxAge = (int)val;
+			return true;
+		}
+		return Unsupported();
+	}
+
+	bool number_unsigned(number_unsigned_t val) override
+	{
+		if (val > (number_unsigned_t)numeric_limits<number_integer_t>::max())
+		{
+			return Unsupported();
+		}
+		return number_integer(val);
+	}
+
+	bool number_float(number_float_t, const string_t&) override
+	{
+		return Unsupported();
+	}
+
+	bool string(string_t& val) override
+	{
+		if (Depth == 1 && Current == Field::Action)
+		{
+			Query.Action = val;
+			return true;
+		}
+		if (Depth == 2 && InFilters)
+		{
+			if (Query.NumFilters == Query.Filters.size())
+			{
+				Query.Filters.emplace_back();
+			}
+			Query.Filters[Query.NumFilters++] = val;
+			return true;
+		}
+		return Unsupported();
+	}
+
+	bool binary(binary_t&) override
+	{
+		return Unsupported();
+	}
+
+	bool start_object(size_t) override
+	{
+		Depth++;
+		if (Depth == 1 || (Depth == 2 && Current == Field::Data))
+		{
+			Current = Field::None;
+			return true;
+		}
+		return Unsupported();
+	}
+
+	bool key(string_t& val) override
+	{
+		if (Depth == 1)
+		{
+			Current = val == "action" ? Field::Action : val == "index" ? Field::Index : val == "data" ? Field::Data : Field::None;
+		}
+		else
+		{
+			Current = val == "filters" ? Field::Filters : val == "maxAge" ? Field::MaxAge : val == "predict" ? Field::Predict : Field::None;
+		}
+		return Current == Field::None ? Unsupported() : true;
+	}
+
+	bool end_object() override
+	{
+		Depth--;
+		Current = Field::None;
+		return true;
+	}
+
+	bool start_array(size_t) override
+	{
+		if (Depth != 2 || Current != Field::Filters || InFilters)
+		{
+			return Unsupported();
+		}
+		InFilters = true;
+		Query.HasFilters = true;
+		return true;
+	}
+
+	bool end_array() override
+	{
+		InFilters = false;
+		return true;
+	}
+
+	bool parse_error(size_t, const std::string&, const detail::exception&) override
+	{
+		return false;
+	}
+};
+
+void JsonListener::LogAction(string_view Frame)
+{
+	auto now = chrono::steady_clock::now();
+	if (now - LastActionLog < ActionLogInterval)
+	{
+		SkippedActionLogs++;
+		return;
+	}
+	LastActionLog = now;
+	cout << "Received action : " << Frame;
+	if (SkippedActionLogs > 0)
+	{
+		cout << " (" << SkippedActionLogs << " more since last log)";
+		SkippedActionLogs = 0;
+	}
+	cout << endl;
+}
+
+void JsonListener::HandleFrame(string_view Frame)
+{
+	if (Frame.size() < 3) //Keep alive
+	{
+		return;
+	}
+	//DATA is most of the traffic : answered without building the json, with the buffers of the previous query
+	DataQuerySax sax(FastQuery);
+	bool parsed = json::sax_parse(Frame.begin(), Frame.end(), &sax);
+	if (!parsed || !FastQuery.Supported || FastQuery.Action != "DATA" || !FastQuery.HasFilters 
+		|| !Parent || !Parent->ExternalRunner)
+	{
+		HandleJson(Frame);
+		return;
+	}
+	LastAliveReceived = chrono::steady_clock::now();
+	LogAction(Frame);
+	//Same as HandleQuery : no data once the runner is shutting down
+	if (Parent->ExternalRunner->IsKilled())
+	{
+		return;
+	}
+	array<char, 24> index;
+	size_t indexlength = 0;
+	if (FastQuery.HasIndex)
+	{
+		indexlength = to_chars(index.data(), index.data() + index.size(), FastQuery.Index).ptr - index.data();
+	}
+	int32_t BinaryIndex = FastQuery.HasIndex ? (int32_t)FastQuery.Index : -1;
+	SendData(GetFastFilterClasses(), FastQuery.MaxAge, FastQuery.Predict, BinaryIndex, string_view(index.data(), indexlength));
+}
+
+void JsonListener::HandleJson(string_view Frame)
 {
 	json parsed;
 	try
 	{
-		parsed = json::parse(command);
+		parsed = json::parse(Frame.begin(), Frame.end());
 	}
 	catch(const json::exception& e)
 	{
@@ -739,7 +1470,7 @@ void JsonListener::HandleJson(const string &command)
 	LastAliveReceived = chrono::steady_clock::now();
 	if (IsQuery(parsed))
 	{
-		cout << "Received action : " << command << endl;
+		LogAction(Frame);
 		HandleQuery(parsed);
 	}
 	else
@@ -750,14 +1481,65 @@ void JsonListener::HandleJson(const string &command)
 
 void JsonListener::SendJson(const json &object)
 {
+	if (BinaryFraming)
+	{
+		string payload = object.dump();
+		BinaryBuffer.clear();
+		BinaryProtocol::Writer writer(BinaryBuffer);
+		writer.BeginPacket(BinaryProtocol::PacketType::Json);
+		writer.Write(payload.data(), payload.size());
+		writer.EndPacket();
+		SendBinary();
+		return;
+	}
 	string SendBuffer = object.dump() + "\n";
 
-	if(!Transport->Send(SendBuffer.data(), SendBuffer.length(), ClientName))
+	if(!Transport->Send(SendBuffer.data(), SendBuffer.length(), Handle))
+	{
+		killed = true;
+	}
+}
+
+void JsonListener::SendRaw(const string &Buffer, bool Droppable)
+{
+	if(!Transport->Send(Buffer.data(), Buffer.length(), Handle, Droppable))
+	{
+		killed = true;
+	}
+}
+
+void JsonListener::SendBinary(bool Droppable)
+{
+	//Names are only sent once per connection, they can't be dropped with the update that brings them
+	size_t reliable = Droppable ? BinaryNamesLength : BinaryBuffer.size();
+	bool sent = true;
+	if (reliable > 0)
+	{
+		sent &= Transport->Send(BinaryBuffer.data(), reliable, Handle, false);
+	}
+	if (reliable < BinaryBuffer.size())
+	{
+		sent &= Transport->Send(BinaryBuffer.data() + reliable, BinaryBuffer.size() - reliable, Handle, Droppable);
+	}
+	if (!sent)
+	{
+		killed = true;
+	}
+}
+
+void JsonListener::OnWritable()
+{
+	if (!Transport->Flush(Handle))
 	{
 		killed = true;
 	}
 }
 
+bool JsonListener::HasPendingOutput() const
+{
+	return Transport->HasPendingOutput(Handle);
+}
+
 void JsonListener::CheckAlive()
 {
 	auto settings = GetKeepAliveSettings();
@@ -771,10 +1553,13 @@ void JsonListener::CheckAlive()
 		return;
 	}
 
-	if (settings.poke_delay > 0 && TimeSinceLastAliveReceived.count() > settings.poke_delay && TimeSinceLastAliveSent.count() > settings.poke_delay)
+	if (!Closing && settings.poke_delay > 0 && TimeSinceLastAliveReceived.count() > settings.poke_delay && TimeSinceLastAliveSent.count() > settings.poke_delay)
 	{
 		LastAliveSent = chrono::steady_clock::now();
-		if (!Transport->Send(" ", 1, ClientName))
+		//Empty json packet in binary, a space otherwise
+		BinaryProtocol::PacketHeader poke{BinaryProtocol::Magic, BinaryProtocol::Version, (uint8_t)BinaryProtocol::PacketType::Json, 0};
+		bool sent = BinaryFraming ? Transport->Send(&poke, sizeof(poke), Handle) : Transport->Send(" ", 1, Handle);
+		if (!sent)
 		{
 			cout << "Client " << ClientName << " disconnect while checking alive, closing..." << endl;
 			killed = true;
@@ -783,49 +1568,32 @@ void JsonListener::CheckAlive()
 	}
 }
 
-void JsonListener::ThreadEntryPoint()
+void JsonListener::OnReadable()
 {
-	while (!killed)
+	while (!killed && !Closing)
 	{
-		CheckAlive();
-
-		array<char, 1<<10> bufferraw;
-		int numreceived = Transport->Receive(bufferraw.data(), bufferraw.size(), ClientName, false);
-		if (numreceived < 0)
+		//Received straight into the framer, which always keeps room for at least one byte
+		size_t available;
+		char* space = Framer.GetWriteSpace(available);
+		int numreceived = Transport->Receive(space, available, Handle);
+		if (numreceived < 0) //nothing left to read
 		{
-			this_thread::sleep_for(chrono::microseconds(500));
-			continue;
-		} else if (numreceived == 0) {
-			killed = true;
+			return;
+		} else if (numreceived == 0) { //half closed, the replies are still sent
+			Closing = true;
 			break;
 		}
-		int rcvbufstartpos = 0;
-		int rcvbufinsertpos = ReceiveBuffer.size();
-
-		ReceiveBuffer.insert(ReceiveBuffer.end(), bufferraw.data(), bufferraw.data() + numreceived);
-
-		for (size_t i = rcvbufinsertpos; i < ReceiveBuffer.size(); i++)
+		Framer.CommitWrite(numreceived);
+		string_view frame;
+		while (!killed && !Closing && Framer.NextFrame(frame))
 		{
-			if (ReceiveBuffer[i] != '\n')
-			{
-				continue;
-			}
-			int commandlen = i-rcvbufstartpos-1;
-			if (commandlen<2)
-			{
-
-			}
-			else
-			{
-				string command(ReceiveBuffer.begin() + rcvbufstartpos, ReceiveBuffer.begin() + i);
-				HandleJson(command);
-			}
-			rcvbufstartpos=i+1;
+			HandleFrame(frame);
 		}
-		rcvbufstartpos = min<int>(ReceiveBuffer.size(), rcvbufstartpos);
-		if (rcvbufstartpos != 0)
+		if (Framer.GetDroppedFrames() != ReportedDroppedFrames)
 		{
-			ReceiveBuffer.erase(ReceiveBuffer.begin(), ReceiveBuffer.begin()+rcvbufstartpos);
+			ReportedDroppedFrames = Framer.GetDroppedFrames();
+			cerr << "Query from " << ClientName << " is longer than " << GetJsonHostSettings().MaxFrameSize << " bytes, dropped (" 
+				<< ReportedDroppedFrames << " so far)" << endl;
 		}
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,85 @@
+#include "Communication/LineFramer.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+LineFramer::LineFramer(size_t InMaxFrameSize)
+	:MaxFrameSize(max<size_t>(InMaxFrameSize, 1))
+{
+	//Room for the longest frame and its newline
+	size_t capacity = 1;
+	while (capacity < MaxFrameSize + 1)
+	{
+		capacity <<= 1;
+	}
+	Ring.resize(capacity);
+	Mask = capacity - 1;
+	Unwrapped.reserve(MaxFrameSize);
+}
+
+char* LineFramer::GetWriteSpace(size_t &Available)
+{
+	size_t free = Ring.size() - (Tail - Head);
+	size_t pos = Tail & Mask;
+	Available = min(free, Ring.size() - pos);
+	return &Ring[pos];
+}
+
+void LineFramer::CommitWrite(size_t Length)
+{
+	Tail += Length;
+}
+
+bool LineFramer::NextFrame(string_view &Frame)
+{
+	while (ScanPos < Tail)
+	{
+		size_t pos = ScanPos & Mask;
+		size_t contiguous = min(Tail - ScanPos, Ring.size() - pos);
+		const char* found = (const char*)memchr(&Ring[pos], '\n', contiguous);
+		if (found == nullptr)
+		{
+			ScanPos += contiguous;
+			continue;
+		}
+		size_t newline = ScanPos + (found - &Ring[pos]);
+		size_t start = Head;
+		ScanPos = Head = newline + 1;
+		if (Skipping)
+		{
+			Skipping = false;
+			continue;
+		}
+		size_t length = newline - start;
+		size_t startidx = start & Mask;
+		if (startidx + length <= Ring.size())
+		{
+			Frame = string_view(&Ring[startidx], length);
+		}
+		else
+		{
+			size_t firstpart = Ring.size() - startidx;
+			Unwrapped.assign(&Ring[startidx], firstpart);
+			Unwrapped.append(Ring.data(), length - firstpart);
+			Frame = Unwrapped;
+		}
+		if (!Frame.empty() && Frame.back() == '\r')
+		{
+			Frame.remove_suffix(1);
+		}
+		return true;
+	}
+	//No newline in sight and already too long : drop what we have, and the rest of the frame as it comes
+	if (Tail - Head > MaxFrameSize)
+	{
+		if (!Skipping)
+		{
+			DroppedFrames++;
+		}
+		Skipping = true;
+		Head = Tail;
+	}
+	return false;
+}
@@ -0,0 +1,80 @@
+#include "Communication/PositionBroadcaster.hpp"
+
+#include <ArucoPipeline/ObjectSnapshot.hpp>
+#include <Communication/BinaryProtocol.hpp>
+#include <Misc/math3d.hpp>
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+PositionBroadcaster::PositionBroadcaster(int Port)
+{
+	auto interfaces = GenericTransport::GetInterfaces();
+	for (auto &ni : interfaces)
+	{
+		if (ni.name == "lo")
+		{
+			continue;
+		}
+		cout << "Broadcasting positions on " << ni.name << " / Broadcast:" << ni.broadcast << ":" << Port << endl;
+		Transports.emplace_back(make_unique<UDPTransport>(Port, ni));
+	}
+}
+
+void PositionBroadcaster::Publish(const ObjectSnapshot &Snapshot)
+{
+	using namespace PositionProtocol;
+	if (Transports.empty())
+	{
+		return;
+	}
+	Buffer.clear();
+	BinaryProtocol::Writer writer(Buffer);
+	PositionHeader header{Magic, Version, 0, Sequence++, 0, 0};
+	writer.Write(header);
+	bool TooMany = false;
+	for (ObjectType type : {ObjectType::Robot, ObjectType::Pami})
+	{
+		Snapshot.Index.ForEach(type, [&Snapshot, &writer, &header, &TooMany](const ObjectIndex::Entry& entry)
+		{
+			const ObjectRecord &record = Snapshot.Records[entry.Index];
+			if (record.LastSeen == ObjectData::TimePoint())
+			{
+				return;
+			}
+			if (header.NumObjects == UINT8_MAX)
+			{
+				TooMany = true;
+				return;
+			}
+			PositionEntry position{};
+			position.Type = (uint8_t)record.Type;
+			position.Team = (uint8_t)entry.Team;
+			position.Instance = record.Instance;
+			const string &name = record.GetName();
+			memcpy(position.Name, name.data(), min(name.size(), sizeof(position.Name)));
+			position.X = entry.Position[0];
+			position.Y = entry.Position[1];
+			position.Yaw = GetRotZ(record.Location.rotation());
+			auto age = chrono::duration_cast<chrono::milliseconds>(Snapshot.CaptureTime - record.LastSeen).count();
+			position.Age = clamp<int64_t>(age, 0, UINT16_MAX);
+			writer.Write(position);
+			header.NumObjects++;
+		});
+	}
+	if (TooMany && !WarnedTooMany)
+	{
+		cerr << "Position broadcast : more than " << UINT8_MAX << " robots and PAMIs, the others are not sent" << endl;
+		WarnedTooMany = true;
+	}
+	header.CaptureTime = chrono::duration_cast<chrono::microseconds>(Snapshot.CaptureTime.time_since_epoch()).count();
+	header.SendDelay = chrono::duration_cast<chrono::microseconds>(ObjectData::Clock::now() - Snapshot.CaptureTime).count();
+	writer.WriteAt(0, header);
+	for (auto &transport : Transports)
+	{
+		transport->Send(Buffer.data(), Buffer.size(), GenericTransport::BroadcastClient);
+	}
+}
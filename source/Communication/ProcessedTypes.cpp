@@ -10,6 +10,8 @@ void CameraFeatureData::Clear()
 	ArucoSegments.clear();
 
 	YoloDetections.clear();
+	YoloProjections.clear();
+	YoloGrabTime = std::chrono::steady_clock::time_point();
 }
 
 void CameraFeatureData::CopyEssentials(const CameraImageData &source)
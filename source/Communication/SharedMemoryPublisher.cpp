@@ -0,0 +1,146 @@
+#include "Communication/SharedMemoryPublisher.hpp"
+
+#include <ArucoPipeline/ObjectSnapshot.hpp>
+#include <Misc/math2d.hpp>
+
+#include <opencv2/core/quaternion.hpp>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+template<size_t N>
+static void CopyName(char (&Destination)[N], const string &Source)
+{
+	memset(Destination, 0, N);
+	memcpy(Destination, Source.data(), min(Source.size(), N));
+}
+
+SharedMemoryPublisher::SharedMemoryPublisher(string InName)
+	:Name(InName)
+{
+	FileDescriptor = shm_open(Name.c_str(), O_CREAT | O_RDWR, 0666);
+	if (FileDescriptor == -1)
+	{
+		cerr << "Shared memory failed to open " << Name << " : " << strerror(errno) << endl;
+		return;
+	}
+	//Readers are not always run by the same user, and the umask applies to shm_open
+	fchmod(FileDescriptor, 0666);
+	if (ftruncate(FileDescriptor, sizeof(cyclops_shm_region)) == -1)
+	{
+		cerr << "Shared memory failed to resize " << Name << " : " << strerror(errno) << endl;
+		return;
+	}
+	void* mapped = mmap(nullptr, sizeof(cyclops_shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, FileDescriptor, 0);
+	if (mapped == MAP_FAILED)
+	{
+		cerr << "Shared memory failed to map " << Name << " : " << strerror(errno) << endl;
+		return;
+	}
+	Region = (cyclops_shm_region*)mapped;
+	//Readers wait for the magic, so it's written last
+	__atomic_store_n(&Region->magic, 0, __ATOMIC_RELAXED);
+	memset((char*)Region + sizeof(Region->magic), 0, sizeof(cyclops_shm_region) - sizeof(Region->magic));
+	Region->version = CYCLOPS_SHM_VERSION;
+	Region->size = sizeof(cyclops_shm_region);
+	__atomic_store_n(&Region->magic, CYCLOPS_SHM_MAGIC, __ATOMIC_RELEASE);
+	cout << "Publishing ticks to shared memory " << Name << " (" << sizeof(cyclops_shm_region) << " bytes)" << endl;
+}
+
+SharedMemoryPublisher::~SharedMemoryPublisher()
+{
+	if (Region)
+	{
+		munmap(Region, sizeof(cyclops_shm_region));
+	}
+	if (FileDescriptor != -1)
+	{
+		close(FileDescriptor);
+		shm_unlink(Name.c_str());
+	}
+}
+
+void SharedMemoryPublisher::Publish(const ObjectSnapshot &Snapshot, const vector<CameraFeatureData> &FeatureData)
+{
+	if (!Region)
+	{
+		return;
+	}
+	cyclops_shm_frame* frame = cyclops_shm_begin_write(Region);
+	frame->tick = ++Tick;
+	//steady_clock is CLOCK_MONOTONIC
+	frame->capture_time_us = chrono::duration_cast<chrono::microseconds>(Snapshot.CaptureTime.time_since_epoch()).count();
+	frame->num_objects = 0;
+	//The index has the root objects and their team
+	for (int type = 0; type <= (int)ObjectType::Team; type++)
+	{
+		Snapshot.Index.ForEach((ObjectType)type, [&Snapshot, frame](const ObjectIndex::Entry& entry)
+		{
+			if (frame->num_objects >= CYCLOPS_SHM_MAX_OBJECTS)
+			{
+				return;
+			}
+			const ObjectRecord &record = Snapshot.Records[entry.Index];
+			cyclops_shm_object &object = frame->objects[frame->num_objects++];
+			object.type = (uint8_t)record.Type;
+			object.team = (uint8_t)entry.Team;
+			object.reserved = 0;
+			object.instance = record.Instance;
+			CopyName(object.name, record.GetName());
+			cv::Vec3d position = record.Location.translation();
+			cv::Quatd rotation = cv::Quatd::createFromRotMat(record.Location.rotation());
+			for (int i = 0; i < 3; i++)
+			{
+				object.position[i] = position[i];
+			}
+			object.rotation[0] = rotation.w;
+			object.rotation[1] = rotation.x;
+			object.rotation[2] = rotation.y;
+			object.rotation[3] = rotation.z;
+			auto age = chrono::duration_cast<chrono::milliseconds>(Snapshot.CaptureTime - record.LastSeen).count();
+			object.age_ms = max<int64_t>(age, 0);
+		});
+	}
+	frame->num_cameras = min<size_t>(FeatureData.size(), CYCLOPS_SHM_MAX_CAMERAS);
+	for (size_t camidx = 0; camidx < frame->num_cameras; camidx++)
+	{
+		auto &data = FeatureData[camidx];
+		cyclops_shm_camera &camera = frame->cameras[camidx];
+		CopyName(camera.name, data.CameraName);
+		camera.width = data.FrameSize.width;
+		camera.height = data.FrameSize.height;
+		cv::Size2d fov = data.CameraMatrix.empty() ? cv::Size2d() : GetCameraFOV(data.FrameSize, data.CameraMatrix);
+		camera.x_fov = fov.width;
+		camera.y_fov = fov.height;
+		camera.num_aruco = min<size_t>(data.ArucoIndices.size(), CYCLOPS_SHM_MAX_ARUCO);
+		for (size_t i = 0; i < camera.num_aruco; i++)
+		{
+			cyclops_shm_aruco &aruco = camera.aruco[i];
+			aruco.index = data.ArucoIndices[i];
+			for (size_t j = 0; j < 4; j++)
+			{
+				aruco.corners[j][0] = j < data.ArucoCorners[i].size() ? data.ArucoCorners[i][j].x : 0;
+				aruco.corners[j][1] = j < data.ArucoCorners[i].size() ? data.ArucoCorners[i][j].y : 0;
+			}
+		}
+		camera.num_yolo = min<size_t>(data.YoloDetections.size(), CYCLOPS_SHM_MAX_YOLO);
+		for (size_t i = 0; i < camera.num_yolo; i++)
+		{
+			auto& det = data.YoloDetections[i];
+			cyclops_shm_yolo &yolo = camera.yolo[i];
+			yolo.class_id = det.Class;
+			yolo.confidence = det.Confidence*100;
+			yolo.tlx = det.Corners.tl().x;
+			yolo.tly = det.Corners.tl().y;
+			yolo.brx = det.Corners.br().x;
+			yolo.bry = det.Corners.br().y;
+		}
+	}
+	cyclops_shm_end_write(Region);
+}
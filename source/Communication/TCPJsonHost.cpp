@@ -1,70 +1,288 @@
 #include "Communication/TCPJsonHost.hpp"
 
 #include <iostream>
+#include <array>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include <Communication/JsonListener.hpp>
 #include <Communication/Transport/TCPTransport.hpp>
 #include <EntryPoints/CDFRExternal.hpp>
+#include <Misc/GlobalConf.hpp>
 
 using namespace std;
 
-void TCPJsonHost::ThreadEntryPoint(GenericTransport::NetworkInterface interface)
+TCPJsonHost::TCPJsonHost(int InPort)
+	:Port(InPort)
 {
-	unique_ptr<TCPTransport> Transport = make_unique<TCPTransport>(true, "0.0.0.0", Port, interface.name);
-	set<shared_ptr<JsonListener>> Listeners;
-	while (!killed)
+	EpollFD = epoll_create1(EPOLL_CLOEXEC);
+	if (EpollFD == -1)
+	{
+		cerr << "TCP Json host failed to create epoll : " << strerror(errno) << endl;
+		killed = true;
+		return;
+	}
+	WakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (WakeFD == -1 || !Watch(WakeFD, EPOLLIN))
+	{
+		cerr << "TCP Json host failed to create wake event : " << strerror(errno) << endl;
+	}
+	auto settings = GetJsonHostSettings();
+	auto interfaces = GenericTransport::GetInterfaces();
+	for (size_t i=0; i<interfaces.size(); i++)
+	{
+		auto& ni = interfaces[i];
+
+		cout << "Starting TCP Json host on " << ni.name << " / IP:" << ni.address << " / Netmask:" << ni.mask << " / Broadcast:" << ni.broadcast << endl;
+		auto &Transport = Transports.emplace_back(make_unique<TCPTransport>(true, "0.0.0.0", Port, ni.name));
+		Transport->SetQueueLimits(settings.SendHighWaterMark, settings.MaxQueuedBytes);
+		int listenfd = Transport->GetListenFileDescriptor();
+		if (listenfd == -1 || !Watch(listenfd, EPOLLIN))
+		{
+			cerr << "TCP Json host can't listen on " << ni.name << endl;
+			continue;
+		}
+		ListenSockets[listenfd] = Transport.get();
+	}
+	ThreadHandle = make_unique<thread>(&TCPJsonHost::ThreadEntryPoint, this);
+}
+
+TCPJsonHost::~TCPJsonHost()
+{
+	killed = true;
+	Wake();
+	if (ThreadHandle)
+	{
+		ThreadHandle->join();
+	}
+	Listeners.clear();
+	Transports.clear();
+	if (WakeFD != -1)
+	{
+		close(WakeFD);
+	}
+	if (EpollFD != -1)
+	{
+		close(EpollFD);
+	}
+}
+
+void TCPJsonHost::Wake()
+{
+	if (WakeFD == -1)
+	{
+		return;
+	}
+	uint64_t one = 1;
+	if (write(WakeFD, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
 	{
-		auto newconnections = Transport->AcceptNewConnections();
-		for (auto &&connection : newconnections)
+		cerr << "TCP Json host failed to wake : " << strerror(errno) << endl;
+	}
+}
+
+void TCPJsonHost::NotifyTick()
+{
+	TickPending = true;
+	Wake();
+}
+
+bool TCPJsonHost::Watch(int fd, uint32_t events)
+{
+	epoll_event event;
+	event.events = events;
+	event.data.fd = fd;
+	if (epoll_ctl(EpollFD, EPOLL_CTL_ADD, fd, &event) == -1)
+	{
+		cerr << "TCP Json host failed to watch fd " << fd << " : " << strerror(errno) << endl;
+		return false;
+	}
+	return true;
+}
+
+void TCPJsonHost::Unwatch(int fd)
+{
+	epoll_ctl(EpollFD, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void TCPJsonHost::UpdateWatchedEvents()
+{
+	for (auto &[fd, listener] : Listeners)
+	{
+		bool pending = !listener->IsKilled() && listener->HasPendingOutput();
+		//A closing client has nothing more to read, and its read events would fire on every loop
+		uint32_t events = (listener->IsClosing() ? 0 : EPOLLIN | EPOLLRDHUP) | (pending ? EPOLLOUT : 0);
+		uint32_t &watched = WatchedEvents[fd];
+		if (events == watched)
+		{
+			continue;
+		}
+		epoll_event event;
+		event.events = events;
+		event.data.fd = fd;
+		if (epoll_ctl(EpollFD, EPOLL_CTL_MOD, fd, &event) == -1)
+		{
+			cerr << "TCP Json host failed to change events of fd " << fd << " : " << strerror(errno) << endl;
+			continue;
+		}
+		watched = events;
+	}
+}
+
+void TCPJsonHost::AcceptClients(TCPTransport* Transport)
+{
+	auto newconnections = Transport->AcceptNewConnections();
+	for (auto &&connection : newconnections)
+	{
+		int fd = Transport->GetFileDescriptor(connection);
+		if (fd == -1 || !Watch(fd, EPOLLIN | EPOLLRDHUP))
+		{
+			Transport->DisconnectClient(connection);
+			continue;
+		}
+		WatchedEvents[fd] = EPOLLIN | EPOLLRDHUP;
+		Listeners[fd] = make_shared<JsonListener>(Transport, connection, this);
+		NumClients++;
+		if (ExternalRunner)
 		{
-			JsonListener* listener = new JsonListener(Transport.get(), connection, this);
-			Listeners.emplace(listener);
-			NumClients++;
 			ExternalRunner->SetHasNoClients(NumClients == 0);
-			cout << NumClients << " clients right now" << endl;
 		}
-		for (auto it = Listeners.begin(); it != Listeners.end();)
+		cout << NumClients << " clients right now" << endl;
+	}
+}
+
+void TCPJsonHost::RemoveKilledListeners()
+{
+	for (auto it = Listeners.begin(); it != Listeners.end();)
+	{
+		shared_ptr<JsonListener> lptr = it->second;
+		if (!lptr->IsDone())
 		{
-			shared_ptr<JsonListener> lptr = *it;
-			if (lptr->IsKilled())
-			{
-				cout << "Client at " << lptr->ClientName << " is killed, cleaning..." << endl;
-				Transport->DisconnectClient(lptr->ClientName);
-				it=Listeners.erase(it);
-				NumClients--;
-				ExternalRunner->SetHasNoClients(NumClients == 0);
-				cout << NumClients << " clients right now" << endl;
-			}
-			else
-			{
-				it++;
-			}
+			it++;
+			continue;
 		}
-		
-		this_thread::sleep_for(chrono::milliseconds(100));
+		cout << "Client at " << lptr->ClientName << (lptr->IsKilled() ? " is killed" : " is closed") << ", cleaning..." << endl;
+		//Stop watching before the socket is closed, the fd number can be reused right after
+		Unwatch(it->first);
+		WatchedEvents.erase(it->first);
+		lptr->Transport->DisconnectClient(lptr->Handle);
+		it=Listeners.erase(it);
+		NumClients--;
+		if (ExternalRunner)
+		{
+			ExternalRunner->SetHasNoClients(NumClients == 0);
+		}
+		cout << NumClients << " clients right now" << endl;
 	}
 }
 
-TCPJsonHost::TCPJsonHost(int InPort)
-	:Port(InPort)
+JsonTick& TCPJsonHost::GetCurrentTick()
 {
-	auto interfaces = GenericTransport::GetInterfaces();
-	for (size_t i=0; i<interfaces.size(); i++)
+	//A new snapshot is a new tick : data is fetched once for all the clients, and the serialization cache starts over
+	auto Snapshot = ExternalRunner->GetObjectSnapshot();
+	if (Snapshot != CurrentTick.Snapshot)
 	{
-		auto& ni = interfaces[i];
-		
-		cout << "Starting TCP Json host on " << ni.name << " / IP:" << ni.address << " / Netmask:" << ni.mask << " / Broadcast:" << ni.broadcast << endl;
-		thread* sendthread = new thread(&TCPJsonHost::ThreadEntryPoint, this, ni);
-		ThreadHandles.emplace(sendthread);
+		CurrentTick.Index = TickIndex;
+		CurrentTick.Snapshot = Snapshot;
+		CurrentTick.FeatureData = ExternalRunner->GetFeatureData();
+		CurrentTick.Serialized.clear();
+		CurrentTick.HasImages = false;
+		CurrentTick.ImageData.clear();
+		CurrentTick.Images.clear();
 	}
+	return CurrentTick;
 }
 
-TCPJsonHost::~TCPJsonHost()
+void TCPJsonHost::PublishTick()
 {
-	killed = true;
-	for (auto &thread : ThreadHandles)
+	if (!ExternalRunner)
+	{
+		return;
+	}
+	bool HasSubscribers = false;
+	for (auto &[fd, listener] : Listeners)
+	{
+		HasSubscribers |= listener->IsSubscribed();
+	}
+	TickIndex++;
+	if (!HasSubscribers)
 	{
-		thread->join();
+		return;
+	}
+	JsonTick &Tick = GetCurrentTick();
+	Tick.Index = TickIndex;
+	for (auto &[fd, listener] : Listeners)
+	{
+		listener->OnTick(Tick);
+	}
+}
+
+void TCPJsonHost::ThreadEntryPoint()
+{
+	array<epoll_event, 64> events;
+	while (!killed)
+	{
+		int numevents = epoll_wait(EpollFD, events.data(), events.size(), LoopTimeoutMs);
+		if (numevents == -1)
+		{
+			if (errno != EINTR)
+			{
+				cerr << "TCP Json host epoll_wait failed : " << strerror(errno) << endl;
+				this_thread::sleep_for(chrono::milliseconds(100));
+			}
+			continue;
+		}
+		for (int i = 0; i < numevents; i++)
+		{
+			int fd = events[i].data.fd;
+			uint32_t flags = events[i].events;
+			if (fd == WakeFD)
+			{
+				uint64_t count;
+				(void) !read(WakeFD, &count, sizeof(count));
+				continue;
+			}
+			auto listenit = ListenSockets.find(fd);
+			if (listenit != ListenSockets.end())
+			{
+				AcceptClients(listenit->second);
+				continue;
+			}
+			auto listenerit = Listeners.find(fd);
+			if (listenerit == Listeners.end())
+			{
+				continue;
+			}
+			auto &listener = listenerit->second;
+			//Data sent right before a hangup is still handled
+			if (flags & EPOLLIN)
+			{
+				listener->OnReadable();
+			}
+			if (flags & EPOLLOUT)
+			{
+				listener->OnWritable();
+			}
+			//Half closed : the client may still be waiting for the replies to what it sent
+			if (flags & EPOLLRDHUP)
+			{
+				listener->Close();
+			}
+			if (flags & (EPOLLHUP | EPOLLERR))
+			{
+				listener->Kill();
+			}
+		}
+		if (TickPending.exchange(false))
+		{
+			PublishTick();
+		}
+		for (auto &[fd, listener] : Listeners)
+		{
+			listener->CheckAlive();
+		}
+		RemoveKilledListeners();
+		UpdateWatchedEvents();
 	}
-	
 }
@@ -9,10 +9,13 @@
 #include <netinet/tcp.h>
 #include <sys/un.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 
 #include <mutex>
+#include <array>
+#include <algorithm>
 
 using namespace std;
 
@@ -34,10 +37,14 @@ TCPTransport::TCPTransport(bool inServer, string inIP, int inPort, string inInte
 TCPTransport::~TCPTransport()
 {
 	cout << "Destroying TCP transport " << IP << ":" << Port << " @ " << Interface <<endl;
-	for (size_t i = 0; i < connections.size(); i++)
+	for (auto &connection : connections)
 	{
-		shutdown(connections[i].filedescriptor, SHUT_RDWR);
-		close(connections[i].filedescriptor);
+		if (connection.filedescriptor == -1)
+		{
+			continue;
+		}
+		shutdown(connection.filedescriptor, SHUT_RDWR);
+		close(connection.filedescriptor);
 	}
 	if (sockfd != -1)
 	{
@@ -153,10 +160,16 @@ void TCPTransport::DeleteSocket(int fd)
 	close(fd);
 }
 
-void TCPTransport::ServerDeleteSocket(int clientidx)
+void TCPTransport::ServerDeleteSocket(TCPConnection &connection)
 {
-	DeleteSocket(connections[clientidx].filedescriptor);
-	connections.erase(next(connections.begin(), clientidx));
+	DeleteSocket(connection.filedescriptor);
+	connection.filedescriptor = -1;
+	connection.Queue.clear();
+	connection.QueuedBytes = 0;
+	connection.DroppedMessages = 0;
+	//Handles of the closed connection stop matching the slot
+	connection.Generation++;
+	FreeSlots.push_back(&connection - connections.data());
 }
 
 
@@ -167,9 +180,12 @@ vector<string> TCPTransport::GetClients() const
 		vector<string> clients;
 		shared_lock lock(listenmutex);
 		clients.reserve(connections.size());
-		for (size_t i = 0; i < connections.size(); i++)
+		for (auto &connection : connections)
 		{
-			clients.push_back(connections[i].name);
+			if (connection.filedescriptor != -1)
+			{
+				clients.push_back(connection.name);
+			}
 		}
 		return clients;
 	}
@@ -187,12 +203,12 @@ int TCPTransport::Receive(void *buffer, int maxlength, string client, bool block
 
 	if (Server)
 	{
-		set<string> DisconnectedClients;
+		vector<ConnectionHandle> DisconnectedClients;
 		{
 			shared_lock lock(listenmutex);
 			for (size_t i = 0; i < connections.size(); i++)
 			{
-				if (client != connections[i].name && client != BroadcastClient)
+				if (connections[i].filedescriptor == -1 || (client != connections[i].name && client != BroadcastClient))
 				{
 					continue;
 				}
@@ -200,16 +216,16 @@ int TCPTransport::Receive(void *buffer, int maxlength, string client, bool block
 				n = recv(connections[i].filedescriptor, buffer, maxlength, flags);
 				if (n == 0/*|| errno == EWOULDBLOCK || errno == EAGAIN*/)
 				{
-					DisconnectedClients.emplace(connections[i].name);
+					DisconnectedClients.push_back({(uint32_t)i, connections[i].Generation});
 				} else if (n < 0) {
 					continue;
 				}
 				return n;
 			}
 		}
-		for (auto & client : DisconnectedClients) //Disconnection must be done outside of loop because the listenmutex is taken
+		for (auto & handle : DisconnectedClients) //Disconnection must be done outside of loop because the listenmutex is taken
 		{
-			DisconnectClient(client);
+			DisconnectClient(handle);
 		}
 	}
 	else
@@ -242,58 +258,28 @@ bool TCPTransport::Send(const void* buffer, int length, string client)
 	}
 	//cout << "Sending " << length << " bytes..." << endl;
 	//printBuffer(buffer, length);
-	/*if (length > 1000)
-	{
-		cerr << "WARNING : Packet length over 1000, packet may be dropped" << endl;
-	}*/
 
 	if (Server)
 	{
-		set<string> DisconnectedClients;
+		iovec single{const_cast<void*>(buffer), (size_t)length};
+		//Queues are modified, so the lock is exclusive
+		unique_lock lock(listenmutex);
 		bool failed = false;
+		bool found = false;
+		for (auto &connection : connections)
 		{
-			shared_lock lock(listenmutex);
-			size_t i;
-			for (i = 0; i < connections.size(); i++)
+			if (connection.filedescriptor == -1 || (client != connection.name && client != BroadcastClient))
 			{
-				if (client != connections[i].name && client != BroadcastClient)
-				{
-					continue;
-				}
-				int err = send(connections[i].filedescriptor, buffer, length, MSG_NOSIGNAL);
-				int errnocp = errno;
-				if (err ==-1 && (errnocp != EAGAIN && errnocp != EWOULDBLOCK))
-				{
-					if (errnocp == EPIPE)
-					{
-						DisconnectedClients.emplace(connections[i].name);
-						failed = true;
-					}
-					else
-					{
-						cerr << "TCP Server failed to send data to client " << connections[i].name << " : " << errnocp << " (" << strerror(errnocp) << ")" << endl;
-						failed = true;
-					}
-					
-				}
-				if (client != BroadcastClient)
-				{
-					break;
-				}
+				continue;
 			}
-			//If nothing was sent because no client matched 
-			if (i == connections.size() && client != BroadcastClient)
+			found = true;
+			if (!QueueSend(connection, &single, 1, false))
 			{
 				failed = true;
 			}
-			
-		}
-		for (auto & client : DisconnectedClients) //Disconnection must be done outside of loop because the listenmutex is taken
-		{
-			DisconnectClient(client);
 		}
-		
-		return !failed;
+		//If nothing was sent because no client matched 
+		return !failed && (found || client == BroadcastClient);
 	}
 	else
 	{
@@ -319,50 +305,277 @@ bool TCPTransport::Send(const void* buffer, int length, string client)
 	}
 }
 
-vector<string> TCPTransport::AcceptNewConnections()
+//Writes as much as the socket takes, without blocking if flags has MSG_DONTWAIT. Returns the number of bytes written, -1 on error.
+static ssize_t SendAvailable(int fd, const iovec* buffers, int count, int flags)
+{
+	//The caller's buffers are not copied : a window of them is passed to the kernel, the first one offset by what was already sent of it
+	array<iovec, 16> window;
+	int first = 0;
+	size_t offset = 0;
+	ssize_t total = 0;
+	while (first < count)
+	{
+		int numwindow = min<int>(count - first, window.size());
+		copy(buffers + first, buffers + first + numwindow, window.begin());
+		window[0].iov_base = (char*)window[0].iov_base + offset;
+		window[0].iov_len -= offset;
+		msghdr message{};
+		message.msg_iov = window.data();
+		message.msg_iovlen = numwindow;
+		ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL | flags);
+		if (sent == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				break;
+			}
+			cerr << "TCP Failed to send data on fd " << fd << " : " << errno << " (" << strerror(errno) << ")" << endl;
+			return -1;
+		}
+		total += sent;
+		//Skip what was sent, the kernel can stop in the middle of a buffer
+		size_t skip = sent + offset;
+		while (first < count && skip >= buffers[first].iov_len)
+		{
+			skip -= buffers[first].iov_len;
+			first++;
+		}
+		offset = skip;
+	}
+	return total;
+}
+
+bool TCPTransport::QueueSend(TCPConnection &connection, const iovec* buffers, int count, bool Droppable)
+{
+	size_t total = 0;
+	for (int i = 0; i < count; i++)
+	{
+		total += buffers[i].iov_len;
+	}
+	size_t written = 0;
+	//Messages are sent in order : once something is queued, the new ones go behind it
+	if (connection.Queue.empty())
+	{
+		ssize_t sent = SendAvailable(connection.filedescriptor, buffers, count, MSG_DONTWAIT);
+		if (sent < 0)
+		{
+			return false;
+		}
+		written = sent;
+	}
+	if (written == total)
+	{
+		return true;
+	}
+	OutboundMessage message;
+	message.Data.reserve(total - written);
+	size_t skip = written;
+	for (int i = 0; i < count; i++)
+	{
+		const uint8_t* data = (const uint8_t*)buffers[i].iov_base;
+		size_t length = buffers[i].iov_len;
+		size_t skipped = min(skip, length);
+		message.Data.insert(message.Data.end(), data + skipped, data + length);
+		skip -= skipped;
+	}
+	//Once started, a message has to be finished or the stream is corrupted
+	message.Droppable = Droppable && written == 0;
+	connection.QueuedBytes += message.Data.size();
+	connection.Queue.push_back(move(message));
+
+	if (connection.QueuedBytes > HighWaterMark)
+	{
+		for (auto it = connection.Queue.begin(); it != connection.Queue.end() && connection.QueuedBytes > HighWaterMark;)
+		{
+			if (!it->Droppable || it->Sent != 0)
+			{
+				it++;
+				continue;
+			}
+			connection.QueuedBytes -= it->Data.size();
+			connection.DroppedMessages++;
+			it = connection.Queue.erase(it);
+		}
+	}
+	if (connection.QueuedBytes > MaxQueuedBytes)
+	{
+		cerr << "TCP Client " << connection.name << " is too slow, " << connection.QueuedBytes << " bytes waiting" << endl;
+		return false;
+	}
+	return true;
+}
+
+bool TCPTransport::FlushQueue(TCPConnection &connection)
+{
+	while (!connection.Queue.empty())
+	{
+		array<iovec, 16> buffers;
+		int count = 0;
+		for (auto it = connection.Queue.begin(); it != connection.Queue.end() && count < (int)buffers.size(); it++, count++)
+		{
+			buffers[count].iov_base = it->Data.data() + it->Sent;
+			buffers[count].iov_len = it->Data.size() - it->Sent;
+		}
+		ssize_t sent = SendAvailable(connection.filedescriptor, buffers.data(), count, MSG_DONTWAIT);
+		if (sent < 0)
+		{
+			return false;
+		}
+		if (sent == 0)
+		{
+			return true;
+		}
+		connection.QueuedBytes -= sent;
+		while (sent > 0)
+		{
+			auto &front = connection.Queue.front();
+			size_t part = min<size_t>(sent, front.Data.size() - front.Sent);
+			front.Sent += part;
+			sent -= part;
+			if (front.Sent == front.Data.size())
+			{
+				connection.Queue.pop_front();
+			}
+		}
+	}
+	return true;
+}
+
+TCPTransport::TCPConnection* TCPTransport::FindConnection(ConnectionHandle Handle)
+{
+	if (Handle.Slot >= connections.size())
+	{
+		return nullptr;
+	}
+	TCPConnection &connection = connections[Handle.Slot];
+	if (connection.filedescriptor == -1 || connection.Generation != Handle.Generation)
+	{
+		return nullptr;
+	}
+	return &connection;
+}
+
+const TCPTransport::TCPConnection* TCPTransport::FindConnection(ConnectionHandle Handle) const
+{
+	return const_cast<TCPTransport*>(this)->FindConnection(Handle);
+}
+
+bool TCPTransport::Send(const void* buffer, int length, ConnectionHandle Handle, bool Droppable)
+{
+	iovec single{const_cast<void*>(buffer), (size_t)length};
+	return Send(&single, 1, Handle, Droppable);
+}
+
+bool TCPTransport::Send(const iovec* buffers, int count, ConnectionHandle Handle, bool Droppable)
+{
+	if (!Connected || !Server)
+	{
+		return false;
+	}
+	//Queues are modified, so the lock is exclusive
+	unique_lock lock(listenmutex);
+	TCPConnection* connection = FindConnection(Handle);
+	return connection && QueueSend(*connection, buffers, count, Droppable);
+}
+
+int TCPTransport::Receive(void *buffer, int maxlength, ConnectionHandle Handle)
+{
+	shared_lock lock(listenmutex);
+	const TCPConnection* connection = FindConnection(Handle);
+	if (!connection)
+	{
+		return 0;
+	}
+	int n = recv(connection->filedescriptor, buffer, maxlength, MSG_DONTWAIT);
+	if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+	{
+		//Connection reset and the like : the owner disconnects the client
+		return 0;
+	}
+	return n;
+}
+
+bool TCPTransport::Flush(ConnectionHandle Handle)
+{
+	unique_lock lock(listenmutex);
+	TCPConnection* connection = FindConnection(Handle);
+	return connection && FlushQueue(*connection);
+}
+
+bool TCPTransport::HasPendingOutput(ConnectionHandle Handle) const
+{
+	shared_lock lock(listenmutex);
+	const TCPConnection* connection = FindConnection(Handle);
+	return connection && !connection->Queue.empty();
+}
+
+TCPTransport::QueueStats TCPTransport::GetQueueStats(ConnectionHandle Handle) const
+{
+	shared_lock lock(listenmutex);
+	QueueStats stats;
+	const TCPConnection* connection = FindConnection(Handle);
+	if (connection)
+	{
+		stats.QueuedBytes = connection->QueuedBytes;
+		stats.QueuedMessages = connection->Queue.size();
+		stats.DroppedMessages = connection->DroppedMessages;
+	}
+	return stats;
+}
+
+void TCPTransport::SetQueueLimits(size_t InHighWaterMark, size_t InMaxQueuedBytes)
+{
+	unique_lock lock(listenmutex);
+	HighWaterMark = InHighWaterMark;
+	MaxQueuedBytes = max(InHighWaterMark, InMaxQueuedBytes);
+}
+
+vector<TCPTransport::ConnectionHandle> TCPTransport::AcceptNewConnections()
 {
 	if (!Server)
 	{
 		return {};	
 	}
-	vector<string> newconnections;
+	vector<ConnectionHandle> newconnections;
 	CheckConnection();
 	while (1)
 	{
-		TCPConnection connection;
-		socklen_t clientSize = sizeof(connection.address);
-		bzero(&connection.address, clientSize);
-		connection.filedescriptor = accept4(sockfd, (struct sockaddr *)&connection.address, &clientSize, 0);
-		if (connection.filedescriptor > 0)
+		sockaddr_in address;
+		socklen_t clientSize = sizeof(address);
+		bzero(&address, clientSize);
+		int fd = accept4(sockfd, (struct sockaddr *)&address, &clientSize, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd > 0)
 		{
 			//LowerLatency(ret);
 			char buffer[16];
-			inet_ntop(AF_INET, &connection.address.sin_addr, buffer, sizeof(buffer));
+			inet_ntop(AF_INET, &address.sin_addr, buffer, sizeof(buffer));
 			buffer[sizeof(buffer)-1] = 0;
-			connection.name = string(buffer, strlen(buffer));
-			cout << "TCP Client connecting from " << connection.name << " fd=" << connection.filedescriptor << endl;
-			bool unique = true;
-			{
-				shared_lock lock(listenmutex);
-				for (auto &already : connections)
-				{
-					if (already.name == connection.name)
-					{
-						unique = false;
-						break;
-					}
-				}
-				if (!unique)
-				{
-					close(connection.filedescriptor);
-					cerr << "Refusing connection from " << connection.name << " as it's already connected" << endl;
-					continue;
-				}
-			}
+			//Several clients can connect from the same machine, the port tells them apart
+			string name = string(buffer, strlen(buffer)) + ":" + to_string(ntohs(address.sin_port));
+			cout << "TCP Client connecting from " << name << " fd=" << fd << endl;
 			
 			unique_lock lock(listenmutex);
-			connections.push_back(connection);
-			newconnections.push_back(connection.name);
+			uint32_t slot;
+			if (FreeSlots.empty())
+			{
+				slot = connections.size();
+				connections.emplace_back();
+			}
+			else
+			{
+				slot = FreeSlots.back();
+				FreeSlots.pop_back();
+			}
+			TCPConnection &connection = connections[slot];
+			connection.filedescriptor = fd;
+			connection.address = address;
+			connection.name = name;
+			connection.Generation++;
+			newconnections.push_back({slot, connection.Generation});
 		}
 		else 
 		{
@@ -381,26 +594,36 @@ vector<string> TCPTransport::AcceptNewConnections()
 	return newconnections;
 }
 
-void TCPTransport::DisconnectClient(std::string client)
+int TCPTransport::GetFileDescriptor(ConnectionHandle Handle) const
+{
+	shared_lock lock(listenmutex);
+	const TCPConnection* connection = FindConnection(Handle);
+	return connection ? connection->filedescriptor : -1;
+}
+
+string TCPTransport::GetClientName(ConnectionHandle Handle) const
+{
+	shared_lock lock(listenmutex);
+	const TCPConnection* connection = FindConnection(Handle);
+	return connection ? connection->name : string();
+}
+
+void TCPTransport::DisconnectClient(ConnectionHandle Handle)
 {
 	unique_lock lock(listenmutex);
-	for (size_t i = 0; i < connections.size(); i++)
+	TCPConnection* connection = FindConnection(Handle);
+	if (!connection)
 	{
-		if (client != connections[i].name && client != BroadcastClient)
-		{
-			continue;
-		}
-		cout << "TCP Client " << connections[i].name << "@fd" << connections[i].filedescriptor << " disconnected." <<endl;
-		
-		ServerDeleteSocket(i);
-		i--;
+		return;
 	}
+	cout << "TCP Client " << connection->name << "@fd" << connection->filedescriptor << " disconnected." <<endl;
+	ServerDeleteSocket(*connection);
 }
 
 void TCPTransport::ThreadEntryPoint()
 {
 	cout << "TCP Webserver thread started..." << endl;
-	while (1)
+	while (!killed)
 	{
 		this_thread::sleep_for(chrono::milliseconds(100));
 		CheckConnection();
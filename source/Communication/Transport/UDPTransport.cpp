@@ -69,7 +69,7 @@ bool UDPTransport::Send(const void *buffer, int length, std::string client)
 	//printBuffer(buffer, length);
 	shared_lock lock(listenmutex);
 	sockaddr_in connectionaddress;
-	connectionaddress.sin_port = Port;
+	connectionaddress.sin_port = htons(Port);
 	connectionaddress.sin_family = AF_INET;
 	if (client == BroadcastClient)
 	{
@@ -77,7 +77,7 @@ bool UDPTransport::Send(const void *buffer, int length, std::string client)
 	}
 	inet_pton(AF_INET, client.c_str(), &connectionaddress.sin_addr);
 	
-	int err = sendto(sockfd, buffer, length, 0, (struct sockaddr*)&connectionaddress, sizeof(sockaddr_in));
+	int err = sendto(sockfd, buffer, length, MSG_DONTWAIT, (struct sockaddr*)&connectionaddress, sizeof(sockaddr_in));
 	if (err==-1 && (errno != EAGAIN && errno != EWOULDBLOCK))
 	{
 		cerr << "UDP Server failed to send data to " << client << " : " << errno << "(" << strerror(errno) << ")" << endl;
@@ -0,0 +1,458 @@
+#include "DetectFeatures/InferenceBackend.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+#include <opencv2/dnn.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#ifdef WITH_CORAL
+#include <edgetpu.h>
+#include <edgetpu_c.h>
+#include <tensorflow/lite/interpreter.h>
+#include <tensorflow/lite/interpreter_builder.h>
+#include <tensorflow/lite/op_resolver.h>
+#include <tensorflow/lite/core/kernels/register.h>
+#include <tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+double InferenceBackend::Benchmark(int Runs)
+{
+	Size size = GetInputSize();
+	int sizes[] = {1, 3, size.height, size.width};
+	Mat blob(4, sizes, CV_32F, Scalar(0.5));
+	vector<Mat> outputs;
+	//warmup, first inference allocates
+	if (!Infer(blob, outputs))
+	{
+		return INFINITY;
+	}
+	vector<double> times;
+	times.reserve(Runs);
+	for (int i = 0; i < Runs; i++)
+	{
+		auto start = chrono::steady_clock::now();
+		if (!Infer(blob, outputs))
+		{
+			return INFINITY;
+		}
+		times.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+	}
+	if (times.empty())
+	{
+		return INFINITY;
+	}
+	nth_element(times.begin(), times.begin() + times.size()/2, times.end());
+	return times[times.size()/2];
+}
+
+//Reads the input size in the [net] section of a darknet config
+static Size ReadDarknetInputSize(const filesystem::path& cfg)
+{
+	Size size(640, 480);
+	ifstream file(cfg);
+	string line;
+	while (getline(file, line))
+	{
+		if (line.rfind("width=", 0) == 0)
+		{
+			size.width = stoi(line.substr(6));
+		}
+		else if (line.rfind("height=", 0) == 0)
+		{
+			size.height = stoi(line.substr(7));
+		}
+		else if (line.size() && line[0] == '[' && line != "[net]")
+		{
+			break;
+		}
+	}
+	return size;
+}
+
+//OpenCV DNN with the darknet model, on any of the backends/targets OpenCV was built with
+//The int8 variant is quantised at load using the images in the calibration folder next to the model
+class OpenCVBackend : public InferenceBackend
+{
+private:
+	dnn::Backend BackendID;
+	dnn::Target TargetID;
+	bool Int8;
+	dnn::Net network;
+	vector<string> OutputNames;
+	Size InputSize;
+	Mat Calibration; //Blob of the calibration images, kept to load similar backends without reading them again
+
+	bool Quantize(const filesystem::path& CalibrationPath)
+	{
+		if (!Calibration.empty())
+		{
+			network = network.quantize(Calibration, CV_32F, CV_32F);
+			return true;
+		}
+		vector<Mat> images;
+		if (filesystem::is_directory(CalibrationPath))
+		{
+			for (auto &entry : filesystem::directory_iterator(CalibrationPath))
+			{
+				Mat image = imread(entry.path().string());
+				if (!image.empty())
+				{
+					images.push_back(image);
+				}
+				if (images.size() >= 16)
+				{
+					break;
+				}
+			}
+		}
+		if (images.empty())
+		{
+			cerr << "No calibration images in " << CalibrationPath << ", int8 inference disabled" << endl;
+			return false;
+		}
+		dnn::blobFromImages(images, Calibration, 1.0/255.0, InputSize, Scalar(), true, false);
+		network = network.quantize(Calibration, CV_32F, CV_32F);
+		return true;
+	}
+
+public:
+	OpenCVBackend(dnn::Backend InBackendID, dnn::Target InTargetID, bool InInt8 = false)
+		:BackendID(InBackendID), TargetID(InTargetID), Int8(InInt8)
+	{}
+
+	virtual string GetName() const override
+	{
+		return string("OpenCV DNN ") + (Int8 ? "int8 " : "") + "(backend " + to_string(BackendID) + ", target " + to_string(TargetID) + ")";
+	}
+
+	virtual unique_ptr<InferenceBackend> CreateSimilar() const override
+	{
+		auto similar = make_unique<OpenCVBackend>(BackendID, TargetID, Int8);
+		similar->Calibration = Calibration;
+		return similar;
+	}
+
+	virtual bool Load(const filesystem::path& ModelBase) override
+	{
+		auto cfg = ModelBase.string() + ".cfg";
+		auto weights = ModelBase.string() + ".weights";
+		try
+		{
+			network = dnn::readNetFromDarknet(cfg, weights);
+			InputSize = ReadDarknetInputSize(cfg);
+			if (Int8 && !Quantize(ModelBase.parent_path() / "calibration"))
+			{
+				return false;
+			}
+			network.setPreferableBackend(BackendID);
+			network.setPreferableTarget(TargetID);
+			OutputNames = network.getUnconnectedOutLayersNames();
+		}
+		catch(const cv::Exception& e)
+		{
+			cerr << "Failed to load " << GetName() << " : " << e.what() << endl;
+			return false;
+		}
+		return !network.empty();
+	}
+
+	virtual Size GetInputSize() const override
+	{
+		return InputSize;
+	}
+
+	virtual bool Infer(const Mat& InputBlob, vector<Mat>& Outputs) override
+	{
+		try
+		{
+			network.setInput(InputBlob);
+			network.forward(Outputs, OutputNames);
+		}
+		catch(const cv::Exception& e)
+		{
+			cerr << "Inference failed on " << GetName() << " : " << e.what() << endl;
+			return false;
+		}
+		return true;
+	}
+};
+
+#ifdef WITH_CORAL
+//TFLite model, either on the CPU with XNNPACK or on a Coral EdgeTPU
+//Images are run one by one, as the models are exported with a batch size of 1
+class TFLiteBackend : public InferenceBackend
+{
+private:
+	bool EdgeTPU;
+	shared_ptr<edgetpu::EdgeTpuContext> context;
+	unique_ptr<tflite::FlatBufferModel> model;
+	unique_ptr<tflite::Interpreter> interpreter;
+	TfLiteDelegate* XNNPack = nullptr;
+
+	static string ToString(edgetpu_device_type type) {
+		switch (type) {
+			case EDGETPU_APEX_PCI:
+			return "PCI";
+			case EDGETPU_APEX_USB:
+			return "USB";
+		}
+		return "Unknown";
+	}
+
+	bool OpenEdgeTPU()
+	{
+		size_t num_edges = 0;
+		unique_ptr<edgetpu_device, decltype(&edgetpu_free_devices)> devices(edgetpu_list_devices(&num_edges), &edgetpu_free_devices);
+		for (size_t i = 0; i < num_edges; i++)
+		{
+			auto device = devices.get()[i];
+			cout << "Found Coral @" << device.path << " over " << ToString(device.type) << endl;
+		}
+		if (num_edges == 0)
+		{
+			return false;
+		}
+		auto manager = edgetpu::EdgeTpuManager::GetSingleton();
+		if (manager == nullptr)
+		{
+			cerr << "Failed to open EdgeTPU Manager" << endl;
+			return false;
+		}
+		manager->SetVerbosity(1);
+
+		context = manager->OpenDevice();
+		if (context == nullptr)
+		{
+			cerr << "Failed to open EdgeTPU Device" << endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool BuildInterpreter()
+	{
+		tflite::ops::builtin::BuiltinOpResolver resolver;
+		if (EdgeTPU)
+		{
+			resolver.AddCustom(edgetpu::kCustomOp, edgetpu::RegisterCustomOp());
+		}
+		auto builder = tflite::InterpreterBuilder(*model, resolver);
+		if (builder(&interpreter) != kTfLiteOk) {
+			cerr << "Failed to build interpreter." << endl;
+			return false;
+		}
+		if (EdgeTPU)
+		{
+			// Bind given context with interpreter.
+			interpreter->SetExternalContext(TfLiteExternalContextType::kTfLiteEdgeTpuContext, (TfLiteExternalContext*) context.get());
+			interpreter->SetNumThreads(1);
+		}
+		else
+		{
+			TfLiteXNNPackDelegateOptions options = TfLiteXNNPackDelegateOptionsDefault();
+			XNNPack = TfLiteXNNPackDelegateCreate(&options);
+			if (interpreter->ModifyGraphWithDelegate(XNNPack) != kTfLiteOk)
+			{
+				cerr << "Failed to apply XNNPACK delegate, running on the reference kernels" << endl;
+			}
+		}
+		if (interpreter->AllocateTensors() != kTfLiteOk) {
+			cerr << "Failed to allocate tensors." << endl;
+			return false;
+		}
+		return true;
+	}
+
+public:
+	TFLiteBackend(bool InEdgeTPU)
+		:EdgeTPU(InEdgeTPU)
+	{}
+
+	virtual ~TFLiteBackend()
+	{
+		interpreter.reset(); //must go before the delegate and the context
+		if (XNNPack)
+		{
+			TfLiteXNNPackDelegateDelete(XNNPack);
+		}
+	}
+
+	virtual string GetName() const override
+	{
+		return EdgeTPU ? "TFLite EdgeTPU" : "TFLite XNNPACK";
+	}
+
+	virtual unique_ptr<InferenceBackend> CreateSimilar() const override
+	{
+		return make_unique<TFLiteBackend>(EdgeTPU);
+	}
+
+	virtual bool Load(const filesystem::path& ModelBase) override
+	{
+		if (EdgeTPU && !OpenEdgeTPU())
+		{
+			return false;
+		}
+		const auto model_path = EdgeTPU ? ModelBase.parent_path() / "edgetpu.tflite" : filesystem::path(ModelBase.string() + ".tflite");
+		if (!filesystem::exists(model_path))
+		{
+			return false;
+		}
+		model = tflite::FlatBufferModel::BuildFromFile(model_path.c_str());
+		if (model == nullptr)
+		{
+			cerr << "Failed to load model for " << GetName() << endl;
+			return false;
+		}
+		if(!BuildInterpreter())
+		{
+			cerr << "Failed to build " << GetName() << " interpreter" << endl;
+			return false;
+		}
+		return true;
+	}
+
+	virtual Size GetInputSize() const override
+	{
+		auto dims = interpreter->input_tensor(0)->dims; //NHWC
+		return Size(dims->data[2], dims->data[1]);
+	}
+
+	virtual bool Infer(const Mat& InputBlob, vector<Mat>& Outputs) override
+	{
+		const int batch = InputBlob.size[0], channels = InputBlob.size[1], height = InputBlob.size[2], width = InputBlob.size[3];
+		TfLiteTensor* input = interpreter->input_tensor(0);
+		if (input->dims->size != 4 || input->dims->data[1] != height || input->dims->data[2] != width || input->dims->data[3] != channels)
+		{
+			cerr << GetName() << " : input blob does not match the model" << endl;
+			return false;
+		}
+		const int planeSize = width*height;
+		Outputs.resize(interpreter->outputs().size());
+		for (int b = 0; b < batch; b++)
+		{
+			//NCHW float to NHWC, quantised if needed
+			for (int c = 0; c < channels; c++)
+			{
+				const float* plane = InputBlob.ptr<float>(b, c);
+				for (int i = 0; i < planeSize; i++)
+				{
+					int index = i*channels + c;
+					switch (input->type)
+					{
+					case kTfLiteFloat32:
+						input->data.f[index] = plane[i];
+						break;
+					case kTfLiteUInt8:
+						input->data.uint8[index] = saturate_cast<uint8_t>(plane[i]/input->params.scale + input->params.zero_point);
+						break;
+					case kTfLiteInt8:
+						input->data.int8[index] = saturate_cast<int8_t>(plane[i]/input->params.scale + input->params.zero_point);
+						break;
+					default:
+						cerr << GetName() << " : unsupported input type" << endl;
+						return false;
+					}
+				}
+			}
+			if (interpreter->Invoke() != kTfLiteOk)
+			{
+				cerr << GetName() << " : inference failed" << endl;
+				return false;
+			}
+			for (size_t o = 0; o < Outputs.size(); o++)
+			{
+				const TfLiteTensor* output = interpreter->output_tensor(o);
+				int numelem = output->dims->data[output->dims->size-1];
+				int numdet = 1;
+				for (int d = 0; d < output->dims->size-1; d++)
+				{
+					numdet *= output->dims->data[d];
+				}
+				if (b == 0)
+				{
+					Outputs[o].create(numdet*batch, numelem, CV_32F);
+				}
+				float* dst = Outputs[o].ptr<float>(numdet*b);
+				const int count = numdet*numelem;
+				for (int i = 0; i < count; i++)
+				{
+					switch (output->type)
+					{
+					case kTfLiteFloat32:
+						dst[i] = output->data.f[i];
+						break;
+					case kTfLiteUInt8:
+						dst[i] = (output->data.uint8[i] - output->params.zero_point) * output->params.scale;
+						break;
+					case kTfLiteInt8:
+						dst[i] = (output->data.int8[i] - output->params.zero_point) * output->params.scale;
+						break;
+					default:
+						cerr << GetName() << " : unsupported output type" << endl;
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+};
+#endif
+
+vector<unique_ptr<InferenceBackend>> CreateInferenceBackends(const filesystem::path& ModelBase)
+{
+	vector<unique_ptr<InferenceBackend>> candidates;
+	cout << "Listing available backends and targets" << endl;
+	for (auto &&backend : dnn::getAvailableBackends())
+	{
+		cout << "Backend " << backend.first << " is available with target " << backend.second << endl;
+		candidates.emplace_back(make_unique<OpenCVBackend>(backend.first, backend.second));
+	}
+	candidates.emplace_back(make_unique<OpenCVBackend>(dnn::DNN_BACKEND_OPENCV, dnn::DNN_TARGET_CPU, true));
+#ifdef WITH_CORAL
+	candidates.emplace_back(make_unique<TFLiteBackend>(false));
+	candidates.emplace_back(make_unique<TFLiteBackend>(true));
+#endif
+	vector<unique_ptr<InferenceBackend>> loaded;
+	for (auto &candidate : candidates)
+	{
+		if (candidate->Load(ModelBase))
+		{
+			loaded.emplace_back(move(candidate));
+		}
+	}
+	return loaded;
+}
+
+unique_ptr<InferenceBackend> SelectFastestBackend(vector<unique_ptr<InferenceBackend>> Backends, int Runs)
+{
+	unique_ptr<InferenceBackend> best;
+	double bestTime = INFINITY;
+	for (auto &backend : Backends)
+	{
+		double time = backend->Benchmark(Runs);
+		cout << "Inference backend " << backend->GetName() << " takes " << time*1000 << "ms/image" << endl;
+		if (time < bestTime)
+		{
+			bestTime = time;
+			best = move(backend);
+		}
+	}
+	if (best)
+	{
+		cout << "Using inference backend " << best->GetName() << endl;
+	}
+	else
+	{
+		cerr << "No inference backend available" << endl;
+	}
+	return best;
+}
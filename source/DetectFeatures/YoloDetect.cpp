@@ -3,20 +3,19 @@
 #include <iostream>
 #include <optional>
 #include <fstream>
+#include <sstream>
 #include <chrono>
 #include <array>
+#include <algorithm>
+#include <cmath>
 
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/dnn.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 
-#ifdef WITH_CORAL
-#include <edgetpu.h>
-#include <edgetpu_c.h>
-#include <tensorflow/lite/interpreter.h>
-#include <tensorflow/lite/interpreter_builder.h>
-#include <tensorflow/lite/op_resolver.h>
-#include <tensorflow/lite/core/kernels/register.h>
-#endif
+#include <DetectFeatures/InferenceBackend.hpp>
 
 #include <Misc/GlobalConf.hpp>
 #include <Misc/math3d.hpp>
@@ -24,14 +23,15 @@
 using namespace std;
 using namespace cv;
 
-const Size modelSize(640,480);
+//Table is 3m x 2m, with some margin for objects hanging over the edge
+static const Vec2d TableHalfSize(1.5+0.1, 1+0.1);
 
-YoloDetect::YoloDetect(string inModelName, int inNumclasses)
+YoloDetect::YoloDetect(string inModelName, int inNumclasses, const InferenceBackend* ReferenceBackend)
 	:ModelName(inModelName)
 {
 	ClassNames.resize(inNumclasses);
 	loadNames();
-	loadNet();
+	loadNet(ReferenceBackend);
 }
 
 YoloDetect::~YoloDetect()
@@ -45,89 +45,207 @@ filesystem::path YoloDetect::GetNetworkPath(string extension) const
 
 void YoloDetect::loadNames()
 {
+	//One class per line : name [height [footprint]], in meters
 	ifstream NamesFile(GetNetworkPath(".names"));
+	ClassShapes.resize(ClassNames.size());
 	for (size_t i = 0; i < ClassNames.size(); i++)
 	{
-		NamesFile >> ClassNames[i];
-		cout << "Yolo class " << i << " is " << ClassNames[i] << endl;
+		auto &shape = ClassShapes[i];
+		shape.Height = i >= 2 ? 0.06 : 0.04;
+		shape.Footprint = 0;
+		string line;
+		getline(NamesFile, line);
+		istringstream LineStream(line);
+		LineStream >> ClassNames[i];
+		LineStream >> shape.Height;
+		LineStream >> shape.Footprint;
+		cout << "Yolo class " << i << " is " << ClassNames[i] << ", height " << shape.Height << "m, footprint " << shape.Footprint << "m" << endl;
 	}
 }
 
-void YoloDetect::loadNet()
+void YoloDetect::loadNet(const InferenceBackend* ReferenceBackend)
 {
-	auto backends = dnn::getAvailableBackends();
-	cout << "Listing available backends and targets" << endl;
-	for (auto &&backend : backends)
+	if (ReferenceBackend)
+	{
+		Backend = ReferenceBackend->CreateSimilar();
+		if (!Backend->Load(GetNetworkPath()))
+		{
+			cerr << "Failed to load inference backend " << Backend->GetName() << endl;
+			Backend.reset();
+		}
+	}
+	else
 	{
-		cout << "Backend " << backend.first << " is available with target " << backend.second << endl;
+		//Every runtime that can load the model is benchmarked, the fastest one is kept
+		Backend = SelectFastestBackend(CreateInferenceBackends(GetNetworkPath()));
 	}
-	network = dnn::readNetFromDarknet(GetNetworkPath(".cfg"), GetNetworkPath(".weights"));
+	InputSize = Backend ? Backend->GetInputSize() : Size(640,480);
 }
 
-void YoloDetect::Preprocess(const UMat& frame, Size inpSize, float scale, const Scalar& mean, bool swapRB)
+void YoloDetect::Preprocess(const vector<UMat>& frames, float scale, const Scalar& mean, bool swapRB)
 {
-	Mat blob;
-	// Create a 4D blob from a frame.
-	if (inpSize.width <= 0) inpSize.width = frame.cols;
-	if (inpSize.height <= 0) inpSize.height = frame.rows;
-	dnn::blobFromImage(frame, blob, 1.0, inpSize, Scalar(), swapRB, false);
-	//cout << "Input has size " << blob.size << endl;
-	// Run a model.
-	network.setInput(blob, "", scale, mean);
+	// Create a normalised 4D blob from the frames, one image per batch index.
+	dnn::blobFromImages(frames, InputBlob, scale, InputSize, mean, swapRB, false);
+	//cout << "Input has size " << InputBlob.size << endl;
 }
 
 
-vector<YoloDetect::Detection> YoloDetect::Postprocess(const vector<Mat> &outputBlobs, const vector<string> &layerNames, Rect window)
+void YoloDetect::Candidates::Clear()
+{
+	Boxes.clear();
+	Scores.clear();
+	ClassIds.clear();
+	BottomCut.clear();
+}
+
+void YoloDetect::Postprocess(int BatchIndex, int BatchSize, Rect window, int FrameHeight, Candidates& Out) const
 {
-	vector<Rect> boxes;
-	vector<float> scores;
-	vector<vector<float>> classes;
-	int numclasses = ClassNames.size();
-	for (size_t blobidx = 0; blobidx < outputBlobs.size(); blobidx++)
+	const int numclasses = ClassNames.size();
+	const float threshold = ConfidenceThreshold;
+	//The frame edge is handled by Project, only the inner edges of the tiles can cut a box
+	const float CutLimit = window.y + window.height < FrameHeight ? window.y + window.height - 2 : INFINITY;
+	//x, y, width, height, confidence, classes...
+	auto AddCandidate = [&Out, &window, numclasses, threshold, CutLimit](const float* row)
+	{
+		if (row[4] <= threshold)
+		{
+			return;
+		}
+		const float* classes = row + 5;
+		int maxidx = 0;
+		for (int i = 1; i < numclasses; i++)
+		{
+			if (classes[i] > classes[maxidx])
+			{
+				maxidx = i;
+			}
+		}
+		float cx = row[0]*window.width+window.x;
+		float cy = row[1]*window.height+window.y;
+		float w = row[2]*window.width;
+		float h = row[3]*window.height;
+		Out.Boxes.emplace_back(cx-w/2, cy-h/2, w, h);
+		Out.Scores.push_back(row[4]);
+		Out.ClassIds.push_back(maxidx);
+		Out.BottomCut.push_back(cy+h/2 >= CutLimit);
+	};
+	for (size_t blobidx = 0; blobidx < OutputBlobs.size(); blobidx++)
 	{
-		auto& blob = outputBlobs[blobidx];
-		auto& layername = layerNames[blobidx];
-		(void) layername;
+		auto& blob = OutputBlobs[blobidx];
 		int numdet = 1;
 		for (int i = 0; i < blob.size.dims()-1; i++)
 		{
 			numdet*=blob.size[i];
 		}
-		int numelem = blob.size[blob.size.dims()-1];
-		assert(numelem == numclasses +4 +1); //x, y, width, height, confidence, classes...
-		//cout << "Layer " << layername << " has " << numdet << " detections and " << numelem << " elements/detection" << endl;
-		size_t newnum = boxes.size() + numdet;
-		boxes.reserve(newnum);
-		scores.reserve(newnum);
-		classes.reserve(newnum);
-		int stride = blob.elemSize1() * numelem;
-		assert(blob.elemSize1() == sizeof(float));
-		//cout << "stride is " << stride << " bytes/detection" << endl;
-		for (const uint8_t* ptr = blob.data; ptr < blob.dataend; ptr+=stride)
+		const int numelem = blob.size[blob.size.dims()-1];
+		assert(numelem == numclasses +4 +1);
+		assert(blob.depth() == CV_32F);
+		//Detections are stored image after image, whatever the number of dimensions of the output
+		assert(numdet % BatchSize == 0);
+		numdet /= BatchSize;
+		//cout << "Output " << blobidx << " has " << numdet << " detections and " << numelem << " elements/detection" << endl;
+		const float* rows = blob.ptr<float>() + (size_t)numelem*numdet*BatchIndex;
+		int detidx = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+		//Gather the objectness of several rows, and skip them all if none pass : most rows are empty
+		const int lanes = VTraits<v_float32>::vlanes();
+		int offsets[VTraits<v_float32>::max_nlanes];
+		for (int lane = 0; lane < lanes; lane++)
+		{
+			offsets[lane] = lane*numelem + 4;
+		}
+		const v_float32 vthreshold = vx_setall_f32(threshold);
+		for (; detidx <= numdet - lanes; detidx += lanes)
 		{
-			auto recast = reinterpret_cast<const float*>(ptr);
-			float cx = recast[0]*window.width+window.x;
-			float cy = recast[1]*window.height+window.y;
-			float w = recast[2]*window.width;
-			float h = recast[3]*window.height;
-			boxes.emplace_back(cx-w/2, cy-h/2, w, h);
-			scores.emplace_back(recast[4]);
-			auto& classesloc = classes.emplace_back();
-			classesloc.resize(numclasses);
-			copy(&recast[5], &recast[numelem], classesloc.data());
+			const float* block = rows + (size_t)detidx*numelem;
+			v_float32 objectness = v_lut(block, offsets);
+			if (!v_check_any(v_gt(objectness, vthreshold)))
+			{
+				continue;
+			}
+			for (int lane = 0; lane < lanes; lane++)
+			{
+				AddCandidate(block + lane*numelem);
+			}
+		}
+		vx_cleanup();
+#endif
+		for (; detidx < numdet; detidx++)
+		{
+			AddCandidate(rows + (size_t)detidx*numelem);
 		}
 	}
-	vector<int> keptIndices;
-	dnn::NMSBoxes(boxes, scores, 0.4, 0.5, keptIndices);
-	vector<Detection> OutDetections;
-	OutDetections.reserve(keptIndices.size());
-	for (int kept : keptIndices)
+}
+
+void YoloDetect::Suppress(const Candidates& In, vector<YoloDetection>& Out)
+{
+	KeptIndices.clear();
+	dnn::NMSBoxesBatched(In.Boxes, In.Scores, In.ClassIds, ConfidenceThreshold, NMSThreshold, KeptIndices);
+	Out.clear();
+	Out.reserve(KeptIndices.size());
+	for (int kept : KeptIndices)
 	{
-		OutDetections.emplace_back(boxes[kept], scores[kept], classes[kept]);
+		YoloDetection final_detection;
+		//cout << "Found " << In.ClassIds[kept] << " at " << In.Boxes[kept] << " (Confidence " << In.Scores[kept] << ")" << endl;
+		final_detection.Class = In.ClassIds[kept];
+		final_detection.Confidence = In.Scores[kept];
+		final_detection.Corners = In.Boxes[kept];
+		final_detection.BottomCut = In.BottomCut[kept];
+		Out.push_back(final_detection);
 	}
-	return OutDetections;
 }
 
+vector<Rect> YoloDetect::GetTiles(const vector<Rect>& Regions, Size FrameSize, double TileScale) const
+{
+	vector<Rect> tiles;
+	if (Regions.empty())
+	{
+		return tiles;
+	}
+	const double Overlap = 0.1; //so that objects on the border of a tile are fully seen in the next one
+	const Rect frame(Point(0,0), FrameSize);
+	const Size tileSize(min<int>(InputSize.width*TileScale, FrameSize.width), min<int>(InputSize.height*TileScale, FrameSize.height));
+	Rect bounds = Regions[0];
+	for (auto &region : Regions)
+	{
+		bounds |= region;
+	}
+	bounds &= frame;
+	//Start of the tiles along an axis, spread evenly over the bounds
+	auto GetStarts = [Overlap](int begin, int length, int tilelength, int framelength)
+	{
+		vector<int> starts;
+		if (length <= tilelength)
+		{
+			starts.push_back(clamp(begin + length/2 - tilelength/2, 0, framelength - tilelength));
+			return starts;
+		}
+		int count = ceil((length - tilelength) / (tilelength*(1-Overlap))) + 1;
+		for (int i = 0; i < count; i++)
+		{
+			starts.push_back(begin + (length - tilelength)*i/(count-1));
+		}
+		return starts;
+	};
+	auto xstarts = GetStarts(bounds.x, bounds.width, tileSize.width, FrameSize.width);
+	auto ystarts = GetStarts(bounds.y, bounds.height, tileSize.height, FrameSize.height);
+	for (int y : ystarts)
+	{
+		for (int x : xstarts)
+		{
+			Rect tile(Point(x,y), tileSize);
+			for (auto &region : Regions)
+			{
+				if ((tile & region).area() > 0)
+				{
+					tiles.push_back(tile);
+					break;
+				}
+			}
+		}
+	}
+	return tiles;
+}
 
 const string& YoloDetect::GetClassName(int index) const
 {
@@ -141,155 +259,131 @@ int YoloDetect::GetNumClasses() const
 
 int YoloDetect::Detect(CameraImageData InData, CameraFeatureData *OutData)
 {
-	Preprocess(InData.Image, modelSize, 1.0/255.0, 0, true);
+	vector<vector<YoloDetection>> detections(1);
+	swap(detections[0], OutData->YoloDetections);
+	int numdetections = DetectBatch({InData}, detections);
+	swap(detections[0], OutData->YoloDetections);
+	return numdetections;
+}
+
+int YoloDetect::DetectBatch(const vector<CameraImageData>& Frames, vector<vector<YoloDetection>>& Detections, 
+	const vector<vector<Rect>>& Tiles)
+{
+	int NumFrames = Frames.size();
+	Detections.resize(NumFrames);
+	InputFrames.clear();
+	InputWindows.clear();
+	for (int frameidx = 0; frameidx < NumFrames; frameidx++)
+	{
+		auto &image = Frames[frameidx].Image;
+		bool tiled = frameidx < (int)Tiles.size() && Tiles[frameidx].size() > 0;
+		if (!tiled)
+		{
+			InputFrames.push_back(image);
+			InputWindows.emplace_back(frameidx, Rect(0,0,image.cols, image.rows));
+			continue;
+		}
+		for (auto &tile : Tiles[frameidx])
+		{
+			InputFrames.emplace_back(image, tile); //no copy, ROI of the frame
+			InputWindows.emplace_back(frameidx, tile);
+		}
+	}
+	int BatchSize = InputFrames.size();
+	if (BatchSize == 0)
+	{
+		return 0;
+	}
+	Preprocess(InputFrames, 1.0/255.0, 0, true);
+	//Release the references to the camera images, the blob has been built
+	InputFrames.clear();
 	auto start = chrono::steady_clock::now();
-	vector<Mat> outputBlobs;
-	auto OutputNames = network.getUnconnectedOutLayersNames();
-	network.forward(outputBlobs, OutputNames);
+	if (!Backend || !Backend->Infer(InputBlob, OutputBlobs))
+	{
+		for (auto &OutDetections : Detections)
+		{
+			OutDetections.clear();
+		}
+		return 0;
+	}
 	auto stop = chrono::steady_clock::now();
-	auto detections = Postprocess(outputBlobs, OutputNames, Rect(0,0,InData.Image.cols, InData.Image.rows));
-	int numdetections = detections.size();
-	OutData->YoloDetections.clear();
-	OutData->YoloDetections.reserve(numdetections);
-	for (auto &det : detections)
+	int numdetections = 0;
+	//Inputs of a frame are contiguous, merge all the tiles of a frame before suppression
+	for (int batchidx = 0; batchidx < BatchSize;)
 	{
-		int maxidx = 0;
-		for (size_t i = 1; i < det.Classes.size(); i++)
+		int frameidx = InputWindows[batchidx].first;
+		FrameCandidates.Clear();
+		for (; batchidx < BatchSize && InputWindows[batchidx].first == frameidx; batchidx++)
 		{
-			if (det.Classes[i] > det.Classes[maxidx])
-			{
-				maxidx = i;
-			}
+			Postprocess(batchidx, BatchSize, InputWindows[batchidx].second, Frames[frameidx].Image.rows, FrameCandidates);
 		}
-		YoloDetection final_detection;
-		//cout << "Found " << maxidx << " at " << det.BoundingBox << " (Confidence " << det.Confidence << ")" << endl;
-		final_detection.Class = maxidx;
-		final_detection.Confidence = det.Confidence;
-		final_detection.Corners = det.BoundingBox;
-		OutData->YoloDetections.push_back(final_detection);
+		Suppress(FrameCandidates, Detections[frameidx]);
+		numdetections += Detections[frameidx].size();
 	}
 	(void) start; (void) stop;
-	//cout << "Inference took " << chrono::duration<double>(stop-start).count() << "s and found " << numdetections << " objects" << endl;
+	//cout << "Inference of " << BatchSize << " images took " << chrono::duration<double>(stop-start).count() << "s and found " << numdetections << " objects" << endl;
 	return numdetections;
 }
 
-static_assert(sizeof(Matx31d) == sizeof(Vec3d));
-vector<ObjectData> YoloDetect::Project(const CameraImageData &ImageData, const CameraFeatureData& FeatureData)
+void YoloDetect::Project(const CameraImageData &ImageData, CameraFeatureData& FeatureData) const
 {
-	vector<ObjectData> objects;
-	objects.reserve(FeatureData.YoloDetections.size());
-	const Matx33d InvCameraMatrix = Mat(ImageData.CameraMatrix.inv());
-	for (size_t i = 0; i < FeatureData.YoloDetections.size(); i++)
+	auto &detections = FeatureData.YoloDetections;
+	auto &projections = FeatureData.YoloProjections;
+	projections.clear();
+	const size_t numdetections = detections.size();
+	if (numdetections == 0)
 	{
-		auto &Detection = FeatureData.YoloDetections[i];
-		//auto ROI = ImageData.Image(Detection.Corners);
-		auto center = (Detection.Corners.tl() + Detection.Corners.br())/2.0;
-		Matx31d position = {center.x, center.y, 1};
-		Matx31d vector(InvCameraMatrix * position); //TODO: This doesn't take into account distortion coeffs
-		Matx31d WorldVector = FeatureData.CameraTransform.rotation() * vector;
-		double InterceptHeight = Detection.Class >= 2 ? 0.03 : 0.02;
-		Vec3d WorldPosition = LinePlaneIntersection(FeatureData.CameraTransform.translation(), 
-			*reinterpret_cast<Vec3d*>(&WorldVector), Vec3d(0,0,InterceptHeight), Vec3d(0,0,1));
-		WorldPosition[2] = 0;
-		ObjectType type = (ObjectType)((int)ObjectType::Fragile + Detection.Class);
-		const auto &name = GetClassName(Detection.Class);
-		ObjectData object(type, name, 
-			Affine3d(Vec3d::all(0), WorldPosition));
-		object.metadata["confidence"] = int(Detection.Confidence*100);
-		objects.emplace_back(object);
-		//imshow("Yolo ROI", ROI);
-		//waitKey(10);
-	}
-	return objects;
-}
-
-#ifdef WITH_CORAL
-namespace EdgeDNN
-{
-	bool EdgeLoaded = false, EdgeOK = false;
-	shared_ptr<edgetpu::EdgeTpuContext> context;
-	unique_ptr<tflite::FlatBufferModel> model;
-	unique_ptr<tflite::Interpreter> interpreter;
-
-	std::string ToString(edgetpu_device_type type) {
-		switch (type) {
-			case EDGETPU_APEX_PCI:
-			return "PCI";
-			case EDGETPU_APEX_USB:
-			return "USB";
-		}
-		return "Unknown";
+		return;
 	}
-
-	bool BuildEdgeTpuInterpreter() {
-		tflite::ops::builtin::BuiltinOpResolver resolver;
-		resolver.AddCustom(edgetpu::kCustomOp, edgetpu::RegisterCustomOp());
-		auto builder = tflite::InterpreterBuilder(*model, resolver);
-		if (builder(&interpreter) != kTfLiteOk) {
-			std::cerr << "Failed to build interpreter." << std::endl;
-			return false;
-		}
-		// Bind given context with interpreter.
-		interpreter->SetExternalContext(TfLiteExternalContextType::kTfLiteEdgeTpuContext, (TfLiteExternalContext*) context.get());
-		interpreter->SetNumThreads(1);
-		if (interpreter->AllocateTensors() != kTfLiteOk) {
-			std::cerr << "Failed to allocate tensors." << std::endl;
-			return false;
-		}
-		return true;
+	projections.reserve(numdetections);
+	//Bottom centre then top centre of each box, all undistorted at once
+	thread_local vector<Point2f> ImagePoints, NormalizedPoints;
+	ImagePoints.resize(numdetections*2);
+	for (size_t i = 0; i < numdetections; i++)
+	{
+		const auto &box = detections[i].Corners;
+		float cx = box.x + box.width/2;
+		ImagePoints[i*2] = Point2f(cx, box.y + box.height);
+		ImagePoints[i*2+1] = Point2f(cx, box.y);
 	}
-
-	bool LoadNet()
+	undistortPoints(ImagePoints, NormalizedPoints, FeatureData.CameraMatrix, 
+		ImageData.Distorted ? FeatureData.DistanceCoefficients : noArray());
+	const Matx33d CameraRotation = FeatureData.CameraTransform.rotation();
+	const Vec3d CameraPosition = FeatureData.CameraTransform.translation();
+	const float BottomLimit = FeatureData.FrameSize.height - 2;
+	for (size_t i = 0; i < numdetections; i++)
 	{
-		if (EdgeLoaded)
+		const auto &Detection = detections[i];
+		const auto &shape = ClassShapes[Detection.Class];
+		bool BottomVisible = Detection.Corners.y + Detection.Corners.height < BottomLimit && !Detection.BottomCut;
+		const Point2f &normalized = NormalizedPoints[i*2 + (BottomVisible ? 0 : 1)];
+		Vec3d ray = CameraRotation * Vec3d(normalized.x, normalized.y, 1);
+		double PlaneHeight = BottomVisible ? 0 : shape.Height;
+		if (abs(ray[2]) < 1e-9)
 		{
-			return EdgeOK;
+			continue;
 		}
-		EdgeLoaded = true;
-
-		if(1)
+		double distance = (PlaneHeight - CameraPosition[2]) / ray[2];
+		if (distance <= 0) //above the horizon
 		{
-			size_t num_edges = 0;
-			std::unique_ptr<edgetpu_device, decltype(&edgetpu_free_devices)> devices(edgetpu_list_devices(&num_edges), &edgetpu_free_devices);
-			for (size_t i = 0; i < num_edges; i++)
-			{
-				auto device = devices.get()[i];
-				cout << "Found Coral @" << device.path << " over " << ToString(device.type) << endl;
-			}
+			continue;
 		}
-		
-		auto manager = edgetpu::EdgeTpuManager::GetSingleton();
-		if (manager == nullptr)
+		Vec3d hit = CameraPosition + ray*distance;
+		//The bottom is the near edge of the object, the top is the far edge : move to the centre
+		Vec2d horizontal(ray[0], ray[1]);
+		double horizontalNorm = norm(horizontal);
+		Vec2d offset = horizontalNorm > 1e-9 ? horizontal * (shape.Footprint/2/horizontalNorm) : Vec2d::all(0);
+		Vec2d position = Vec2d(hit[0], hit[1]) + (BottomVisible ? offset : -offset);
+		//Grazing rays land far away (or not at all) : only keep what can be on the table
+		if (!(abs(position[0]) < TableHalfSize[0] && abs(position[1]) < TableHalfSize[1]))
 		{
-			cerr << "Failed to open EdgeTPU Manager" << endl;
-			return false;
+			continue;
 		}
-		manager->SetVerbosity(1);
-
-		context = manager->OpenDevice();
-		if (context == nullptr)
-		{
-			cerr << "Failed to open EdgeTPU Device" << endl;
-			return false;
-		}
-		
-		const auto model_path = GetAssetsPath() / "dnn" / "edgetpu.tflite";
-		model = tflite::FlatBufferModel::BuildFromFile(model_path.c_str());
-		if (model == nullptr)
-		{
-			cerr << "Failed to load model for Coral" << endl;
-			return false;
-		}
-		
-
-		if(!BuildEdgeTpuInterpreter())
-		{
-			cerr << "Failed to build EdgeTPU interpreter" << endl;
-			return false;
-		}
-		EdgeOK = true;
-		return true;
+		YoloProjection projection;
+		projection.Position = position;
+		projection.Class = Detection.Class;
+		projection.Confidence = Detection.Confidence;
+		projection.Name = &ClassNames[Detection.Class];
+		projections.push_back(projection);
 	}
-
-} // namespace EdgeDNN
-#endif
+}
@@ -0,0 +1,142 @@
+#include "DetectFeatures/YoloInferenceService.hpp"
+
+#include <iostream>
+
+#include <DetectFeatures/YoloDetect.hpp>
+
+using namespace std;
+using namespace cv;
+
+YoloInferenceService::YoloInferenceService(string ModelName, int NumClasses, int NumWorkers, int InMaxBatchSize)
+	:MaxBatchSize(max(InMaxBatchSize, 1))
+{
+	Workers.resize(max(NumWorkers, 1));
+	//Backends are benchmarked once, the other workers use the one the first picked
+	Workers[0].Detector = make_unique<YoloDetect>(ModelName, NumClasses);
+	for (size_t i = 1; i < Workers.size(); i++)
+	{
+		Workers[i].Detector = make_unique<YoloDetect>(ModelName, NumClasses, Workers[0].Detector->GetBackend());
+	}
+	for (auto &worker : Workers)
+	{
+		worker.Thread = thread(&YoloInferenceService::WorkerEntryPoint, this, worker.Detector.get());
+	}
+	cout << "Yolo inference running on " << Workers.size() << " thread(s)" << endl;
+}
+
+YoloInferenceService::~YoloInferenceService()
+{
+	{
+		lock_guard lock(Mutex);
+		Stopping = true;
+	}
+	WorkAvailable.notify_all();
+	for (auto &worker : Workers)
+	{
+		if (worker.Thread.joinable())
+		{
+			worker.Thread.join();
+		}
+	}
+}
+
+void YoloInferenceService::Submit(const CameraImageData& Frame, const vector<Rect>& Tiles)
+{
+	{
+		lock_guard lock(Mutex);
+		CameraSlot &slot = Slots[Frame.CameraName];
+		slot.Pending = Frame;
+		slot.PendingTiles = Tiles;
+		slot.HasPending = true;
+	}
+	WorkAvailable.notify_one();
+}
+
+bool YoloInferenceService::GetLatest(const string& CameraName, vector<YoloDetection>& Detections, TimePoint& GrabTime) const
+{
+	lock_guard lock(Mutex);
+	auto found = Slots.find(CameraName);
+	if (found == Slots.end() || found->second.GrabTime == TimePoint())
+	{
+		return false;
+	}
+	Detections = found->second.Detections;
+	GrabTime = found->second.GrabTime;
+	return true;
+}
+
+const YoloDetect& YoloInferenceService::GetDetector() const
+{
+	return *Workers[0].Detector;
+}
+
+void YoloInferenceService::WorkerEntryPoint(YoloDetect* Detector)
+{
+	vector<CameraSlot*> batch;
+	vector<CameraImageData> frames;
+	vector<vector<Rect>> tiles;
+	vector<vector<YoloDetection>> results;
+	unique_lock lock(Mutex);
+	while (true)
+	{
+		//Take the pending frames of all the cameras no other worker is busy with, so that results of a camera stay in order
+		WorkAvailable.wait(lock, [this]()
+		{
+			if (Stopping)
+			{
+				return true;
+			}
+			for (auto &[name, slot] : Slots)
+			{
+				if (slot.HasPending && !slot.Busy)
+				{
+					return true;
+				}
+			}
+			return false;
+		});
+		if (Stopping)
+		{
+			return;
+		}
+		batch.clear();
+		frames.clear();
+		tiles.clear();
+		for (auto &[name, slot] : Slots)
+		{
+			if (!slot.HasPending || slot.Busy || (int)batch.size() >= MaxBatchSize)
+			{
+				continue;
+			}
+			frames.emplace_back(move(slot.Pending));
+			tiles.emplace_back(move(slot.PendingTiles));
+			slot.PendingTiles.clear();
+			slot.Pending = CameraImageData();
+			slot.HasPending = false;
+			slot.Busy = true;
+			batch.push_back(&slot);
+		}
+		lock.unlock();
+
+		//All the cameras go through the network at once
+		Detector->DetectBatch(frames, results, tiles);
+
+		lock.lock();
+		//map nodes are stable, the slots are still valid
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			CameraSlot &slot = *batch[i];
+			slot.Busy = false;
+			if (frames[i].GrabTime > slot.GrabTime)
+			{
+				swap(slot.Detections, results[i]);
+				slot.GrabTime = frames[i].GrabTime;
+			}
+			if (slot.HasPending)
+			{
+				WorkAvailable.notify_one();
+			}
+		}
+		frames.clear(); //don't keep the images alive while waiting
+	}
+}
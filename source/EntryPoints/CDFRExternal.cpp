@@ -8,6 +8,7 @@
 #include <Cameras/Calibfile.hpp>
 #include <DetectFeatures/ArucoDetect.hpp>
 #include <DetectFeatures/YoloDetect.hpp>
+#include <DetectFeatures/YoloInferenceService.hpp>
 
 #include <Visualisation/BoardGL.hpp>
 #include <Visualisation/ImguiWindow.hpp>
@@ -22,9 +23,6 @@
 #include <Cameras/CameraManagerSimulation.hpp>
 #include <Cameras/VideoCaptureCamera.hpp>
 
-#include <PostProcessing/YoloDeflicker.hpp>
-#include <PostProcessing/StockPlants.hpp>
-#include <PostProcessing/Jardinieres.hpp>
 
 #include <thread>
 #include <memory>
@@ -35,7 +33,6 @@
 CDFRExternal::CDFRExternal()
 {
 
-	assert(ObjData.size() == FeatureData.size());
 	assert(FeatureData.size() > 0);
 
 	CDFRCommon::MakeTrackedObjects(false, 
@@ -118,12 +115,34 @@ CDFRTeam CDFRExternal::GetTeam()
 	return Team;
 }
 
+void CDFRExternal::GetYoloRegionsOfInterest(vector<vector<Point3d>> &Regions) const
+{
+	//Playable area of the table, up to the height of the plants
+	const double TableHalfWidth = 1.5, TableHalfHeight = 1, ObjectHeight = 0.1;
+	auto &table = Regions.emplace_back();
+	for (int corneridx = 0; corneridx < 4; corneridx++)
+	{
+		double x = corneridx%2 ? TableHalfWidth : -TableHalfWidth;
+		double y = corneridx/2 ? TableHalfHeight : -TableHalfHeight;
+		table.emplace_back(x, y, 0);
+		table.emplace_back(x, y, ObjectHeight);
+	}
+	PostProcesses.GetRegionsOfInterest(Regions);
+}
+
+void CDFRExternal::AddTickListener(function<void()> Listener)
+{
+	lock_guard lock(TickListenersMutex);
+	TickListeners.push_back(Listener);
+}
+
 using ExternalProfType = ManualProfiler<false>;
 
 void CDFRExternal::ThreadEntryPoint()
 {
 	ExternalProfType prof("External Global Profile");
 	ExternalProfType ParallelProfiler("Parallel Cameras Detail");
+	ExternalProfType PostProcessProfiler("Post Processes Detail");
 	
 	if (GetScenario().size())
 	{
@@ -136,11 +155,12 @@ void CDFRExternal::ThreadEntryPoint()
 		CameraMan = make_unique<CameraManagerV4L2>(GetCaptureMethod(), GetCaptureConfig().filter, false);
 	}
 
-	YoloDetector = make_unique<YoloDetect>("cdfr", 4);
+	YoloService = make_unique<YoloInferenceService>("cdfr", 4);
 
-	PostProcesses.emplace_back(make_unique<PostProcessYoloDeflicker>(this));
-	PostProcesses.emplace_back(make_unique<PostProcessStockPlants>(this));
-	PostProcesses.emplace_back(make_unique<PostProcessJardinieres>(this));
+	for (auto &name : GetPostProcessNames())
+	{
+		PostProcesses.Add(name, this);
+	}
 
 	//display/debug section
 	FrameCounter fps;
@@ -302,6 +322,11 @@ void CDFRExternal::ThreadEntryPoint()
 		ImageDataLocal.resize(NumCams);
 		FeatureDataLocal.resize(NumCams);
 		ParallelProfilers.resize(NumCams);
+		vector<vector<Point3d>> YoloRegions;
+		if (CDFRCommon::ExternalSettings.YoloDetection && CDFRCommon::ExternalSettings.YoloTiled)
+		{
+			GetYoloRegionsOfInterest(YoloRegions);
+		}
 		prof.EnterSection("Parallel Cameras");
 
 		//grab frames
@@ -345,7 +370,27 @@ void CDFRExternal::ThreadEntryPoint()
 					//imwrite("noised.jpg", ImData.Image);
 					break;
 				}
-				CDFRCommon::ImageToFeatureData(CDFRCommon::ExternalSettings, cam, ImData, FeatData, *TrackerToUse, GrabTick, YoloDetector.get());
+				CDFRCommon::ImageToFeatureData(CDFRCommon::ExternalSettings, cam, ImData, FeatData, *TrackerToUse, GrabTick);
+				//Yolo runs asynchronously : the frame is queued, and the latest finished detections of this camera are used
+				bool doYolo = CDFRCommon::ExternalSettings.YoloDetection;
+				if (doYolo)
+				{
+					thisprof.EnterSection("Yolo Submit");
+					vector<Rect> YoloTiles;
+					if (YoloRegions.size() > 0)
+					{
+						auto RegionRects = GetPOIRects(YoloRegions, ImData.Image.size(), FeatData.CameraTransform, 
+							ImData.CameraMatrix, ImData.DistanceCoefficients);
+						YoloTiles = YoloService->GetDetector().GetTiles(RegionRects, ImData.Image.size(), YoloTileScale);
+					}
+					YoloService->Submit(ImData, YoloTiles);
+					thisprof.EnterSection("Yolo Gather");
+					if (!YoloService->GetLatest(ImData.CameraName, FeatData.YoloDetections, FeatData.YoloGrabTime) 
+						|| GrabTick - FeatData.YoloGrabTime > YoloMaxAge)
+					{
+						FeatData.YoloDetections.clear();
+					}
+				}
 
 				if (RecordThisTick)
 				{
@@ -365,23 +410,36 @@ void CDFRExternal::ThreadEntryPoint()
 
 		prof.EnterSection("3D Solve");
 		TrackerToUse->SolveLocationsPerObject(FeatureDataLocal, GrabTick);
-		vector<ObjectData> &ObjDataLocal = ObjData[BufferIndex]; 
+		vector<ObjectData> &ObjDataLocal = ObjData; 
 		ObjDataLocal = TrackerToUse->GetObjectDataVector(GrabTick);
+		//Yolo detections are placed on the table, then turned into objects by the deflicker
 		for (size_t camidx = 0; camidx < Cameras.size(); camidx++)
 		{
-			auto YoloObjects = YoloDetector->Project(ImageDataLocal[camidx], FeatureDataLocal[camidx]);
-			ObjDataLocal.insert(ObjDataLocal.end(), YoloObjects.begin(), YoloObjects.end());
+			YoloService->GetDetector().Project(ImageDataLocal[camidx], FeatureDataLocal[camidx]);
 		}
 
-		for (auto &i : PostProcesses)
-		{
-			i->Process(ImageDataLocal, FeatureDataLocal, ObjDataLocal);
-		}
+		prof.EnterSection("Post Processing");
+		PostProcesses.Run(ImageDataLocal, FeatureDataLocal, ObjDataLocal, WorkingIndex);
+		PostProcesses.GatherProfile(PostProcessProfiler);
+
+		prof.EnterSection("Publish");
+		shared_ptr<ObjectSnapshot> Snapshot = SnapshotPool.Acquire();
+		Snapshot->CaptureTime = GrabTick;
+		Snapshot->Add(ObjDataLocal);
+		Snapshot->BuildIndex();
+		atomic_store(&LatestSnapshot, shared_ptr<const ObjectSnapshot>(Snapshot));
 		
 		
 
 
-		BufferIndex = (BufferIndex+1)%ObjData.size();
+		BufferIndex = (BufferIndex+1)%FeatureData.size();
+		{
+			lock_guard lock(TickListenersMutex);
+			for (auto &listener : TickListeners)
+			{
+				listener();
+			}
+		}
 		if (RecordThisTick)
 		{
 			RecordImageIndex++;
@@ -406,7 +464,7 @@ void CDFRExternal::ThreadEntryPoint()
 			}
 			else
 			{
-				if(!OpenGLBoard->Tick(ObjectData::ToGLObjects(ObjDataLocal)))
+				if(!OpenGLBoard->Tick(Snapshot->ToGLObjects()))
 				{
 					killed = true;
 					cout << "3D visualizer closed, shutting down..." << endl;
@@ -440,6 +498,7 @@ void CDFRExternal::ThreadEntryPoint()
 			cout << fps.GetFPSString(deltaTime) << endl;
 			prof.PrintProfile();
 			ParallelProfiler.PrintProfile();
+			PostProcessProfiler.PrintProfile();
 		}
 	}
 }
@@ -459,9 +518,19 @@ std::vector<CameraFeatureData> CDFRExternal::GetFeatureData() const
 	return FeatureData[GetReadBufferIndex()];
 }
 
+shared_ptr<const ObjectSnapshot> CDFRExternal::GetObjectSnapshot() const
+{
+	auto Snapshot = atomic_load(&LatestSnapshot);
+	if (!Snapshot)
+	{
+		return make_shared<const ObjectSnapshot>();
+	}
+	return Snapshot;
+}
+
 std::vector<ObjectData> CDFRExternal::GetObjectData() const
 {
-	return ObjData[GetReadBufferIndex()];
+	return GetObjectSnapshot()->ToObjectData();
 }
 
 void CDFRExternal::Open3DVisualizer()
@@ -22,11 +22,13 @@ bool RecordVideo = false;
 
 
 KeepAliveSettings KeepAliveConfig = {30, 3*60}; //Delay between messages, Delay before kick when no response
+JsonHostSettings JsonHostConfig = {1<<16, 1.0, 1<<20, 32<<20}; //Max query size, Delay between action logs, Send queue limits
 
 //Default values
 CaptureConfig CaptureCfg = {(int)CameraStartType::ANY, Size(3840,3032), 1.f, 30, 1, ""};
 vector<InternalCameraConfig> CamerasInternal;
 CalibrationConfig CamCalConf = {40, Size(6,4), 0.5, 1.5, Size2d(4.96, 3.72)};
+vector<string> PostProcessNames = {"YoloDeflicker", "StockPlants", "Jardinieres"};
 
 template<class dataType, class accessorType>
 void CopyOrDefaultRef(nlohmann::json &owner, accessorType accessor, dataType &value)
@@ -119,6 +121,16 @@ void InitConfig()
 		CopyOrDefaultRef(KeepAliveSett, "Delay to kick", KeepAliveConfig.kick_delay);
 	}
 
+	nlohmann::json& JsonHostSett = CopyOrDefaultJson(configobj, "JsonHost");
+	{
+		CopyOrDefaultRef(JsonHostSett, "MaxFrameSize", JsonHostConfig.MaxFrameSize);
+		CopyOrDefaultRef(JsonHostSett, "ActionLogInterval", JsonHostConfig.ActionLogInterval);
+		CopyOrDefaultRef(JsonHostSett, "SendHighWaterMark", JsonHostConfig.SendHighWaterMark);
+		CopyOrDefaultRef(JsonHostSett, "MaxQueuedBytes", JsonHostConfig.MaxQueuedBytes);
+	}
+
+	CopyOrDefaultRef(configobj, "PostProcesses", PostProcessNames);
+
 	try
 	{
 		ofstream file(filepath);
@@ -201,6 +213,18 @@ KeepAliveSettings GetKeepAliveSettings()
 	return KeepAliveConfig;
 }
 
+JsonHostSettings GetJsonHostSettings()
+{
+	InitConfig();
+	return JsonHostConfig;
+}
+
+const vector<string>& GetPostProcessNames()
+{
+	InitConfig();
+	return PostProcessNames;
+}
+
 Size GetArucoReduction()
 {
 	Size reduction;
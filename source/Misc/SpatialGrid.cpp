@@ -0,0 +1,61 @@
+#include "Misc/SpatialGrid.hpp"
+
+using namespace std;
+using namespace cv;
+
+SpatialGrid::SpatialGrid(Vec2d Min, Vec2d Max, double InCellSize)
+	:Origin(Min), CellSize(InCellSize)
+{
+	Width = max<int>(ceil((Max[0] - Min[0]) / CellSize), 1);
+	Height = max<int>(ceil((Max[1] - Min[1]) / CellSize), 1);
+	Cells.resize(Width*Height);
+}
+
+void SpatialGrid::Clear()
+{
+	for (int cell : UsedCells)
+	{
+		Cells[cell].clear();
+	}
+	UsedCells.clear();
+}
+
+void SpatialGrid::Insert(int Item, Vec2d Position)
+{
+	int cell = GetCellIndex(Position);
+	if (cell < 0)
+	{
+		return;
+	}
+	if (Cells[cell].empty())
+	{
+		UsedCells.push_back(cell);
+	}
+	Cells[cell].push_back(Item);
+}
+
+void SpatialGrid::Remove(int Item, Vec2d Position)
+{
+	int index = GetCellIndex(Position);
+	if (index < 0)
+	{
+		return;
+	}
+	auto &cell = Cells[index];
+	auto found = find(cell.begin(), cell.end(), Item);
+	if (found != cell.end())
+	{
+		*found = cell.back();
+		cell.pop_back();
+	}
+}
+
+void SpatialGrid::Move(int Item, Vec2d From, Vec2d To)
+{
+	if (GetCellIndex(From) == GetCellIndex(To))
+	{
+		return;
+	}
+	Remove(Item, From);
+	Insert(Item, To);
+}
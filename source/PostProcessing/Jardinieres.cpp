@@ -2,15 +2,21 @@
 #include <EntryPoints/CDFRExternal.hpp>
 #include <opencv2/calib3d.hpp>
 #include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
 
 #include <iostream>
+#include <cmath>
 
 using namespace std;
 using namespace cv;
 
 PostProcessJardinieres::PostProcessJardinieres(CDFRExternal* InOwner)
-	:PostProcess(InOwner)
+	:PostProcess(InOwner), SlotSize(65,30)
 {
+	Reads = {ObjectType::Robot};
+	Writes = {ObjectType::Jardiniere};
+	DilationKernel = getStructuringElement(MORPH_ELLIPSE, Size(DilationAmount*2+1,DilationAmount*2+1), Point(DilationAmount,DilationAmount));
+	ErosionKernel = getStructuringElement(MORPH_ELLIPSE, Size(ErosionAmount*2+1,ErosionAmount*2+1), Point(ErosionAmount,ErosionAmount));
 	array<string, 6> names = {"Jaune Milieu", "Bleu Sud", "Bleu Milieu", "Jaune Sud", "Jaune Nord", "Bleu Nord"};
 	size_t stockidx;
 	for (size_t stockidx = 0; stockidx < Stocks.size(); stockidx++)
@@ -72,90 +78,148 @@ PostProcessJardinieres::PostProcessJardinieres(CDFRExternal* InOwner)
 	}
 }
 
-void PostProcessJardinieres::Process(std::vector<CameraImageData> &ImageData, std::vector<CameraFeatureData> &FeatureData, std::vector<ObjectData> &Objects)
+void PostProcessJardinieres::Process(const std::vector<CameraImageData> &ImageData, const std::vector<CameraFeatureData> &FeatureData, const std::vector<ObjectData> &Objects, std::vector<ObjectData> &Output)
 {
-	(void) ImageData;
+	(void) Objects;
 	if (FeatureData.size() == 0)
 	{
 		return;
 	}
-	assert(FeatureData.size() == 1);
-	for (auto &zone : Stocks)
+	vector<Vec2f> AffineTarget{{0,0}, {0, (float)SlotSize.height}, Vec2f(SlotSize.width, SlotSize.height)};
+	const int SlotStride = SlotSize.height + 2*SlotPadding;
+
+	//Which cameras see which planters
+	Slots.clear();
+	ObjectData::TimePoint TickTime;
+	vector<Mat> AffineMatrices;
+	vector<int> SlotCameras;
+	for (size_t camidx = 0; camidx < FeatureData.size() && camidx < ImageData.size(); camidx++)
 	{
-		zone.NumPlants = 0;
+		const auto &ThisImageData = ImageData[camidx];
+		const auto &ThisFeatureData = FeatureData[camidx];
+		if (ThisImageData.Image.empty())
+		{
+			continue;
+		}
+		TickTime = max(TickTime, ThisImageData.GrabTime);
+		const auto InvCameraMatrix = ThisFeatureData.CameraTransform.inv();
+		const Vec3d CameraPosition = ThisFeatureData.CameraTransform.translation();
+		const Rect ImageRect(Point(0,0), ThisImageData.Image.size());
+		for (size_t zoneidx = 0; zoneidx < Stocks.size(); zoneidx++)
+		{
+			auto &zone = Stocks[zoneidx];
+			Vec3d center = (zone.Corners[0] + zone.Corners[2])/2;
+			Vec3d view = center - CameraPosition;
+			if ((InvCameraMatrix * center)[2] <= 0) //behind the camera
+			{
+				continue;
+			}
+			vector<Vec2d> ImagePointsDouble;
+			projectPoints(zone.Corners, InvCameraMatrix.rvec(), InvCameraMatrix.translation(), 
+				ThisFeatureData.CameraMatrix, ThisFeatureData.DistanceCoefficients, ImagePointsDouble);
+			bool inside = true;
+			for (auto &point : ImagePointsDouble)
+			{
+				inside &= ImageRect.contains(Point2d(point));
+			}
+			if (!inside)
+			{
+				continue;
+			}
+			vector<Vec2f> ImagePoints(ImagePointsDouble.begin(), ImagePointsDouble.end()-1);
+			StripSlot slot;
+			slot.ZoneIdx = zoneidx;
+			slot.Weight = abs(view[2]) / norm(view); //sine of the elevation angle
+			slot.ROI = Rect(0, Slots.size()*SlotStride + SlotPadding, SlotSize.width, SlotSize.height);
+			Slots.push_back(slot);
+			AffineMatrices.push_back(getAffineTransform(ImagePoints, AffineTarget));
+			SlotCameras.push_back(camidx);
+		}
 	}
-	const auto &ThisImageData = ImageData[0];
-	const auto &ThisFeatureData = FeatureData[0];
-	const auto InvCameraMatrix = ThisFeatureData.CameraTransform.inv();
-	Size WantedImageSize(65,30);
-	vector<Vec2f> AffineTarget{{0,0}, {0, (float)WantedImageSize.height}, Vec2f(WantedImageSize.width, WantedImageSize.height)};
-	int adaptive_threshold_size = 5;
-	int dilation_amount = adaptive_threshold_size/2, erosion_amount=dilation_amount+1;
-	Mat dilation_kernel = getStructuringElement(MORPH_ELLIPSE, Size(dilation_amount*2+1,dilation_amount*2+1), Point(dilation_amount,dilation_amount));
-	Mat erosion_kernel = getStructuringElement(MORPH_ELLIPSE, Size(erosion_amount*2+1,erosion_amount*2+1), Point(erosion_amount,erosion_amount));
-	vector<ObjectData> EnemyRobots = GetEnemyRobots(Objects);
-	
-	for (auto &zone : Stocks)
+
+	//Warp everything into the strip
+	Strip.create(max<int>(Slots.size(), 1)*SlotStride, SlotSize.width, CV_8UC3);
+	for (size_t slotidx = 0; slotidx < Slots.size(); slotidx++)
+	{
+		const Rect &roi = Slots[slotidx].ROI;
+		Mat dst = Strip(roi); //preallocated, so warpAffine writes in place
+		warpAffine(ImageData[SlotCameras[slotidx]].Image, dst, AffineMatrices[slotidx], SlotSize);
+		for (int pad = 1; pad <= SlotPadding; pad++)
+		{
+			Strip.row(roi.y).copyTo(Strip.row(roi.y - pad));
+			Strip.row(roi.y + roi.height - 1).copyTo(Strip.row(roi.y + roi.height - 1 + pad));
+		}
+	}
+
+	//Fused per pixel pass : colour mask (green, not blue, not red) and HSV value
+	StripValue.create(Strip.size(), CV_8UC1);
+	StripColour.create(Strip.size(), CV_8UC1);
+	for (int y = 0; y < Strip.rows; y++)
+	{
+		const Vec3b* bgr = Strip.ptr<Vec3b>(y);
+		uint8_t* value = StripValue.ptr<uint8_t>(y);
+		uint8_t* colour = StripColour.ptr<uint8_t>(y);
+		for (int x = 0; x < Strip.cols; x++)
+		{
+			uint8_t b = bgr[x][0], g = bgr[x][1], r = bgr[x][2];
+			value[x] = max(b, max(g, r));
+			colour[x] = (g > 32 && b <= 128 && r <= 128) ? 255 : 0;
+		}
+	}
+	adaptiveThreshold(StripValue, StripAdaptive, 255, ADAPTIVE_THRESH_GAUSSIAN_C, THRESH_BINARY_INV, AdaptiveBlockSize, 10);
+	dilate(StripAdaptive, StripDilated, DilationKernel);
+	erode(StripDilated, StripEroded, ErosionKernel);
+
+	//Count per slot, then fuse the cameras
+	WeightedPixels.fill(0);
+	TotalWeight.fill(0);
+	for (auto &slot : Slots)
 	{
-		vector<Vec2d> ImagePointsDouble;
-		projectPoints(zone.Corners, InvCameraMatrix.rvec(), InvCameraMatrix.translation(), 
-			ThisFeatureData.CameraMatrix, ThisFeatureData.DistanceCoefficients, ImagePointsDouble);
-		vector<Vec2f> ImagePoints(ImagePointsDouble.begin(), ImagePointsDouble.end()-1);
-		
-		Mat WarpedImage, HSV; vector<Mat> BGRComponents, HSVComponents;
-		Mat AffineMatrix = getAffineTransform(ImagePoints, AffineTarget);
-		warpAffine(ThisImageData.Image, WarpedImage, AffineMatrix, WantedImageSize);
-		split(WarpedImage, BGRComponents);
-		cvtColor(WarpedImage, HSV, COLOR_BGR2HSV);
-		split(WarpedImage, HSVComponents);
-		Mat mask, green, notblue, notred, adaptive_value, adaptive_dilated, adaptive_eroded, saturated;
-		threshold(BGRComponents[1], green, 32, 255, THRESH_BINARY);
-		threshold(BGRComponents[0], notblue, 128, 255, THRESH_BINARY_INV);
-		threshold(BGRComponents[2], notred, 128, 255, THRESH_BINARY_INV);
-		adaptiveThreshold(HSVComponents[2], adaptive_value, 255, ADAPTIVE_THRESH_GAUSSIAN_C, THRESH_BINARY_INV, 3, 10);
-		dilate(adaptive_value, adaptive_dilated, dilation_kernel);
-		erode(adaptive_dilated, adaptive_eroded, erosion_kernel);
-		threshold(HSVComponents[1], saturated, 32, 255, THRESH_BINARY);
-		mask = green & notblue & notred & adaptive_eroded;
-		/*if (zone.name == "Bleu Sud")
+		int NumWhitePixels = 0;
+		for (int y = slot.ROI.y; y < slot.ROI.y + slot.ROI.height; y++)
 		{
-			Mat concat;
-			vector<Mat> masks{green, notblue, notred, adaptive_value, adaptive_dilated, adaptive_eroded, saturated, mask};
-			vconcat(masks, concat);
-			cvtColor(concat, concat, COLOR_GRAY2BGR);
-			masks = {WarpedImage, concat};
-			vconcat(masks, concat);
-			imshow(zone.name, concat);
-		}*/
-		int NumWhitePixels = countNonZero(mask);
-		zone.NumPlants = NumWhitePixels * 12 / WantedImageSize.area();
+			const uint8_t* colour = StripColour.ptr<uint8_t>(y);
+			const uint8_t* eroded = StripEroded.ptr<uint8_t>(y);
+			for (int x = 0; x < slot.ROI.width; x++)
+			{
+				NumWhitePixels += (colour[x] & eroded[x]) != 0;
+			}
+		}
+		WeightedPixels[slot.ZoneIdx] += NumWhitePixels * slot.Weight;
+		TotalWeight[slot.ZoneIdx] += slot.Weight;
+	}
+
+	const CDFRTeam EnemyTeam = GetOtherTeam(Owner->GetTeam());
+	const ObjectIndex &index = GetIndex();
+	for (size_t zoneidx = 0; zoneidx < Stocks.size(); zoneidx++)
+	{
+		auto &zone = Stocks[zoneidx];
+		int NumWhitePixels = TotalWeight[zoneidx] > 0 ? (int)round(WeightedPixels[zoneidx] / TotalWeight[zoneidx]) : 0;
+		zone.NumPlants = NumWhitePixels * 12 / SlotSize.area();
 		//cout << zone.NumPlants << " plants in " << zone.name << endl;
 
 		//track enemy robot contact
 		zone.ContactThisTick = false;
-		for (auto &obj : EnemyRobots)
+		index.QueryRadius(ObjectType::Robot, zone.BuzzingPoint, zone.BuzzingRadius, [&zone, EnemyTeam](const ObjectIndex::Entry& entry)
 		{
-			auto pos = obj.GetPos2D();
-			auto delta = pos-zone.BuzzingPoint;
-			double distance = sqrt(delta.ddot(delta));
-			bool contact = distance < zone.BuzzingRadius;
-			if (contact)
+			if (entry.Team != EnemyTeam)
 			{
-				if (!zone.Contacting)
-				{
-					zone.LastContactStart = obj.LastSeen;
-				}
-				zone.ContactThisTick = true;
+				return;
 			}
-		}
+			if (!zone.Contacting)
+			{
+				zone.LastContactStart = entry.LastSeen;
+			}
+			zone.ContactThisTick = true;
+		});
 		if (!zone.ContactThisTick && zone.Contacting)
 		{
-			zone.LastContactEnd = ThisImageData.GrabTime;
+			zone.LastContactEnd = TickTime;
 			zone.TimeSpentContacting += zone.LastContactEnd - zone.LastContactStart;
 		}
 		zone.Contacting = zone.ContactThisTick;
 
-		ObjectData obj(ObjectType::Jardiniere, zone.name, Affine3d::Identity(), ThisImageData.GrabTime);
+		ObjectData obj(ObjectType::Jardiniere, zone.name, Affine3d::Identity(), TickTime);
 		obj.metadata["numPlantes"] = zone.NumPlants;
 		obj.metadata["whitePixels"] = NumWhitePixels;
 		if (zone.LastContactStart != ObjectData::TimePoint())
@@ -168,9 +232,21 @@ void PostProcessJardinieres::Process(std::vector<CameraImageData> &ImageData, st
 		}
 		obj.metadata["contacting"] = zone.Contacting;
 		obj.metadata["timeSpentNear"] = chrono::duration_cast<chrono::milliseconds>(zone.TimeSpentContacting).count();
-		Objects.push_back(obj);
+		Output.push_back(obj);
 	}
-	//waitKey(2);
-
+}
 
-}
\ No newline at end of file
+void PostProcessJardinieres::GetRegionsOfInterest(vector<vector<Point3d>> &Regions) const
+{
+	const double PlantHeight = 0.1;
+	for (auto &zone : Stocks)
+	{
+		auto &region = Regions.emplace_back();
+		region.reserve(zone.Corners.size()*2);
+		for (auto &corner : zone.Corners)
+		{
+			region.emplace_back(corner[0], corner[1], corner[2]);
+			region.emplace_back(corner[0], corner[1], corner[2] + PlantHeight);
+		}
+	}
+}
@@ -13,31 +13,37 @@ PostProcess::~PostProcess()
 {
 }
 
-vector<ObjectData> PostProcess::GetEnemyRobots(vector<ObjectData> &Objects) const 
+const ObjectIndex& PostProcess::GetIndex() const
+{
+	assert(Owner != nullptr);
+	return Owner->GetWorkingIndex();
+}
+
+vector<ObjectData> PostProcess::GetEnemyRobots(const vector<ObjectData> &Objects) const 
 {
 	assert(Owner != nullptr);
 	auto OurTeam = Owner->GetTeam();
 	auto EnemyTeam = GetOtherTeam(OurTeam);
-	const string& EnemyTeamName = TeamNames.at(EnemyTeam);
 	vector<ObjectData> robots;
-	for (auto &obj : Objects)
+	GetIndex().ForEach(ObjectType::Robot, [&robots, &Objects, EnemyTeam](const ObjectIndex::Entry& entry)
 	{
-		if (obj.type != ObjectType::Robot)
-		{
-			continue;
-		}
-		if (obj.name.rfind(EnemyTeamName, 0) != 0)
+		if (entry.Team == EnemyTeam)
 		{
-			continue;
+			robots.emplace_back(Objects[entry.Index]);
 		}
-		robots.emplace_back(obj);
-	}
+	});
 	return robots;
 }
 
-void PostProcess::Process(vector<CameraImageData> &ImageData, vector<CameraFeatureData> &FeatureData, vector<ObjectData> &Objects)
+void PostProcess::Process(const vector<CameraImageData> &ImageData, const vector<CameraFeatureData> &FeatureData, const vector<ObjectData> &Objects, vector<ObjectData> &Output)
 {
 	(void) ImageData;
 	(void) FeatureData;
 	(void) Objects;
-}
\ No newline at end of file
+	(void) Output;
+}
+
+void PostProcess::GetRegionsOfInterest(vector<vector<Point3d>> &Regions) const
+{
+	(void) Regions;
+}
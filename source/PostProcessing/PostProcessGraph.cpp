@@ -0,0 +1,119 @@
+#include "PostProcessing/PostProcessGraph.hpp"
+
+#include <PostProcessing/YoloDeflicker.hpp>
+#include <PostProcessing/StockPlants.hpp>
+#include <PostProcessing/Jardinieres.hpp>
+#include <PostProcessing/Template.hpp>
+
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+template<class T>
+unique_ptr<PostProcess> CreatePostProcess(CDFRExternal* Owner)
+{
+	return make_unique<T>(Owner);
+}
+
+map<string, PostProcessGraph::Factory>& PostProcessGraph::GetRegistry()
+{
+	static map<string, Factory> Registry =
+	{
+		{"YoloDeflicker", 	CreatePostProcess<PostProcessYoloDeflicker>},
+		{"StockPlants", 	CreatePostProcess<PostProcessStockPlants>},
+		{"Jardinieres", 	CreatePostProcess<PostProcessJardinieres>},
+		{"Template", 		CreatePostProcess<PostProcessTemplate>}
+	};
+	return Registry;
+}
+
+void PostProcessGraph::Register(const string &Name, Factory Create)
+{
+	GetRegistry()[Name] = Create;
+}
+
+bool PostProcessGraph::Add(const string &Name, CDFRExternal* Owner)
+{
+	auto &registry = GetRegistry();
+	auto found = registry.find(Name);
+	if (found == registry.end())
+	{
+		cerr << "Unknown post process \"" << Name << "\", available post processes are :";
+		for (auto &entry : registry)
+		{
+			cerr << " " << entry.first;
+		}
+		cerr << endl;
+		return false;
+	}
+	Stage stage;
+	stage.Name = Name;
+	stage.Process = found->second(Owner);
+	//Run after every earlier stage that writes something this one reads
+	for (auto &other : Stages)
+	{
+		const auto &writes = other.Process->GetWrites();
+		for (ObjectType type : stage.Process->GetReads())
+		{
+			if (writes.find(type) != writes.end())
+			{
+				stage.Level = max(stage.Level, other.Level+1);
+				break;
+			}
+		}
+	}
+	if ((int)Levels.size() <= stage.Level)
+	{
+		Levels.resize(stage.Level+1);
+	}
+	Levels[stage.Level].push_back(Stages.size());
+	Stages.emplace_back(move(stage));
+	return true;
+}
+
+void PostProcessGraph::Run(const vector<CameraImageData> &ImageData, const vector<CameraFeatureData> &FeatureData,
+	vector<ObjectData> &Objects, ObjectIndex &Index)
+{
+	for (auto &level : Levels)
+	{
+		Index.Build(Objects);
+		auto RunStage = [this, &ImageData, &FeatureData, &Objects](int stageidx)
+		{
+			auto &stage = Stages[stageidx];
+			stage.Output.clear();
+			stage.Profiler.EnterSection(stage.Name);
+			stage.Process->Process(ImageData, FeatureData, Objects, stage.Output);
+			stage.Profiler.EnterSection("");
+		};
+		if (level.size() == 1)
+		{
+			RunStage(level[0]);
+		}
+		else
+		{
+			parallel_for_(Range(0, level.size()), [&level, &RunStage](const Range& range)
+			{
+				for (int i = range.start; i < range.end; i++)
+				{
+					RunStage(level[i]);
+				}
+			});
+		}
+		//Stages of a level are in declaration order
+		for (int stageidx : level)
+		{
+			auto &output = Stages[stageidx].Output;
+			Objects.insert(Objects.end(), output.begin(), output.end());
+		}
+	}
+}
+
+void PostProcessGraph::GetRegionsOfInterest(vector<vector<Point3d>> &Regions) const
+{
+	for (auto &stage : Stages)
+	{
+		stage.Process->GetRegionsOfInterest(Regions);
+	}
+}
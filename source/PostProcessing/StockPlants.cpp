@@ -7,6 +7,8 @@ using namespace cv;
 PostProcessStockPlants::PostProcessStockPlants(CDFRExternal* InOwner)
 	:PostProcess(InOwner)
 {
+	Reads = {ObjectType::Fragile, ObjectType::Resistant, ObjectType::Robot};
+	Writes = {ObjectType::PlantStock};
 	array<string, 6> names = {"Nord Ouest", "Nord", "Nord Est", "Sud Ouest", "Sud", "Sud Est", };
 	for (size_t i = 0; i < Stocks.size(); i++)
 	{
@@ -37,41 +39,41 @@ PostProcessStockPlants::PostProcessStockPlants(CDFRExternal* InOwner)
 	
 }
 
-void PostProcessStockPlants::Process(std::vector<CameraImageData> &ImageData, std::vector<CameraFeatureData> &FeatureData, std::vector<ObjectData> &Objects)
+void PostProcessStockPlants::Process(const std::vector<CameraImageData> &ImageData, const std::vector<CameraFeatureData> &FeatureData, const std::vector<ObjectData> &Objects, std::vector<ObjectData> &Output)
 {
 	(void) ImageData;
 	(void) FeatureData;
+	(void) Objects;
 	for (auto &zone : Stocks)
 	{
 		zone.NumPlants = 0;
 	}
 	
-	for (auto &obj : Objects)
+	//Each object only counts for the first zone it is in, zones overlap once the robot margin is added
+	const ObjectIndex &index = GetIndex();
+	for (ObjectType type : {ObjectType::Fragile, ObjectType::Resistant, ObjectType::Robot})
 	{
-		Vec2d pos2d = obj.GetPos2D();
-		bool plant = obj.type == ObjectType::Fragile || obj.type == ObjectType::Resistant;
-		bool robot = obj.type == ObjectType::Robot;
-		if (!robot && !plant)
+		const bool robot = type == ObjectType::Robot;
+		index.ForEach(type, [this, robot](const ObjectIndex::Entry& entry)
 		{
-			continue;
-		}
-		for (auto &zone : Stocks)
-		{
-			auto delta = pos2d - zone.position;
-			double distance = sqrt(delta.ddot(delta));
-			if (distance < zone.radius + robot * 0.2)
+			for (auto &zone : Stocks)
 			{
-				if (robot)
-				{
-					zone.LastTouched = obj.LastSeen;
-				}
-				else
+				Vec2d delta = entry.Position - zone.position;
+				double radius = zone.radius + robot * 0.2;
+				if (delta.ddot(delta) < radius*radius)
 				{
-					zone.NumPlants++;
+					if (robot)
+					{
+						zone.LastTouched = max(zone.LastTouched, entry.LastSeen);
+					}
+					else
+					{
+						zone.NumPlants++;
+					}
+					break;
 				}
-				break;
 			}
-		}
+		});
 	}
 	
 	for (auto &zone : Stocks)
@@ -85,6 +87,23 @@ void PostProcessStockPlants::Process(std::vector<CameraImageData> &ImageData, st
 			obj.metadata["ageContact"] = chrono::duration_cast<chrono::milliseconds>(ObjectData::Clock::now() - zone.LastTouched).count();
 		}
 		
-		Objects.push_back(obj);
+		Output.push_back(obj);
+	}
+}
+
+void PostProcessStockPlants::GetRegionsOfInterest(vector<vector<Point3d>> &Regions) const
+{
+	const double PlantHeight = 0.1;
+	for (auto &zone : Stocks)
+	{
+		auto &region = Regions.emplace_back();
+		region.reserve(8);
+		for (int corneridx = 0; corneridx < 4; corneridx++)
+		{
+			double x = zone.position[0] + (corneridx%2 ? zone.radius : -zone.radius);
+			double y = zone.position[1] + (corneridx/2 ? zone.radius : -zone.radius);
+			region.emplace_back(x, y, 0);
+			region.emplace_back(x, y, PlantHeight);
+		}
 	}
-}
\ No newline at end of file
+}
@@ -1,10 +1,11 @@
 #include <PostProcessing/Template.hpp>
 #include <EntryPoints/CDFRExternal.hpp>
 
-void PostProcessTemplate::Process(std::vector<CameraImageData> &ImageData, std::vector<CameraFeatureData> &FeatureData, std::vector<ObjectData> &Objects)
+void PostProcessTemplate::Process(const std::vector<CameraImageData> &ImageData, const std::vector<CameraFeatureData> &FeatureData, const std::vector<ObjectData> &Objects, std::vector<ObjectData> &Output)
 {
 	(void) ImageData;
 	(void) FeatureData;
+	(void) Objects;
 	assert(Owner != nullptr);
-	Objects.emplace_back(ObjectType::Team, TeamNames.at(Owner->GetTeam()));
+	Output.emplace_back(ObjectType::Team, TeamNames.at(Owner->GetTeam()));
 }
\ No newline at end of file
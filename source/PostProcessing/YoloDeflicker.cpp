@@ -1,6 +1,8 @@
 #include <PostProcessing/YoloDeflicker.hpp>
 #include <EntryPoints/CDFRExternal.hpp>
 #include <iostream>
+#include <cmath>
+#include <climits>
 
 using namespace std;
 
@@ -9,73 +11,94 @@ bool PostProcessYoloDeflicker::IsYolo(const ObjectData& obj)
 	return obj.type >= ObjectType::Fragile && obj.type <= ObjectType::PottedPlant;
 }
 
-void PostProcessYoloDeflicker::Process(vector<CameraImageData> &ImageData, vector<CameraFeatureData> &FeatureData, vector<ObjectData> &Objects)
+void PostProcessYoloDeflicker::Process(const vector<CameraImageData> &ImageData, const vector<CameraFeatureData> &FeatureData, const vector<ObjectData> &Objects, vector<ObjectData> &Output)
 {
 	(void) ImageData;
-	(void) FeatureData;
-	for (auto &cacheobj : CachedObjects)
+	Grid.Clear();
+	for (size_t i = 0; i < CachedObjects.size(); i++)
 	{
-		cacheobj.Associated = false;
+		CachedObjects[i].Associated = false;
+		Grid.Insert(i, CachedObjects[i].GetPos2D());
 	}
 	int numnew=0, numlinked=0;
-	for (auto &obj : Objects)
+	for (auto &camera : FeatureData)
 	{
-		if (!IsYolo(obj))
-		{
-			continue;
-		}
-		bool associated = false;
-		for (auto &cacheobj : CachedObjects)
+		for (auto &proj : camera.YoloProjections)
 		{
-			if (cacheobj == obj)
+			//closest cached object in the neighbouring cells
+			int match = -1;
+			double bestdistance = INFINITY;
+			Grid.Query(proj.Position, AssociationRadius, [this, &proj, &match, &bestdistance](int idx)
+			{
+				auto &cacheobj = CachedObjects[idx];
+				if (!cacheobj.Matches(proj))
+				{
+					return;
+				}
+				cv::Vec2d delta = proj.Position - cacheobj.GetPos2D();
+				double distance = delta.ddot(delta);
+				if (distance < bestdistance)
+				{
+					bestdistance = distance;
+					match = idx;
+				}
+			});
+			if (match >= 0)
 			{
-				cacheobj+=obj;
-				associated = true;
+				auto &cacheobj = CachedObjects[match];
+				cv::Vec2d oldpos = cacheobj.GetPos2D();
+				cacheobj.Merge(proj, camera.YoloGrabTime);
+				Grid.Move(match, oldpos, cacheobj.GetPos2D());
 				numlinked++;
-				break;
+				continue;
 			}
+			Grid.Insert(CachedObjects.size(), proj.Position);
+			CachedObjects.emplace_back(proj, camera.YoloGrabTime, NextTrackID);
+			NextTrackID = NextTrackID == INT_MAX ? 0 : NextTrackID+1; //wraps before reaching -1, which means unique
+			numnew++;
 		}
-		if (associated)
+	}
+	//Forget objects that expired or that are under a robot
+	auto time_threshold = ObjectData::Clock::now();
+	RemoveScratch.resize(CachedObjects.size());
+	for (size_t i = 0; i < CachedObjects.size(); i++)
+	{
+		auto &obj = CachedObjects[i];
+		RemoveScratch[i] = !obj.Associated && (obj.Lifetime < time_threshold);
+	}
+	for (auto &obj : Objects)
+	{
+		if (obj.type != ObjectType::Robot)
 		{
 			continue;
 		}
-		CachedObjects.emplace_back(obj);
-		numnew++;
+		cv::Vec2d robotpos2d = obj.GetPos2D();
+		Grid.Query(robotpos2d, RobotClearRadius, [this, robotpos2d](int idx)
+		{
+			auto delta = CachedObjects[idx].GetPos2D()-robotpos2d;
+			if (delta.ddot(delta) < RobotClearRadius*RobotClearRadius)
+			{
+				RemoveScratch[idx] = true;
+			}
+		});
 	}
-	auto time_threshold = ObjectData::Clock::now();
-	auto cache_erase_iterator = std::remove_if(CachedObjects.begin(), 
-		CachedObjects.end(),
-		[time_threshold](YoloObject &obj) { return !obj.Associated && (obj.Lifetime < time_threshold); });
-	//cout << numnew << " new in cache, " << numlinked << " relinked, " << CachedObjects.end() - cache_erase_iterator << " to be deleted, ";
-	CachedObjects.erase(cache_erase_iterator, CachedObjects.end());
-	//cout << CachedObjects.size() << " still in cache" << endl;
-	//cout << "Vector before yolo erase: " << Objects.size() <<endl;
-	Objects.erase(
-		std::remove_if(Objects.begin(), 
-			Objects.end(),
-			&PostProcessYoloDeflicker::IsYolo),
-		Objects.end());
-	//cout << "Vector after yolo erase: " << Objects.size() <<endl;
-	for (auto &obj : Objects)
+	size_t kept = 0;
+	for (size_t i = 0; i < CachedObjects.size(); i++)
 	{
-		if (obj.type == ObjectType::Robot)
+		if (RemoveScratch[i])
 		{
-			cv::Vec2d robotpos2d = obj.GetPos2D();
-			CachedObjects.erase(
-				std::remove_if(
-					CachedObjects.begin(), CachedObjects.end(),
-					[robotpos2d](YoloObject &yobj){
-						cv::Vec2d pos2d = yobj.GetPos2D();
-						auto delta = pos2d-robotpos2d;
-						return delta.ddot(delta) < 0.15*0.15;
-					}
-				),
-				CachedObjects.end()
-			);
+			continue;
 		}
+		if (kept != i)
+		{
+			CachedObjects[kept] = move(CachedObjects[i]);
+		}
+		kept++;
 	}
+	//cout << numnew << " new in cache, " << numlinked << " relinked, " << CachedObjects.size() - kept << " deleted, ";
+	CachedObjects.erase(CachedObjects.begin() + kept, CachedObjects.end());
+	//cout << CachedObjects.size() << " still in cache" << endl;
 	
-	
-	Objects.insert(Objects.end(), CachedObjects.begin(), CachedObjects.end());
+	Output.insert(Output.end(), CachedObjects.begin(), CachedObjects.end());
 	//cout << "Vector after re-adding: " << Objects.size() <<endl;
-}
\ No newline at end of file
+}
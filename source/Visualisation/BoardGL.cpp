@@ -446,7 +446,7 @@ void BoardGL::ThreadEntryPoint()
 	LoadTags();
 	while (!killed && !Parent->IsKilled())
 	{
-		closed = !Tick(ObjectData::ToGLObjects(Parent->GetObjectData()));
+		closed = !Tick(Parent->GetObjectSnapshot()->ToGLObjects());
 		killed |= closed;		
 	}
 	killed = true;
@@ -5,6 +5,7 @@
 #include <Misc/math2d.hpp>
 #include <EntryPoints/CDFRExternal.hpp>
 #include <EntryPoints/CDFRCommon.hpp>
+#include <DetectFeatures/YoloInferenceService.hpp>
 #include <Cameras/ImageTypes.hpp>
 #include <Visualisation/BoardGL.hpp>
 
@@ -222,6 +223,7 @@ void ImguiWindow::ThreadEntryPoint()
 				ImGui::Checkbox("Segmented detection", &entry.second.SegmentedDetection);
 				ImGui::Checkbox("POI Detection", &entry.second.POIDetection);
 				ImGui::Checkbox("Yolo detection", &entry.second.YoloDetection);
+				ImGui::Checkbox("Yolo tiled", &entry.second.YoloTiled);
 				ImGui::Checkbox("Denoising", &entry.second.Denoising);
 				ImGui::Spacing();
 			}
@@ -328,7 +330,7 @@ void ImguiWindow::ThreadEntryPoint()
 				{
 					auto det = FeatData.YoloDetections[detidx];
 					uint8_t r,g,b;
-					HsvConverter::getRgbFromHSV(1530*det.Class/Parent->YoloDetector->GetNumClasses(), 255, 255, r, g, b);
+					HsvConverter::getRgbFromHSV(1530*det.Class/Parent->YoloService->GetDetector().GetNumClasses(), 255, 255, r, g, b);
 					uint32_t color = IM_COL32(r,g,b,det.Confidence*255);
 					
 					Point2d textpos(0,0);
@@ -336,7 +338,7 @@ void ImguiWindow::ThreadEntryPoint()
 					auto br = ImageRemap<double>(SourceRemap, DestRemap, det.Corners.br());
 					DrawList->AddRect(tl, br, color);
 					//text with class and confidence
-					string text = Parent->YoloDetector->GetClassName(det.Class) + string("\n") + to_string(int(det.Confidence*100));
+					string text = Parent->YoloService->GetDetector().GetClassName(det.Class) + string("\n") + to_string(int(det.Confidence*100));
 					DrawList->AddText(nullptr, 16, tl, color, text.c_str());
 				}
 			}
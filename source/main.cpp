@@ -26,6 +26,8 @@
 
 #include <Communication/AdvertiseMV.hpp>
 #include <Communication/TCPJsonHost.hpp>
+#include <Communication/PositionBroadcaster.hpp>
+#include <Communication/SharedMemoryPublisher.hpp>
 #include <Communication/Transport/GenericTransport.hpp>
 
 #include <DetectFeatures/YoloDetect.hpp>
@@ -192,12 +194,28 @@ int main(int argc, char** argv )
 	{
 		//AdvertiseMV advertiser;
 		TCPJsonHost JsonHost(50667);
+		PositionBroadcaster Broadcaster(50668);
+		SharedMemoryPublisher SharedMemory;
 		
 		CDFRExternal ExternalCameraHost;
 		CDFRInternal InternalCameraHost;
 
 		JsonHost.ExternalRunner = &ExternalCameraHost;
 		JsonHost.InternalRunner = &InternalCameraHost;
+		ExternalCameraHost.AddTickListener([&JsonHost]()
+		{
+			JsonHost.NotifyTick();
+		});
+		//Positions go out on UDP straight from the detection thread, without waiting on the json clients
+		ExternalCameraHost.AddTickListener([&Broadcaster, &ExternalCameraHost]()
+		{
+			Broadcaster.Publish(*ExternalCameraHost.GetObjectSnapshot());
+		});
+		//Same for the consumers on this machine
+		ExternalCameraHost.AddTickListener([&SharedMemory, &ExternalCameraHost]()
+		{
+			SharedMemory.Publish(*ExternalCameraHost.GetObjectSnapshot(), ExternalCameraHost.GetFeatureData());
+		});
 
 		while (!ExternalCameraHost.IsKilled() && !JsonHost.IsKilled() && !killrequest)
 		{
@@ -0,0 +1,110 @@
+/*
+ * Reads the ticks cyclops publishes to shared memory, and checks them.
+ * Usage : shm_reader [number of ticks, default 100] [shared memory name, default /cyclops]
+ * Prints the robots of every tick and the latency from publish to read. Exits with 1 if a tick is torn or goes back.
+ */
+
+#define _GNU_SOURCE /* clock_gettime and syscall with -std=c11 */
+#include <Communication/SharedMemoryLayout.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TYPE_ROBOT 11 /* ObjectType::Robot */
+#define TYPE_PAMI 12 /* ObjectType::Pami */
+
+int main(int argc, char** argv)
+{
+	int count = argc > 1 ? atoi(argv[1]) : 100;
+	const char* name = argc > 2 ? argv[2] : CYCLOPS_SHM_NAME;
+
+	/* Read write, waiting registers in the region */
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd == -1)
+	{
+		perror("shm_open, is cyclops running ?");
+		return 1;
+	}
+	cyclops_shm_region* region = mmap(NULL, sizeof(cyclops_shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (region == MAP_FAILED)
+	{
+		perror("mmap");
+		return 1;
+	}
+	if (__atomic_load_n(&region->magic, __ATOMIC_ACQUIRE) != CYCLOPS_SHM_MAGIC || region->version != CYCLOPS_SHM_VERSION
+		|| region->size != sizeof(cyclops_shm_region))
+	{
+		fprintf(stderr, "Shared memory %s has another layout than this reader (version %u, %llu bytes)\n", 
+			name, region->version, (unsigned long long)region->size);
+		return 1;
+	}
+
+	static cyclops_shm_frame frame; /* too big for the stack */
+	struct timespec timeout = {1, 0};
+	uint32_t seen = __atomic_load_n(&region->tick_futex, __ATOMIC_ACQUIRE);
+	uint64_t last_tick = 0, skipped = 0, latency_sum = 0, latency_max = 0, copy_sum = 0;
+	int failed = 0, reads = 0, timeouts = 0;
+	while (reads < count)
+	{
+		uint32_t now_seen = cyclops_shm_wait(region, seen, &timeout);
+		if (now_seen == seen)
+		{
+			printf("No tick for 1s\n");
+			if (++timeouts >= 5)
+			{
+				failed = 1;
+				break;
+			}
+			continue;
+		}
+		timeouts = 0;
+		seen = now_seen;
+		uint64_t start = cyclops_shm_now_us();
+		if (cyclops_shm_read(region, &frame) != 0)
+		{
+			continue;
+		}
+		reads++;
+		uint64_t end = cyclops_shm_now_us();
+		uint64_t latency = end - frame.publish_time_us;
+		latency_sum += latency;
+		latency_max = latency > latency_max ? latency : latency_max;
+		copy_sum += end - start;
+		if (frame.tick <= last_tick || frame.num_objects > CYCLOPS_SHM_MAX_OBJECTS || frame.num_cameras > CYCLOPS_SHM_MAX_CAMERAS)
+		{
+			fprintf(stderr, "Tick %llu is inconsistent (previous %llu, %u objects, %u cameras)\n", 
+				(unsigned long long)frame.tick, (unsigned long long)last_tick, frame.num_objects, frame.num_cameras);
+			failed = 1;
+		}
+		if (last_tick != 0 && frame.tick > last_tick + 1)
+		{
+			skipped += frame.tick - last_tick - 1;
+		}
+		last_tick = frame.tick;
+
+		printf("Tick %llu : %u objects, %u cameras, capture %llu us ago, published %llu us ago\n", (unsigned long long)frame.tick, 
+			frame.num_objects, frame.num_cameras, (unsigned long long)(end - frame.capture_time_us), (unsigned long long)latency);
+		for (uint32_t j = 0; j < frame.num_objects; j++)
+		{
+			const cyclops_shm_object* object = &frame.objects[j];
+			if (object->type != TYPE_ROBOT && object->type != TYPE_PAMI)
+			{
+				continue;
+			}
+			printf("\t%.*s : x=%.3f y=%.3f age=%ums\n", CYCLOPS_SHM_NAME_LENGTH, object->name, 
+				object->position[0], object->position[1], object->age_ms);
+		}
+	}
+	if (reads > 0)
+	{
+		printf("Publish to read latency : average %llu us, max %llu us. Copy : average %llu us. Skipped ticks : %llu\n", 
+			(unsigned long long)(latency_sum / reads), (unsigned long long)latency_max, 
+			(unsigned long long)(copy_sum / reads), (unsigned long long)skipped);
+	}
+	munmap(region, sizeof(cyclops_shm_region));
+	close(fd);
+	return failed;
+}